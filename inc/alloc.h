@@ -20,9 +20,31 @@
 #define ALLOC_H
 
 #include <stddef.h>
+#include <stdio.h>
 
-#define alloc(p, elem) alloc_(p, sizeof *(p), elem);
+/* Subsystem owning a given heap block. Used for accounting only. */
+enum alloc_tag
+{
+    ALLOC_FILE_BUF,
+    ALLOC_LABEL_NAME,
+    ALLOC_CALL_LIST,
+    ALLOC_OUTPUT_NAME,
+    ALLOC_TABLE,
+    ALLOC_LOG,
 
-void *alloc_(void *p, size_t sz, size_t elem);
+    N_ALLOC_TAGS
+};
+
+#define alloc(p, elem, tag) alloc_(p, sizeof *(p), elem, tag)
+#define alloc_grow(p, elem, tag) alloc_grow_(p, sizeof *(p), elem, tag)
+
+/* Grows p to elem + 1 elements of sz bytes. p is released on failure. */
+void *alloc_(void *p, size_t sz, size_t elem, enum alloc_tag tag);
+/* Same as alloc_(), but p is kept on failure, still owned by the caller. */
+void *alloc_grow_(void *p, size_t sz, size_t elem, enum alloc_tag tag);
+void *alloc_buf(size_t sz, enum alloc_tag tag);
+void alloc_free(void *p);
+void enable_alloc_stats(void);
+void alloc_report(FILE *f);
 
 #endif /* ALLOC_H */
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include "context.h"
+#include "remove_unused.h"
+
+/* Adds spans to p for unreachable lines within labels kept by
+ * cfg, e.g.: code following a return that no local label leads
+ * to. Spans are appended unsorted. Returns 0 or ENOMEM. */
+int plan_blocks(const struct sdccrm *c, const struct config *cfg, const struct file *f, const char *text,
+    struct plan *p);
+
+#endif /* BLOCKS_H */
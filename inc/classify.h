@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Line kinds, in decreasing order of priority. */
+enum line_kind
+{
+    LINE_OTHER,
+    /* .globl directive. Operand: declared symbol. */
+    LINE_GLOBAL,
+    /* ".area" whose first operand token is a code area of the
+     * port, e.g.: "CODE" on stm8, "_CODE" on z80 or "CSEG" on
+     * mcs51, whatever follows it, e.g.: ".area CSEG    (CODE)".
+     * No operand. */
+    LINE_AREA_CODE,
+    /* Function label. Operand: label name, without ':'. */
+    LINE_LABEL,
+    /* Call instruction, or jump to another label. Operand:
+     * everything after the mnemonic and any condition code. */
+    LINE_CALL,
+    /* Immediate address operand. Operand: referenced symbol. */
+    LINE_REF,
+    /* Data directive holding addresses, e.g.: ".dw _f" or "int _f".
+     * Operand: everything after the directive. */
+    LINE_DATA
+};
+
+struct line_info
+{
+    enum line_kind kind;
+    /* View into the classified line. Null-terminated only for
+     * LINE_GLOBAL, LINE_CALL and LINE_DATA, which extend to the
+     * end of line. */
+    const char *operand;
+    size_t operand_len;
+    /* Line contains ".area", which ends any label span. */
+    bool area;
+};
+
+enum
+{
+    CHAR_SPACE = 1 << 0,
+    /* Letters, digits, '_' and '$', e.g.: "_f" or "C$main$0". */
+    CHAR_SYMBOL = 1 << 1
+};
+
+extern const unsigned char char_class[256];
+
+static inline bool is_space(const char c)
+{
+    return char_class[(unsigned char)c] & CHAR_SPACE;
+}
+
+static inline bool is_symbol_char(const char c)
+{
+    return char_class[(unsigned char)c] & CHAR_SYMBOL;
+}
+
+/* Effect of an instruction on the stack pointer. */
+struct stack_effect
+{
+    /* Bytes pushed (positive) or released (negative). */
+    long delta;
+    /* Return address size for call instructions, 0 otherwise. */
+    unsigned call;
+    bool ret;
+    bool iret;
+};
+
+/* Call, return and jump mnemonics of the same reach, e.g.: "call",
+ * "ret" and "jp", so "call _f" followed by "ret" can be "jp _f". */
+struct tail
+{
+    const char *call;
+    const char *ret;
+    const char *jump;
+    /* Reaches any address, e.g.: stm8 "callf", instead of only those
+     * within the same 64 KB section. */
+    bool far;
+};
+
+/* Assembler syntax and instruction set of an SDCC port. */
+struct port;
+
+/* Returns the port named as given to --port, e.g.: "z80", the
+ * default one (stm8) if name is NULL, or NULL if unknown. */
+const struct port *find_port(const char *name);
+const char *port_name(const struct port *port);
+void classify(const struct port *port, const char *line, size_t len, struct line_info *li);
+/* Returns whether an area name, not null-terminated, e.g.: "CSEG"
+ * on mcs51, is one of the areas holding functions on port. */
+bool is_code_area(const struct port *port, const char *name, size_t len);
+/* Bytes pushed by hardware on interrupt entry. */
+size_t interrupt_frame(const struct port *port);
+/* Returns whether execution never continues after line, e.g.:
+ * returns and unconditional jumps. */
+bool ends_block(const struct port *port, const char *line);
+/* Returns the tail line starts with the call or jump mnemonic
+ * of, telling which one by *call, or NULL. */
+const struct tail *find_tail(const struct port *port, const char *line, bool *call);
+/* Returns false if the instruction does not affect the stack. */
+bool stack_effect(const struct port *port, const char *line, struct stack_effect *se);
+/* Rough number of bytes emitted by a line. Data directives are
+ * counted from their operands, while instructions are assumed to
+ * take one byte plus two per address or one per any other number. */
+size_t estimate_size(const char *line, const struct line_info *li);
+
+#endif /* CLASSIFY_H */
@@ -19,9 +19,12 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include "classify.h"
 #include <stddef.h>
 #include <stdbool.h>
 
+#define AREA_DIRECTIVE ".area"
+
 enum
 {
     /* Defined by SDCC's assembly specifications. */
@@ -54,6 +57,14 @@ struct tree
 {
     struct file *files;
     size_t n_files;
+    /* Label graph, built once all inputs are known (see graph.h).
+     * labels[] is indexed by label id, by_name[] is sorted by name. */
+    struct label **labels;
+    struct label **by_name;
+    size_t n_labels;
+    /* Ids of labels referenced by struct file roots. */
+    size_t *roots;
+    size_t n_roots;
 };
 
 struct file
@@ -61,17 +72,39 @@ struct file
     struct label *labels;
     const char *name;
     size_t n_labels;
+    /* Symbols declared by .globl directives, in file order. */
+    char **globals;
+    size_t n_globals;
+    /* Labels referenced from outside any label, e.g.: by interrupt
+     * vector tables, which are always kept. */
+    char **roots;
+    size_t n_roots;
 };
 
 struct label
 {
     bool global;
-    bool used;
     char *name;
     char **calls;
     size_t n_calls;
     size_t start_line;
     size_t end_line;
+    /* Peak stack bytes used by the label itself and, for each
+     * entry in calls, bytes in use when calling, including the
+     * return address. */
+    size_t frame;
+    size_t *call_depths;
+    /* Label returns through iret, i.e.: an interrupt handler. */
+    bool interrupt;
+    /* Bytes emitted, only estimated for assembly inputs. */
+    size_t size;
+    /* Filled in by resolve_graph(). callee_depths is
+     * parallel to callees, as call_depths is to calls. */
+    size_t id;
+    size_t file;
+    size_t *callees;
+    size_t *callee_depths;
+    size_t n_callees;
 };
 
 typedef struct
@@ -79,10 +112,110 @@ typedef struct
     bool global;
 } labell;
 
+/* Line found by scan_line(). */
+struct text_line
+{
+    const char *start;
+    size_t len;
+};
+
+/* Union-find over items 0 to pinned - 1, plus pinned itself, which
+ * is always the root of its set so it can be told apart. Bytes held
+ * by every set are only valid for roots. */
+struct sets
+{
+    size_t *parent;
+    size_t *size;
+    size_t pinned;
+};
+
+/* Set found by find_set(), and the bytes it holds. */
+struct set_size
+{
+    size_t root;
+    size_t size;
+};
+
+/* Line walked by scan_areas(). */
+struct scanned_line
+{
+    enum
+    {
+        /* First line of f->labels[owner]. */
+        SCANNED_LABEL,
+        /* .area directive. */
+        SCANNED_AREA,
+        /* Any other line, classified into li. */
+        SCANNED_OTHER
+    } kind;
+
+    size_t ln;
+    const char *line;
+    size_t len;
+    struct line_info li;
+    /* Label whose span holds the line, as an index into f->labels,
+     * or SIZE_MAX. */
+    size_t owner;
+    /* Line found in a code area. */
+    bool code;
+};
+
+/* Returns 0 to go on walking lines, or an errno value. */
+typedef int (*scan_areas_fn)(void *arg, const struct scanned_line *sl);
+
+/* Growable, NUL-terminated text buffer. */
+struct strbuf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
 const char *get_line(const char *p, char *const line, size_t *const len);
-char *open(const char *path);
+/* Returns the end of the next line, which starts at *start,
+ * or NULL once no lines are left. */
+const char *scan_line(const char *p, const char **start);
+/* Returns every line found by scan_line(), indexed by line number
+ * minus one, or NULL. */
+struct text_line *index_lines(const char *text, size_t *n);
+/* Copies a line into line, truncated as get_line() does. Returns
+ * its length, without the null terminator. */
+size_t copy_line(const struct text_line *tl, char *line);
+/* Walks every line of f, numbered as by index_lines(), calling fn
+ * on each. Kept labels, by used[id], execution might fall into from
+ * the previous one are joined with it in s, or with s->pinned when
+ * falling from anything else, e.g.: the previous label is not kept
+ * or other areas come in between. Label k stands for item base + k,
+ * e.g.: its id when base is the id of the first one. */
+int scan_areas(const struct port *port, const struct file *f, const struct text_line *lines, size_t n_lines,
+    const bool *used, size_t base, struct sets *s, scan_areas_fn fn, void *arg);
+/* Returns the last line of l, in a file of n_lines lines. */
+size_t label_end(const struct label *l, size_t n_lines);
+/* Returns the length of the name given to an .area directive,
+ * e.g.: "CSEG" in ".area CSEG    (CODE)", pointed to by *name. */
+size_t area_name(const char *line, const char **name);
+/* Returns whether line defines a local label, e.g.: "00102$:",
+ * storing its number into *label. */
+bool is_local_label(const char *line, unsigned long *label);
+/* Finds the next local label named from *p onwards, e.g.: 00102 in
+ * "jrne 00102$", storing its number into *label and moving *p past
+ * it. Returns false once none is left. */
+bool next_local(const char *line, const char **p, unsigned long *label);
+/* Sets every item apart, with no bytes. Returns 0 or ENOMEM. */
+int init_sets(struct sets *s, size_t n);
+void free_sets(struct sets *s);
+size_t find_set(struct sets *s, size_t i);
+void join_sets(struct sets *s, size_t a, size_t b);
+/* Largest first, ties in a stable order, for qsort(). */
+int compare_set_sizes(const void *a, const void *b);
+/* Returns a NUL-terminated copy of a non-empty file. len is optional,
+ * and is set to 0 when the file is empty. */
+char *read_file(const char *path, size_t *len);
 const char *get_global(const char *line);
-bool verbose(void);
-void enable_verbose(void);
+bool is_label(const char *line, size_t length);
+bool is_call(const char *line);
+const char *get_ref(const char *line);
+const char *get_call(const char *line);
+bool strbuf_append(struct strbuf *b, const char *s, size_t len);
 
 #endif /* SDCCRM_COMMON_H */
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "sdccrm.h"
+#include "common.h"
+#include "exclude.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct trampoline;
+
+struct input
+{
+    char *name;
+    /* NULL for inputs added from summaries. */
+    char *buf;
+    size_t len;
+    /* Text checksum, only kept for inputs added from summaries. */
+    uint64_t checksum;
+    /* Read from the path given by name, which can be copied as is. */
+    bool from_file;
+};
+
+/* Entry label and exclusions for one analysis. configs[0] holds
+ * the defaults, inherited by any named configuration. */
+struct config
+{
+    char *name;
+    char *entry_label;
+    struct exclusions excluded;
+    /* Labels listed for removal, e.g.: as found from object files.
+     * When given, any other global label is kept. */
+    struct exclusions removals;
+    bool has_removals;
+    /* Indexed by label id. Only valid during sdccrm_run(). */
+    bool *used;
+    /* Indexed by label id, only allocated for reports. */
+    size_t *pred;
+    /* Indexed by label id, only found when c->window is set and
+     * valid while cfg->used is. */
+    size_t *windows;
+};
+
+/* Definition of the opaque libsdccrm context. */
+struct sdccrm
+{
+    enum sdccrm_log_level log_level;
+    enum sdccrm_log_format log_format;
+    FILE *log;
+    const struct port *port;
+    /* Unreachable lines within kept labels are removed too. */
+    bool remove_blocks;
+    bool peephole;
+    /* Indexed by label id, only found by sdccrm_run() when
+     * peephole is enabled (see peephole.h). */
+    struct trampoline *trampolines;
+    /* Bytes per window labels are placed into, or 0 to leave
+     * labels where they are (see layout.h). */
+    size_t window;
+    /* Modules every output is split into, or 0 (see split.h). */
+    size_t split;
+    struct config *configs;
+    size_t n_configs;
+    struct input *inputs;
+    size_t n_inputs;
+    struct tree tree;
+    struct sdccrm_result *results;
+    /* Parallel to results. */
+    struct plan *plans;
+    size_t n_results;
+};
+
+const char *get_entry_label(const struct sdccrm *c, const struct config *cfg);
+bool is_label_excluded(const struct sdccrm *c, const struct config *cfg, const struct label *l);
+
+#endif /* CONTEXT_H */
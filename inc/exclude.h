@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EXCLUDE_H
+#define EXCLUDE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Set of labels excluded from removal. Exact names are kept in a
+ * hash set, while glob patterns ('*', '?' and '[...]') are compiled
+ * into a sequence of matching instructions. */
+struct exclusions
+{
+    char **names;
+    size_t n_names;
+    size_t cap;
+    struct pattern *patterns;
+    size_t n_patterns;
+};
+
+/* Returns 0 on success, EEXIST if already present or ENOMEM. */
+int exclusions_add(struct exclusions *e, const char *pattern);
+int exclusions_add_file(struct exclusions *e, const char *path);
+bool exclusions_match(const struct exclusions *e, const char *name);
+void exclusions_free(struct exclusions *e);
+
+#endif /* EXCLUDE_H */
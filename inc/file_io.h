@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <stddef.h>
+
+/* Called in path order for every file read. buf is NUL-terminated
+ * and owned by the callee. A non-zero return stops reading. */
+typedef int (*read_done_fn)(void *arg, size_t i, char *buf, size_t len);
+
+/* Both return 0 on success or an errno value. read_files() stops
+ * at the first file that cannot be read, while write_files()
+ * attempts every file and returns the first error found. */
+int read_files(size_t n, const char *const *paths, read_done_fn done, void *arg);
+int write_files(size_t n, const char *const *paths, const char *const *bufs, const size_t *lens);
+/* Copies src into dst without reading it, through a reflink if the
+ * filesystem supports it, or copy_file_range() otherwise. Returns 0
+ * or an errno value, e.g.: ENOTSUP on systems other than Linux. */
+int copy_file(const char *src, const char *dst);
+
+#endif /* FILE_IO_H */
@@ -19,8 +19,12 @@
 #ifndef FUNCTION_LIST_H
 #define FUNCTION_LIST_H
 
-#include <stddef.h>
+#include "context.h"
 
-struct tree get_function_list(const size_t n_files, const char *const *files);
+struct file get_function_list(const struct sdccrm *c, const struct input *in);
+/* Same as get_function_list(), but always on the calling thread
+ * and line by line, as a reference for the chunked tokenizer. */
+struct file get_function_list_serial(const struct sdccrm *c, const struct input *in);
+void free_file(struct file *f);
 
 #endif /* FUNCTION_LIST_H */
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "common.h"
+
+/* Resolves call and reference names into label ids once, so
+ * reachability can be run any number of times without any further
+ * string comparison. A name resolves to every global label with
+ * that name, plus any static label with that name in the same file.
+ * Returns 0 on success or ENOMEM. */
+int resolve_graph(struct tree *t);
+void free_graph(struct tree *t);
+/* Returns the first label, in file order, named as given, or NULL. */
+const struct label *find_label(const struct tree *t, const char *name);
+/* Returns the id of the only label named as given visible from
+ * file, or SIZE_MAX if there is none or more than one. */
+size_t resolve_label(const struct tree *t, size_t file, const char *name);
+
+#endif /* GRAPH_H */
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "context.h"
+#include "remove_unused.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* Fills cfg->windows, indexed by label id, with the window every
+ * kept label in a code area is placed into, or SIZE_MAX for any
+ * other label. Windows are c->window bytes long, and window 0 is
+ * the area labels are found in. Requires cfg->used. Returns 0 or
+ * ENOMEM. */
+int place_labels(const struct sdccrm *c, struct config *cfg);
+/* Adds edits to p so every label placed into another window than
+ * the one before it is preceded by an .area directive for its
+ * window, e.g.: ".area CODE_1". Returns 0 or ENOMEM. */
+int plan_layout(const struct sdccrm *c, const struct config *cfg, size_t file, const char *text, struct plan *p);
+/* Prints every window and the labels placed into it to f. */
+int report_layout(const struct sdccrm *c, const struct config *cfg, FILE *f);
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include "sdccrm.h"
+#include "context.h"
+#include <stddef.h>
+
+/* Records are only formatted when their level is enabled, so
+ * disabled ones cost a single comparison. file and symbol may
+ * be NULL. */
+#define LOG(c, level, file, symbol, ...)                                \
+    do                                                                  \
+    {                                                                   \
+        if ((c)->log_level >= (level))                                  \
+            log_record((c), (level), __func__, (file), (symbol), __VA_ARGS__); \
+    } while (0)
+
+#define WARNING(c, file, symbol, ...) LOG(c, SDCCRM_LOG_WARNING, file, symbol, __VA_ARGS__)
+
+/* Formatted records, one per line, waiting to be written. Warnings
+ * are kept apart, as they go to stderr unless a log stream is set. */
+struct log_buf
+{
+    struct log_text
+    {
+        char *data;
+        size_t len;
+        size_t size;
+    } out, warnings;
+};
+
+/* Records from the calling thread go to b until bound to NULL, so
+ * concurrent jobs can be written in a fixed order afterwards. By
+ * default, every thread writes through a buffer of its own. */
+void log_bind(struct log_buf *b);
+void log_record(const struct sdccrm *c, enum sdccrm_log_level level, const char *func,
+    const char *file, const char *symbol, const char *fmt, ...);
+/* Writes and releases b, or the own buffer of the calling thread if NULL. */
+void log_flush(const struct sdccrm *c, struct log_buf *b);
+
+#endif /* LOG_H */
@@ -19,36 +19,54 @@
 #ifndef OPTIONS_H
 #define OPTIONS_H
 
+#include "sdccrm.h"
 #include <stdbool.h>
-#include <stdio.h>
 
-/* Defines default main label. */
-#define DEFAULT_ENTRY_LABEL "_main"
+/* Separates files when reading from stdin and writing to stdout.
+ * Starts with ';' so the assembler treats it as a comment. */
+#define FILE_MARKER ";sdccrm-file "
 
-#define WARNING(str, ...)                                   \
-    if (verbose())                                          \
-    {                                                       \
-        fprintf(stderr, "%s(), %d: (warning) " str ".\n",   \
-            __func__, __LINE__, __VA_ARGS__);               \
-    }
+/* Where output files for a configuration are written to. NULL
+ * members mean the default: next to the input, or into a
+ * directory named after the configuration, using suffix "rm". */
+struct output
+{
+    const char *config;
+    const char *dir;
+    const char *suffix;
+};
 
-#define LOG(str, ...)                           \
-    if (verbose())                              \
-    {                                           \
-        printf("%s(), %d: " str ".\n",          \
-            __func__, __LINE__, __VA_ARGS__);   \
-    }
+enum mode
+{
+    MODE_DEFAULT,
+    /* Writes a summary next to every input. */
+    MODE_SUMMARIZE,
+    /* Reads summaries and writes removal plans. */
+    MODE_MERGE,
+    /* Applies removal plans to their inputs. */
+    MODE_APPLY,
+    /* Reads object files and writes removal lists. */
+    MODE_REL,
+    /* Checks results against the reference engine, writing nothing. */
+    MODE_VERIFY
+};
 
-bool verbose(void);
 bool replace(void);
-const char *get_entry_label(void);
-void set_entry_label(const char *const l);
-void enable_verbose(void);
-void enable_replace(void);
-void exclude_label(const char *const l);
-bool is_label_excluded(const char *const l);
-void options_cleanup(void);
-int parse_options(const int offset, const int argc, const char *const *const argv, bool *const exit);
+enum mode mode(void);
+bool stack(void);
+bool layout(void);
+bool split(void);
+/* Labels given by --why. */
+size_t n_why(void);
+const char *why(size_t i);
+bool why_all(void);
+/* name is a configuration name as given by --config, or NULL. */
+const struct output *get_output(const char *name);
+void free_options(void);
+/* Returns the index of the first file in argv. *exit is set
+ * if nothing else should be done, e.g.: after --version, or
+ * after an invalid option, with errno set to the error. */
+int parse_options(struct sdccrm *c, const int offset, const int argc, const char *const *const argv, bool *const exit);
 void usage(void);
 void show_version(void);
 
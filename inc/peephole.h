@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "context.h"
+#include "remove_unused.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Label whose only line is a jump to another label. */
+struct trampoline
+{
+    /* Final target id, after any chain of trampolines, or SIZE_MAX
+     * if the label is not a trampoline. */
+    size_t target;
+    const struct tail *tail;
+    /* Every reference is retargeted, so the trampoline itself is
+     * bypassed when finding references. */
+    bool bypass;
+};
+
+/* Fills c->trampolines, indexed by label id. Requires
+ * resolve_graph(). Returns 0 or ENOMEM. */
+int find_trampolines(struct sdccrm *c);
+/* Adds edits and spans to p so calls followed by a return become
+ * jumps, and calls or jumps to trampolines go to their targets.
+ * Spans are appended unsorted. Returns 0 or ENOMEM. */
+int plan_peephole(const struct sdccrm *c, size_t file, const char *text, struct plan *p);
+
+#endif /* PEEPHOLE_H */
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include "context.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* Checks the default engine against a straightforward reference
+ * one on every input and configuration given, printing differences
+ * in parsed labels, labels kept and output text to f. Results must
+ * come from sdccrm_run(). Returns 0 or ENOMEM. */
+int verify_engines(const struct sdccrm *c, struct config *configs, size_t n_configs, FILE *f, size_t *n_diff);
+
+#endif /* REFERENCE_H */
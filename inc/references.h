@@ -19,8 +19,12 @@
 #ifndef REFERENCES_H
 #define REFERENCES_H
 
-#include "common.h"
+#include "context.h"
 
-void find_references(struct tree *t);
+/* Marks every label reachable from the roots of a configuration
+ * into cfg->used and, if allocated, the label it was first reached
+ * from into cfg->pred (SIZE_MAX for roots). Requires resolve_graph()
+ * to have been called. Returns 0 or ENOMEM. */
+int find_references(const struct sdccrm *c, const struct config *cfg);
 
 #endif /* REFERENCES_H */
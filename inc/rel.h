@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef REL_H
+#define REL_H
+
+#include "common.h"
+#include <stddef.h>
+
+/* Builds the label list of an ASxxxx object (.rel) file, as emitted
+ * by sdas: every symbol defined in a code area of port, e.g.: CODE
+ * on stm8 or CSEG on mcs51, becomes a label
+ * spanning until the next one, and relocations become references.
+ * References from any other area, e.g.: the interrupt vector table,
+ * are reachability roots. Returns 0, EINVAL or ENOMEM. */
+int parse_rel(const struct port *port, const char *buf, struct file *f);
+
+#endif /* REL_H */
@@ -19,8 +19,48 @@
 #ifndef REMOVE_UNUSED_H
 #define REMOVE_UNUSED_H
 
-#include "common.h"
+#include "context.h"
+#include <stddef.h>
 
-void remove_unused(const struct tree *const t);
+/* Lines removed from a file, [start, end], in increasing order.
+ * end is SIZE_MAX for spans extending until the end of file. */
+struct span
+{
+    size_t start;
+    size_t end;
+};
+
+/* Line replaced when filtering. */
+struct edit
+{
+    size_t line;
+    /* Replacement text, without the end of line. */
+    char *text;
+};
+
+/* Everything needed to filter a file, without the analysis. */
+struct plan
+{
+    struct span *spans;
+    size_t n_spans;
+    /* Indices of .globl directives to remove, in increasing
+     * order, counting from the first one in the file. */
+    size_t *drop;
+    size_t n_drop;
+    /* Lines rewritten, in increasing line order. */
+    struct edit *edits;
+    size_t n_edits;
+};
+
+/* Fills one result and plan per input into results[] and plans[]. */
+void remove_unused(const struct sdccrm *c, const struct config *cfg, struct sdccrm_result *results, struct plan *plans);
+/* Sorts spans, merging those overlapping. */
+void merge_spans(struct plan *p);
+/* Appends the lines of p kept by plan to out. */
+void write_filtered_file(struct strbuf *out, const struct plan *plan, const char *p);
+/* Appends an edit replacing line with a copy of text. Returns 0
+ * or ENOMEM. */
+int add_edit(struct plan *p, size_t line, const char *text);
+void free_plan(struct plan *p);
 
 #endif /* REMOVE_UNUSED_H */
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SDCCRM_H
+#define SDCCRM_H
+
+/* libsdccrm public interface.
+ *
+ * A context holds the options and inputs for one analysis. Inputs
+ * are given as in-memory buffers (or read from paths), sdccrm_run()
+ * performs the analysis and one result per input is then available
+ * until the context is released. Contexts do not share state, so
+ * several of them can be used concurrently from different threads.
+ *
+ * Functions returning int return 0 on success or an errno value. */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Defines default main label. */
+#define SDCCRM_DEFAULT_ENTRY_LABEL "_main"
+
+struct sdccrm;
+
+enum sdccrm_log_level
+{
+    SDCCRM_LOG_NONE,
+    SDCCRM_LOG_WARNING,
+    /* Files and labels being removed. */
+    SDCCRM_LOG_INFO,
+    /* Every reference found and label kept. */
+    SDCCRM_LOG_DEBUG
+};
+
+enum sdccrm_log_format
+{
+    /* "level: file: symbol: message" */
+    SDCCRM_LOG_TEXT,
+    /* One JSON object per line. */
+    SDCCRM_LOG_JSON
+};
+
+/* Module split off an output (see sdccrm_set_split()). */
+struct sdccrm_part
+{
+    /* Assembly text, NUL-terminated. */
+    const char *output;
+    size_t output_len;
+};
+
+struct sdccrm_result
+{
+    /* Input name as given to sdccrm_add_buffer() or sdccrm_add_file(). */
+    const char *name;
+    /* Configuration name as given to sdccrm_add_config(), or NULL. */
+    const char *config;
+    /* Filtered assembly text, NUL-terminated. */
+    const char *output;
+    size_t output_len;
+    /* Nothing was removed, so output is the input text as given. */
+    bool unchanged;
+    /* Names of the labels removed from this input. */
+    const char *const *removed;
+    size_t n_removed;
+    /* output split into modules, the first one keeping anything not
+     * moved into the rest, or none if not split. */
+    const struct sdccrm_part *parts;
+    size_t n_parts;
+};
+
+struct sdccrm *sdccrm_new(void);
+void sdccrm_free(struct sdccrm *c);
+/* Same as SDCCRM_LOG_INFO, or SDCCRM_LOG_NONE when false. */
+void sdccrm_set_verbose(struct sdccrm *c, bool verbose);
+void sdccrm_set_log_level(struct sdccrm *c, enum sdccrm_log_level level);
+void sdccrm_set_log_format(struct sdccrm *c, enum sdccrm_log_format format);
+/* Log records go to stdout, and warnings to stderr, unless set
+ * otherwise. Records are buffered, and written before the function
+ * logging them returns. */
+void sdccrm_set_log(struct sdccrm *c, FILE *f);
+/* Sets the SDCC port inputs were generated for: stm8 (default),
+ * z80, z180, hc08, s08 or mcs51. Must be called before adding any
+ * input. Returns EINVAL for unknown ports. */
+int sdccrm_set_port(struct sdccrm *c, const char *name);
+/* Also removes unreachable code within labels being kept, e.g.:
+ * instructions following a return that no local label leads to.
+ * Disabled by default. */
+void sdccrm_set_remove_blocks(struct sdccrm *c, bool enable);
+/* Also rewrites calls right before a return into jumps, and calls
+ * to labels only jumping to another label (trampolines) into calls
+ * to the latter, removing trampolines left unused. Disabled by
+ * default. */
+void sdccrm_set_peephole(struct sdccrm *c, bool enable);
+/* Places kept functions into windows of window bytes, e.g.: 65536
+ * for the sections stm8 near calls can reach, so as many far calls
+ * as possible are made within a window. Functions not placed into
+ * the first window are moved into areas named after their own and
+ * the window, e.g.: CODE_1. 0, the default, leaves them in place. */
+void sdccrm_set_layout(struct sdccrm *c, size_t window);
+/* Also splits every output into up to n modules of about the same
+ * estimated size, each one assembled on its own, so they can be
+ * assembled in parallel. Functions referencing each other are kept
+ * together where possible, and every module keeps the .globl
+ * directives of the output, so symbols defined in any other module
+ * are imported. 0 or 1, the default, does not split outputs. */
+void sdccrm_set_split(struct sdccrm *c, size_t n);
+/* Starts a named configuration. Entry and exclusions set afterwards
+ * apply to it only, while those set before the first configuration
+ * are shared by all of them. Inputs are parsed once, and every
+ * configuration is analysed concurrently by sdccrm_run(). */
+int sdccrm_add_config(struct sdccrm *c, const char *name);
+int sdccrm_set_entry(struct sdccrm *c, const char *label);
+/* label may be a glob pattern using '*', '?' and '[...]'. */
+int sdccrm_exclude(struct sdccrm *c, const char *label);
+/* Reads exclusions, one name or pattern per line. */
+int sdccrm_exclude_file(struct sdccrm *c, const char *path);
+/* Reads names of labels to remove, one per line, e.g.: as reported
+ * for object files. Any other global label is then kept, so only
+ * listed labels and static labels only reachable from them are
+ * removed. */
+int sdccrm_remove_file(struct sdccrm *c, const char *path);
+int sdccrm_add_buffer(struct sdccrm *c, const char *name, const char *buf, size_t len);
+int sdccrm_add_file(struct sdccrm *c, const char *path);
+/* Same as calling sdccrm_add_file() for every path, in order, but
+ * reads are batched and overlapped with parsing where possible. */
+int sdccrm_add_files(struct sdccrm *c, size_t n, const char *const *paths);
+/* Summaries hold everything sdccrm_run() needs from an input, so
+ * inputs can be parsed on different hosts. Results for inputs
+ * added from summaries have an empty output: their removal plans
+ * are applied to the original text by sdccrm_apply_plan() instead.
+ * Data returned by sdccrm_get_summary(), sdccrm_get_plan() and
+ * sdccrm_apply_plan() is released by sdccrm_free_data(). */
+int sdccrm_add_summary(struct sdccrm *c, const void *data, size_t len);
+/* Adds an SDCC object (.rel) file. Results for these inputs have an
+ * empty output, but list which symbols are unused, so they can be
+ * given to sdccrm_remove_file() along with the matching .asm files. */
+int sdccrm_add_rel(struct sdccrm *c, const char *name, const char *buf, size_t len);
+int sdccrm_get_summary(const struct sdccrm *c, size_t input, void **data, size_t *len);
+int sdccrm_run(struct sdccrm *c);
+/* One result per input and configuration, grouped by configuration. */
+size_t sdccrm_n_inputs(const struct sdccrm *c);
+size_t sdccrm_n_results(const struct sdccrm *c);
+const struct sdccrm_result *sdccrm_get_result(const struct sdccrm *c, size_t i);
+/* Removal plan for result i, valid after sdccrm_run(). */
+int sdccrm_get_plan(const struct sdccrm *c, size_t i, void **data, size_t *len);
+/* Returns ESTALE if the plan was made for different text. */
+int sdccrm_apply_plan(const char *buf, size_t len, const void *plan, size_t plan_len, char **out, size_t *out_len);
+void sdccrm_free_data(void *data);
+/* Prints worst-case stack usage per configuration, from the entry
+ * label, interrupt handlers and excluded labels, to f. */
+int sdccrm_stack_report(struct sdccrm *c, FILE *f);
+/* Prints, per configuration, every window and the functions placed
+ * into it to f. Returns EINVAL unless sdccrm_set_layout() was
+ * given a window. */
+int sdccrm_layout_report(struct sdccrm *c, FILE *f);
+/* Prints, per configuration, the shortest chain of references
+ * from the entry label or any other root to label, to f. */
+int sdccrm_why(struct sdccrm *c, const char *label, FILE *f);
+/* Prints, per configuration, how many bytes every root keeps
+ * alive, both on its own and shared with other roots, to f. */
+int sdccrm_why_all(struct sdccrm *c, FILE *f);
+/* Runs the analysis, then checks every configuration against a
+ * straightforward reference engine, printing any difference in
+ * parsed labels, labels kept or output text to f. *n_diff is set
+ * to the number of differences found. */
+int sdccrm_verify(struct sdccrm *c, FILE *f, size_t *n_diff);
+/* Writes every result output to paths[i], in one batch. Unchanged
+ * files read from paths are copied instead, or not written at all
+ * if paths[i] is the input path itself. Split outputs are written as
+ * their modules instead, module k > 0 into paths[i] with "_k" added
+ * before the extension, e.g.: main_1.asm. Nothing is written, and
+ * EEXIST is returned, if a module path names another input or output. */
+int sdccrm_write_files(const struct sdccrm *c, const char *const *paths);
+
+#endif /* SDCCRM_H */
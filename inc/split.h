@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include "context.h"
+#include "remove_unused.h"
+#include <stddef.h>
+
+/* Fills r->parts with the text written from file by plan p, split
+ * into up to c->split modules of about the same estimated size.
+ * Labels calling each other are kept together where possible, while
+ * those which cannot be moved, e.g.: static labels referenced from
+ * the first module, stay there. Leaves r->parts empty if nothing can
+ * be moved. Requires cfg->used. Returns 0 or ENOMEM. */
+int split_output(const struct sdccrm *c, const struct config *cfg, size_t file, const char *text,
+    const struct plan *p, struct sdccrm_result *r);
+
+#endif /* SPLIT_H */
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include "context.h"
+#include <stdio.h>
+
+/* Prints worst-case stack usage from the entry label, interrupt
+ * handlers and excluded labels of a configuration, along with the
+ * call chain causing it and any recursion found. Requires
+ * resolve_graph() to have been called. Returns 0 or ENOMEM. */
+int report_stack(const struct sdccrm *c, const struct config *cfg, FILE *f);
+
+#endif /* STACK_H */
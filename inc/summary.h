@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include "common.h"
+#include "remove_unused.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compact binary forms of a parsed file (summary) and of its
+ * removal plan, so analysis and filtering can run on different
+ * hosts. Integers are stored as LEB128 varints and strings are
+ * prefixed by their length. Both embed a checksum of the text,
+ * so a plan is never applied to a different revision of a file.
+ * Functions returning int return 0, EINVAL or ENOMEM. */
+
+uint64_t text_checksum(const char *buf, size_t len);
+int write_summary(const struct file *f, const char *name, uint64_t checksum, struct strbuf *out);
+/* On success, f and *name are owned by the caller. */
+int read_summary(const void *buf, size_t len, struct file *f, char **name, uint64_t *checksum);
+int write_plan(const struct plan *p, uint64_t checksum, struct strbuf *out);
+int read_plan(const void *buf, size_t len, struct plan *p, uint64_t *checksum);
+
+#endif /* SUMMARY_H */
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Optional span arguments. Zero/NULL members are not emitted. */
+struct trace_args
+{
+    const char *file;
+    size_t bytes;
+    size_t labels;
+    size_t removed;
+};
+
+void enable_trace(const char *path);
+bool tracing(void);
+uint64_t trace_begin(void);
+void trace_end(uint64_t start, const char *name, const struct trace_args *args);
+void trace_write(void);
+
+#endif /* TRACE_H */
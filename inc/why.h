@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WHY_H
+#define WHY_H
+
+#include "context.h"
+#include <stdio.h>
+
+/* Both reports require find_references() to have been
+ * run with cfg->pred allocated. */
+
+/* Prints the shortest chain from any root to every label
+ * named as given, or whether it is removed. Returns 0 or ENOMEM. */
+int report_why(const struct sdccrm *c, const struct config *cfg, const char *name, FILE *f);
+/* Prints how many bytes every root keeps alive, both on its
+ * own and shared with other roots. Returns 0 or ENOMEM. */
+int report_why_all(const struct sdccrm *c, const struct config *cfg, FILE *f);
+
+#endif /* WHY_H */
@@ -17,19 +17,212 @@
  */
 
 #include "alloc.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 
-void *alloc_(void *p, const size_t sz, const size_t elem)
+enum
 {
-    void *const t = p;
+    /* Histogram buckets hold sizes up to 2^(i + MIN_BUCKET_SHIFT)
+     * bytes. The last bucket collects everything bigger. */
+    MIN_BUCKET_SHIFT = 4,
+    N_BUCKETS = 14
+};
 
-    p = realloc(p, (elem + 1) * sz);
+/* Every block is prefixed by this header so alloc_free() and
+ * alloc_() know how many bytes are being released, and for which
+ * subsystem. */
+struct header
+{
+    size_t sz;
+    enum alloc_tag tag;
+    bool accounted;
+};
+
+/* Keep user data aligned as malloc() would. */
+union aligned_header
+{
+    struct header h;
+    max_align_t align;
+};
+
+static const char *const tag_names[N_ALLOC_TAGS] =
+{
+    [ALLOC_FILE_BUF] = "file buffers",
+    [ALLOC_LABEL_NAME] = "label names",
+    [ALLOC_CALL_LIST] = "call lists",
+    [ALLOC_OUTPUT_NAME] = "output names",
+    [ALLOC_TABLE] = "tables",
+    [ALLOC_LOG] = "log buffers"
+};
+
+static struct
+{
+    atomic_size_t calls;
+    atomic_size_t frees;
+    atomic_size_t bytes;
+    atomic_size_t live;
+    atomic_size_t peak;
+    atomic_size_t histogram[N_BUCKETS];
+} stats[N_ALLOC_TAGS];
+
+static atomic_size_t total_live, total_peak;
+static bool stats_enabled;
+
+void enable_alloc_stats(void)
+{
+    stats_enabled = true;
+}
+
+static void update_peak(atomic_size_t *const peak, const size_t live)
+{
+    size_t prev = atomic_load_explicit(peak, memory_order_relaxed);
+
+    while (live > prev
+        && !atomic_compare_exchange_weak_explicit(peak, &prev, live,
+            memory_order_relaxed, memory_order_relaxed));
+}
+
+static size_t bucket(const size_t sz)
+{
+    size_t i = 0;
+
+    while (i < N_BUCKETS - 1 && sz > (size_t)1 << (i + MIN_BUCKET_SHIFT))
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static void account_alloc(struct header *const h)
+{
+    if ((h->accounted = stats_enabled))
+    {
+        const size_t live = atomic_fetch_add_explicit(&stats[h->tag].live, h->sz,
+            memory_order_relaxed) + h->sz;
+        const size_t total = atomic_fetch_add_explicit(&total_live, h->sz,
+            memory_order_relaxed) + h->sz;
+
+        atomic_fetch_add_explicit(&stats[h->tag].calls, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats[h->tag].bytes, h->sz, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats[h->tag].histogram[bucket(h->sz)], 1,
+            memory_order_relaxed);
+
+        update_peak(&stats[h->tag].peak, live);
+        update_peak(&total_peak, total);
+    }
+}
 
-    if (t && !p)
+static void account_free(const struct header *const h)
+{
+    if (h->accounted)
     {
-        free(t);
-        return t;
+        atomic_fetch_add_explicit(&stats[h->tag].frees, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&stats[h->tag].live, h->sz, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&total_live, h->sz, memory_order_relaxed);
     }
+}
 
-    return p;
+void *alloc_buf(const size_t sz, const enum alloc_tag tag)
+{
+    union aligned_header *const b = malloc(sizeof *b + sz);
+
+    if (b)
+    {
+        b->h.sz = sz;
+        b->h.tag = tag;
+        account_alloc(&b->h);
+
+        return b + 1;
+    }
+
+    return NULL;
+}
+
+void alloc_free(void *const p)
+{
+    if (p)
+    {
+        union aligned_header *const b = (union aligned_header *)p - 1;
+
+        account_free(&b->h);
+        free(b);
+    }
+}
+
+void *alloc_grow_(void *const p, const size_t sz, const size_t elem, const enum alloc_tag tag)
+{
+    union aligned_header *const old = p ? (union aligned_header *)p - 1 : NULL;
+    const size_t new_sz = (elem + 1) * sz;
+    union aligned_header *const b = realloc(old, sizeof *b + new_sz);
+
+    if (!b)
+        return NULL;
+    else if (old)
+    {
+        /* Growing a block counts as releasing the old one and
+         * allocating the new one. realloc() kept the old header. */
+        account_free(&b->h);
+    }
+
+    b->h.sz = new_sz;
+    b->h.tag = tag;
+    account_alloc(&b->h);
+
+    return b + 1;
+}
+
+void *alloc_(void *const p, const size_t sz, const size_t elem, const enum alloc_tag tag)
+{
+    void *const b = alloc_grow_(p, sz, elem, tag);
+
+    if (!b)
+        alloc_free(p);
+
+    return b;
+}
+
+void alloc_report(FILE *const f)
+{
+    if (!stats_enabled)
+        return;
+
+    fprintf(f, "Memory usage:\n");
+    fprintf(f, "%-14s %10s %10s %12s %12s %12s\n",
+        "tag", "allocs", "frees", "bytes", "peak live", "live");
+
+    for (size_t i = 0; i < N_ALLOC_TAGS; i++)
+    {
+        fprintf(f, "%-14s %10zu %10zu %12zu %12zu %12zu\n", tag_names[i],
+            atomic_load(&stats[i].calls), atomic_load(&stats[i].frees),
+            atomic_load(&stats[i].bytes), atomic_load(&stats[i].peak),
+            atomic_load(&stats[i].live));
+    }
+
+    fprintf(f, "Total peak live bytes: %zu\n", atomic_load(&total_peak));
+    fprintf(f, "Allocation size histogram (bytes):\n");
+
+    for (size_t i = 0; i < N_ALLOC_TAGS; i++)
+    {
+        if (!atomic_load(&stats[i].calls))
+            continue;
+
+        fprintf(f, "  %s:\n", tag_names[i]);
+
+        for (size_t j = 0; j < N_BUCKETS; j++)
+        {
+            const size_t n = atomic_load(&stats[i].histogram[j]);
+
+            if (!n)
+                continue;
+
+            if (j < N_BUCKETS - 1)
+                fprintf(f, "    <= %-8zu %zu\n", (size_t)1 << (j + MIN_BUCKET_SHIFT), n);
+            else
+                fprintf(f, "    >  %-8zu %zu\n", (size_t)1 << (j - 1 + MIN_BUCKET_SHIFT), n);
+        }
+    }
 }
@@ -0,0 +1,683 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Micro-benchmark for the tokenizer and classifier primitives
+ * declared in common.h and classify.h. Each primitive is measured in isolation
+ * against synthetic, SDCC-like line mixes and results are written
+ * to stdout as JSON, one result object per line, so runs from
+ * different parser revisions can be diffed directly. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "common.h"
+#include "classify.h"
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#else
+#define HAVE_CYCLE_COUNTER 0
+#endif
+
+enum
+{
+    DEFAULT_LINES = 100000,
+    DEFAULT_ITERATIONS = 5
+};
+
+enum shape
+{
+    SHAPE_MIXED,
+    SHAPE_COMMENT_HEAVY,
+    SHAPE_LONG_OPERAND,
+    SHAPE_LABEL_DENSE,
+
+    N_SHAPES
+};
+
+static const char *const shape_names[N_SHAPES] =
+{
+    [SHAPE_MIXED] = "mixed",
+    [SHAPE_COMMENT_HEAVY] = "comment-heavy",
+    [SHAPE_LONG_OPERAND] = "long-operand",
+    [SHAPE_LABEL_DENSE] = "label-dense"
+};
+
+struct buffer
+{
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/* Lines as returned by get_line(), stored contiguously so
+ * classifier primitives can be timed without tokenizing. */
+struct lines
+{
+    char (*text)[MAX_CH_PER_LINE];
+    size_t *len;
+    size_t n;
+    size_t bytes;
+};
+
+struct sample
+{
+    double ns;
+    uint64_t cycles;
+};
+
+static uint32_t rng_state = 0x5dcc0001;
+
+static uint32_t rng(void)
+{
+    /* Deterministic LCG: every run must see the same input. */
+    rng_state = rng_state * 1103515245u + 12345u;
+    return rng_state >> 8;
+}
+
+static void append(struct buffer *const b, const char *const fmt, ...)
+{
+    for (;;)
+    {
+        va_list ap;
+        const size_t room = b->cap - b->len;
+        int n;
+
+        va_start(ap, fmt);
+        n = vsnprintf(b->data + b->len, room, fmt, ap);
+        va_end(ap);
+
+        if (n < 0)
+        {
+            return;
+        }
+        else if ((size_t)n < room)
+        {
+            b->len += n;
+            return;
+        }
+        else
+        {
+            char *const d = realloc(b->data, b->cap * 2 + n);
+
+            if (!d)
+            {
+                fprintf(stderr, "Could not grow benchmark buffer\n");
+                exit(EXIT_FAILURE);
+            }
+
+            b->data = d;
+            b->cap = b->cap * 2 + n;
+        }
+    }
+}
+
+static void gen_instruction(struct buffer *const b)
+{
+    static const char *const plain[] =
+    {
+        "\tld\ta, (0x01, sp)\n",
+        "\tldw\tx, (0x03, sp)\n",
+        "\tpushw\tx\n",
+        "\tpopw\tx\n",
+        "\tincw\tx\n",
+        "\ttnz\ta\n",
+        "\tjrne\t00102$\n",
+        "\tclrw\tx\n",
+        "\taddw\tsp, #4\n",
+        "\tret\n"
+    };
+
+    switch (rng() % 8)
+    {
+        case 0:
+            append(b, "\tcall\t_func_%u\n", rng() % 512);
+            break;
+
+        case 1:
+            append(b, "\tldw\tx, #(_table_%u + 0)\n", rng() % 64);
+            break;
+
+        default:
+            append(b, "%s", plain[rng() % lengthof (plain)]);
+            break;
+    }
+}
+
+static void gen_long_operand(struct buffer *const b)
+{
+    switch (rng() % 3)
+    {
+        case 0:
+            append(b, "\tldw\tx, #(_a_rather_long_generated_symbol_name_for_module_%u + 0x%04x)\n",
+                rng() % 4096, rng() % 0x10000);
+            break;
+
+        case 1:
+            append(b, "\tcall\t_a_rather_long_generated_function_name_for_module_%u\n",
+                rng() % 4096);
+            break;
+
+        default:
+            append(b, "\tld\ta, (_a_rather_long_generated_variable_name_%u + 0x%02x, x)\n",
+                rng() % 4096, rng() % 0x100);
+            break;
+    }
+}
+
+static void gen_header(struct buffer *const b)
+{
+    append(b, ";--------------------------------------------------------\n"
+        "; File Created by SDCC : free open source ANSI-C Compiler\n"
+        ";--------------------------------------------------------\n"
+        "\t.module bench\n"
+        "\t.optsdcc -mstm8\n");
+
+    for (unsigned i = 0; i < 64; i++)
+    {
+        append(b, "\t.globl _func_%u\n", i);
+    }
+
+    append(b, "\t.area DATA\n\t.area CODE\n");
+}
+
+static struct buffer generate(const enum shape s, const size_t n_lines)
+{
+    struct buffer b = {.cap = 4096};
+
+    if (!(b.data = malloc(b.cap)))
+    {
+        fprintf(stderr, "Could not allocate benchmark buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *b.data = '\0';
+    gen_header(&b);
+
+    for (size_t i = 0; i < n_lines; i++)
+    {
+        const unsigned r = rng() % 100;
+
+        switch (s)
+        {
+            case SHAPE_MIXED:
+                if (r < 5)
+                    append(&b, "_func_%zu:\n", i);
+                else if (r < 20)
+                    append(&b, ";\tbench.c: %zu: x = y + %u;\n", i, r);
+                else
+                    gen_instruction(&b);
+
+                break;
+
+            case SHAPE_COMMENT_HEAVY:
+                if (r < 70)
+                    append(&b, ";\tbench.c: %zu: some_variable = some_function(arg, %u);\n", i, r);
+                else if (r < 72)
+                    append(&b, "_func_%zu:\n", i);
+                else
+                    gen_instruction(&b);
+
+                break;
+
+            case SHAPE_LONG_OPERAND:
+                if (r < 3)
+                    append(&b, "_func_%zu:\n", i);
+                else if (r < 70)
+                    gen_long_operand(&b);
+                else
+                    gen_instruction(&b);
+
+                break;
+
+            case SHAPE_LABEL_DENSE:
+                if (r < 45)
+                    append(&b, "_func_%zu:\n", i);
+                else if (r < 50)
+                    append(&b, "%05zu$:\n", i % 100000);
+                else
+                    gen_instruction(&b);
+
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return b;
+}
+
+static struct lines tokenize(const char *p)
+{
+    struct lines l = {0};
+    size_t cap = 0;
+    char line[MAX_CH_PER_LINE];
+    size_t len;
+
+    while ((p = get_line(p, line, &len)))
+    {
+        if (l.n >= cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            l.text = realloc(l.text, cap * sizeof *l.text);
+            l.len = realloc(l.len, cap * sizeof *l.len);
+
+            if (!l.text || !l.len)
+            {
+                fprintf(stderr, "Could not allocate line table\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        memcpy(l.text[l.n], line, len);
+        l.len[l.n++] = len;
+        l.bytes += len;
+    }
+
+    return l;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#if HAVE_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Results are fed here so the compiler cannot elide the calls. */
+static volatile uintptr_t sink;
+
+static size_t run_get_line(const struct buffer *const b, const struct lines *const l)
+{
+    const char *p = b->data;
+    char line[MAX_CH_PER_LINE];
+    size_t len, n = 0;
+
+    (void)l;
+
+    while ((p = get_line(p, line, &len)))
+    {
+        n++;
+    }
+
+    sink += n;
+    return n;
+}
+
+static size_t run_get_global(const struct buffer *const b, const struct lines *const l)
+{
+    size_t hits = 0;
+
+    (void)b;
+
+    for (size_t i = 0; i < l->n; i++)
+    {
+        const char *const g = get_global(l->text[i]);
+
+        sink += (uintptr_t)g;
+        hits += !!g;
+    }
+
+    return hits;
+}
+
+static size_t run_is_label(const struct buffer *const b, const struct lines *const l)
+{
+    size_t hits = 0;
+
+    (void)b;
+
+    for (size_t i = 0; i < l->n; i++)
+    {
+        hits += is_label(l->text[i], l->len[i]);
+    }
+
+    sink += hits;
+    return hits;
+}
+
+static size_t run_is_call(const struct buffer *const b, const struct lines *const l)
+{
+    size_t hits = 0;
+
+    (void)b;
+
+    for (size_t i = 0; i < l->n; i++)
+    {
+        hits += is_call(l->text[i]);
+    }
+
+    sink += hits;
+    return hits;
+}
+
+static size_t run_get_ref(const struct buffer *const b, const struct lines *const l)
+{
+    size_t hits = 0;
+
+    (void)b;
+
+    for (size_t i = 0; i < l->n; i++)
+    {
+        const char *const r = get_ref(l->text[i]);
+
+        sink += (uintptr_t)r;
+        hits += !!r;
+    }
+
+    return hits;
+}
+
+static size_t run_get_call(const struct buffer *const b, const struct lines *const l)
+{
+    size_t hits = 0;
+
+    (void)b;
+
+    for (size_t i = 0; i < l->n; i++)
+    {
+        /* get_call() expects a call line, as in parse(). */
+        if (is_call(l->text[i]))
+        {
+            sink += (uintptr_t)get_call(l->text[i]);
+            hits++;
+        }
+    }
+
+    return hits;
+}
+
+static size_t run_classify(const struct buffer *const b, const struct lines *const l)
+{
+    size_t hits = 0;
+
+    (void)b;
+
+    for (size_t i = 0; i < l->n; i++)
+    {
+        struct line_info li;
+
+        classify(find_port(NULL), l->text[i], l->len[i], &li);
+        sink += li.kind;
+        hits += li.kind != LINE_OTHER;
+    }
+
+    return hits;
+}
+
+static const struct
+{
+    const char *name;
+    size_t (*f)(const struct buffer *b, const struct lines *l);
+    /* get_line() walks raw text, the rest walk tokenized lines. */
+    bool raw;
+} primitives[] =
+{
+    {.name = "get_line", .f = run_get_line, .raw = true},
+    {.name = "get_global", .f = run_get_global},
+    {.name = "is_label", .f = run_is_label},
+    {.name = "is_call", .f = run_is_call},
+    {.name = "get_ref", .f = run_get_ref},
+    {.name = "get_call", .f = run_get_call},
+    /* Replaces the whole chain above in parse(). */
+    {.name = "classify", .f = run_classify}
+};
+
+static struct sample measure(size_t (*const f)(const struct buffer *, const struct lines *),
+    const struct buffer *const b, const struct lines *const l, const unsigned iterations,
+    size_t *const hits)
+{
+    struct sample best = {0};
+
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        const double t0 = now_ns();
+        const uint64_t c0 = now_cycles();
+
+        *hits = f(b, l);
+
+        const uint64_t c1 = now_cycles();
+        const double t1 = now_ns();
+
+        if (!i || t1 - t0 < best.ns)
+        {
+            best.ns = t1 - t0;
+            best.cycles = c1 - c0;
+        }
+    }
+
+    return best;
+}
+
+/* Large memory model module for --layout, using far calls. */
+static int write_far(const char *const dir)
+{
+    enum {N_FAR = 2048};
+    char path[FILENAME_MAX];
+    FILE *f;
+
+    snprintf(path, sizeof path, "%s/far.asm", dir);
+
+    if (!(f = fopen(path, "wb")))
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(f, "\t.module far\n\t.optsdcc -mstm8\n");
+
+    /* Some are static, so they stay with their callers. */
+    for (unsigned i = 0; i < N_FAR; i++)
+    {
+        if (!i || i % 8)
+            fprintf(f, "\t.globl _far_%u\n", i);
+    }
+
+    fprintf(f, "\t.area CODE\n");
+
+    for (unsigned i = 0; i < N_FAR; i++)
+    {
+        const unsigned r = rng() % 16;
+
+        fprintf(f, "_far_%u:\n", i);
+
+        for (unsigned j = rng() % 24; j; j--)
+        {
+            const unsigned callee = i + 1 + rng() % 16;
+
+            if (j % 4 || callee >= N_FAR)
+                fprintf(f, "\tldw\tx, (0x%02x, sp)\n", rng() % 0x100);
+            else if (rng() % 16)
+                fprintf(f, "\tcallf\t_far_%u\n", callee);
+            else if (rng() % 2)
+                fprintf(f, "\tcall\t_far_%u\n", callee);
+            else
+                fprintf(f, "\tldw\tx, #(_far_%u + 0)\n", callee);
+        }
+
+        /* Some fall through into the next one. */
+        if (r)
+            fprintf(f, "\t%s\n", r == 1 ? "jpf\t_far_0" : "retf");
+    }
+
+    fprintf(f, "\tretf\n");
+    fclose(f);
+
+    return EXIT_SUCCESS;
+}
+
+static int write_corpus(const char *const dir, const size_t n_lines)
+{
+    /* Same inputs as measured, so they can also be used to
+     * check the whole tool, e.g.: by sdccrm --verify. */
+    for (enum shape s = 0; s < N_SHAPES; s++)
+    {
+        struct buffer b = generate(s, n_lines);
+        char path[FILENAME_MAX];
+        FILE *f;
+
+        snprintf(path, sizeof path, "%s/%s.asm", dir, shape_names[s]);
+
+        if (!(f = fopen(path, "wb")))
+        {
+            fprintf(stderr, "Could not open %s\n", path);
+            free(b.data);
+            return EXIT_FAILURE;
+        }
+
+        fwrite(b.data, sizeof *b.data, b.len, f);
+        fclose(f);
+        free(b.data);
+    }
+
+    /* Entry point, so every shape has some labels kept. */
+    char path[FILENAME_MAX];
+    FILE *f;
+
+    snprintf(path, sizeof path, "%s/main.asm", dir);
+
+    if (!(f = fopen(path, "wb")))
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(f, "\t.module main\n\t.globl _main\n\t.area CODE\n_main:\n");
+
+    /* Same range as called by generated instructions. */
+    for (unsigned i = 0; i < 512; i++)
+    {
+        fprintf(f, "\tcall\t_func_%u\n", i);
+    }
+
+    /* Entry to the far module written below. */
+    fprintf(f, "\tcall\t_far_0\n");
+
+    /* Trampolines for --peephole: a chain, one also referenced
+     * as data, so it is kept, and two jumping to each other. */
+    fprintf(f, "\tcall\t_jump_0\n\tldw\tx, #(_jump_2 + 0)\n\tcall\t_jump_2\n\tcall\t_jump_4\n\tret\n"
+        "_jump_0:\n\tjp\t_jump_1\n_jump_1:\n\tjp\t_done\n_jump_2:\n\tjp\t_done\n"
+        "_jump_4:\n\tjp\t_jump_5\n_jump_5:\n\tjp\t_jump_4\n_done:\n\tret\n");
+    fclose(f);
+
+    return write_far(dir);
+}
+
+static void usage(void)
+{
+    printf("Usage:\nsdccrm-bench [-n lines] [-i iterations] [--corpus dir]\n");
+}
+
+int main(const int argc, const char *const argv[])
+{
+    size_t n_lines = DEFAULT_LINES;
+    unsigned iterations = DEFAULT_ITERATIONS;
+    const char *corpus = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            n_lines = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+        {
+            iterations = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "--corpus") && i + 1 < argc)
+        {
+            corpus = argv[++i];
+        }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!n_lines || !iterations)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    else if (corpus)
+    {
+        return write_corpus(corpus, n_lines);
+    }
+
+    printf("{\n\"benchmark\": \"sdccrm-primitives\",\n\"lines_per_shape\": %zu,\n"
+        "\"iterations\": %u,\n\"cycle_counter\": %s,\n\"results\": [\n",
+        n_lines, iterations, HAVE_CYCLE_COUNTER ? "true" : "false");
+
+    for (enum shape s = 0; s < N_SHAPES; s++)
+    {
+        struct buffer b = generate(s, n_lines);
+        struct lines l = tokenize(b.data);
+
+        for (size_t i = 0; i < lengthof (primitives); i++)
+        {
+            size_t hits;
+            const struct sample r = measure(primitives[i].f, &b, &l, iterations, &hits);
+            const size_t bytes = primitives[i].raw ? b.len : l.bytes;
+            const bool last = s == N_SHAPES - 1 && i == lengthof (primitives) - 1;
+
+            printf("{\"shape\": \"%s\", \"primitive\": \"%s\", \"lines\": %zu, "
+                "\"bytes\": %zu, \"hits\": %zu, \"ns_per_line\": %.3f, ",
+                shape_names[s], primitives[i].name, l.n, bytes, hits,
+                l.n ? r.ns / l.n : 0.0);
+
+            if (HAVE_CYCLE_COUNTER && r.cycles)
+            {
+                printf("\"bytes_per_cycle\": %.4f}", (double)bytes / r.cycles);
+            }
+            else
+            {
+                printf("\"bytes_per_cycle\": null}");
+            }
+
+            printf("%s\n", last ? "" : ",");
+        }
+
+        free(l.text);
+        free(l.len);
+        free(b.data);
+    }
+
+    printf("]\n}\n");
+
+    return EXIT_SUCCESS;
+}
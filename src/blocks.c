@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Unreachable basic block removal. Lines within a kept label are
+ * split into blocks at local labels, e.g.: "00102$:", and at any
+ * other label, e.g.: "loop:" in inline assembly. A block is
+ * reachable from the label itself, by falling through from the
+ * previous block, or when its local label is named by a reachable
+ * line or by any directive, e.g.: jump tables. Blocks starting at
+ * any other label are always reachable. Lines following a
+ * return or an unconditional jump are unreachable until the next
+ * block. Only instructions and local labels are ever removed. */
+
+#include "blocks.h"
+#include "classify.h"
+#include "alloc.h"
+#include "common.h"
+#include "trace.h"
+#include "log.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct block
+{
+    /* Local label number, unused by the first block. */
+    unsigned long label;
+    /* Line numbers. Lines after last_live are unreachable. */
+    size_t first, last_live, last;
+    /* Block ends with a return or an unconditional jump. */
+    bool ends;
+    /* Starts at a label other than a local one, which might
+     * be reached from anywhere. */
+    bool named;
+    bool reached;
+};
+
+struct local
+{
+    unsigned long label;
+    size_t block;
+};
+
+struct function
+{
+    const struct port *port;
+    const struct text_line *lines;
+    struct block *blocks;
+    size_t n_blocks;
+    /* Sorted by label. */
+    struct local *locals;
+    size_t n_locals;
+    /* Local labels named by directives. */
+    unsigned long *roots;
+    size_t n_roots;
+    size_t *pending;
+    size_t n_pending;
+};
+
+static bool is_instruction(const struct port *port, const char *line, size_t len);
+static bool is_symbol(char c);
+static bool is_named_label(const char *line);
+static int split_blocks(struct function *fn, size_t start, size_t end);
+static int find_reachable(struct function *fn);
+static void mark(struct function *fn, size_t block);
+static void reach(struct function *fn, unsigned long label);
+static int add_spans(const struct function *fn, struct plan *p, size_t first_span, size_t *removed);
+static void free_function(struct function *fn);
+
+int plan_blocks(const struct sdccrm *const c, const struct config *const cfg, const struct file *const f,
+    const char *const text, struct plan *const p)
+{
+    const uint64_t start = trace_begin();
+    const size_t first_span = p->n_spans;
+    size_t n_lines, total = 0;
+    struct text_line *const lines = index_lines(text, &n_lines);
+    int ret = lines ? 0 : ENOMEM;
+
+    for (size_t i = 0; i < f->n_labels && !ret; i++)
+    {
+        const struct label *const l = &f->labels[i];
+        const size_t end = label_end(l, n_lines);
+        struct function fn = {.port = c->port, .lines = lines};
+        size_t removed = 0;
+
+        if (!cfg->used[l->id] || l->start_line > n_lines)
+            continue;
+
+        if (!(ret = split_blocks(&fn, l->start_line, end)) && !(ret = find_reachable(&fn)))
+            ret = add_spans(&fn, p, first_span, &removed);
+
+        if (removed)
+            LOG(c, SDCCRM_LOG_INFO, f->name, l->name, "removing %zu unreachable lines", removed);
+
+        total += removed;
+        free_function(&fn);
+    }
+
+    alloc_free(lines);
+
+    trace_end(start, "blocks", &(const struct trace_args)
+        {
+            .file = f->name,
+            .labels = f->n_labels,
+            .removed = total
+        });
+
+    return ret;
+}
+
+static bool is_instruction(const struct port *const port, const char *const line, const size_t len)
+{
+    struct line_info li;
+
+    /* Mnemonics are lower case, unlike debug symbols such as
+     * "C$main.c$10$0_0$1 = .", which are kept as well. */
+    if (*line < 'a' || *line > 'z' || strchr(line, '='))
+        return false;
+
+    /* e.g.: "int _f" on stm8. */
+    classify(port, line, len + 1, &li);
+
+    return li.kind != LINE_DATA;
+}
+
+static bool is_symbol(const char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$' || c == '.';
+}
+
+static bool is_named_label(const char *const line)
+{
+    /* e.g.: "__helper:", "_f::" or "loop:". Local labels
+     * are told apart by is_local_label() first. */
+    const char *p = line;
+
+    while (is_symbol(*p))
+    {
+        p++;
+    }
+
+    return p > line && *p == ':';
+}
+
+static int compare_locals(const void *const a, const void *const b)
+{
+    const struct local *const la = a, *const lb = b;
+
+    return (la->label > lb->label) - (la->label < lb->label);
+}
+
+static int split_blocks(struct function *const fn, const size_t start, const size_t end)
+{
+    char line[MAX_CH_PER_LINE];
+
+    for (size_t ln = start; ln <= end; ln++)
+    {
+        const size_t len = copy_line(&fn->lines[ln - 1], line);
+        unsigned long label = 0;
+        bool named = false;
+
+        if (!strncmp(line, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)))
+        {
+            /* Labels spanning several areas are left alone. */
+            fn->n_blocks = 0;
+            return 0;
+        }
+        else if (!fn->n_blocks || is_local_label(line, &label) || (named = is_named_label(line)))
+        {
+            if (fn->n_blocks)
+            {
+                struct block *const prev = &fn->blocks[fn->n_blocks - 1];
+
+                prev->last = ln - 1;
+
+                if (!prev->ends)
+                    prev->last_live = ln - 1;
+            }
+
+            if (!(fn->blocks = alloc(fn->blocks, fn->n_blocks, ALLOC_TABLE)))
+            {
+                fn->n_blocks = 0;
+                return ENOMEM;
+            }
+
+            fn->blocks[fn->n_blocks++] = (struct block){.label = label, .first = ln, .last_live = end, .last = end, .named = named};
+        }
+        else if (*line == '.')
+        {
+            for (const char *p = line; next_local(line, &p, &label); )
+            {
+                if (!(fn->roots = alloc(fn->roots, fn->n_roots, ALLOC_TABLE)))
+                {
+                    fn->n_roots = 0;
+                    return ENOMEM;
+                }
+
+                fn->roots[fn->n_roots++] = label;
+            }
+        }
+        else
+        {
+            struct block *const b = &fn->blocks[fn->n_blocks - 1];
+
+            if (!b->ends && is_instruction(fn->port, line, len) && ends_block(fn->port, line))
+            {
+                b->ends = true;
+                b->last_live = ln;
+            }
+        }
+    }
+
+    if (fn->n_blocks > 1)
+    {
+        const size_t n = fn->n_blocks - 1;
+
+        if (!(fn->locals = alloc_(NULL, sizeof *fn->locals, n, ALLOC_TABLE)))
+            return ENOMEM;
+
+        for (size_t i = 1; i < fn->n_blocks; i++)
+        {
+            if (!fn->blocks[i].named)
+                fn->locals[fn->n_locals++] = (struct local){.label = fn->blocks[i].label, .block = i};
+        }
+
+        qsort(fn->locals, fn->n_locals, sizeof *fn->locals, compare_locals);
+    }
+
+    return 0;
+}
+
+static int find_reachable(struct function *const fn)
+{
+    char line[MAX_CH_PER_LINE];
+
+    if (!fn->n_blocks)
+        return 0;
+
+    /* Every block is pending once at most. */
+    if (!(fn->pending = alloc_(NULL, sizeof *fn->pending, fn->n_blocks, ALLOC_TABLE)))
+        return ENOMEM;
+
+    for (size_t i = 0; i < fn->n_blocks; i++)
+    {
+        if (!i || fn->blocks[i].named)
+            mark(fn, i);
+    }
+
+    for (size_t i = 0; i < fn->n_roots; i++)
+    {
+        reach(fn, fn->roots[i]);
+    }
+
+    while (fn->n_pending)
+    {
+        const size_t i = fn->pending[--fn->n_pending];
+        const struct block *const b = &fn->blocks[i];
+
+        for (size_t ln = b->first; ln <= b->last_live; ln++)
+        {
+            unsigned long label;
+
+            copy_line(&fn->lines[ln - 1], line);
+
+            for (const char *p = line; next_local(line, &p, &label); )
+            {
+                reach(fn, label);
+            }
+        }
+
+        if (!b->ends && i + 1 < fn->n_blocks)
+            mark(fn, i + 1);
+    }
+
+    return 0;
+}
+
+static void mark(struct function *const fn, const size_t block)
+{
+    struct block *const b = &fn->blocks[block];
+
+    if (!b->reached)
+    {
+        b->reached = true;
+        fn->pending[fn->n_pending++] = block;
+    }
+}
+
+static void reach(struct function *const fn, const unsigned long label)
+{
+    const struct local key = {.label = label};
+    const struct local *const l = fn->n_locals ?
+        bsearch(&key, fn->locals, fn->n_locals, sizeof *fn->locals, compare_locals) : NULL;
+
+    if (l)
+        mark(fn, l->block);
+}
+
+static int add_spans(const struct function *const fn, struct plan *const p, const size_t first_span,
+    size_t *const removed)
+{
+    char line[MAX_CH_PER_LINE];
+
+    for (size_t i = 0; i < fn->n_blocks; i++)
+    {
+        const struct block *const b = &fn->blocks[i];
+
+        for (size_t ln = b->reached ? b->last_live + 1 : b->first; ln <= b->last; ln++)
+        {
+            const size_t len = copy_line(&fn->lines[ln - 1], line);
+            struct span *const prev = p->n_spans > first_span ? &p->spans[p->n_spans - 1] : NULL;
+
+            /* The local label of an unreachable block goes too. */
+            if (!is_instruction(fn->port, line, len) && ln != b->first)
+                continue;
+
+            ++*removed;
+
+            if (prev && prev->end == ln - 1)
+            {
+                prev->end = ln;
+                continue;
+            }
+
+            if (!(p->spans = alloc(p->spans, p->n_spans, ALLOC_TABLE)))
+            {
+                p->n_spans = 0;
+                return ENOMEM;
+            }
+
+            p->spans[p->n_spans++] = (struct span){.start = ln, .end = ln};
+        }
+    }
+
+    return 0;
+}
+
+static void free_function(struct function *const fn)
+{
+    alloc_free(fn->blocks);
+    alloc_free(fn->locals);
+    alloc_free(fn->roots);
+    alloc_free(fn->pending);
+}
@@ -0,0 +1,827 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Single-dispatch line classifier shared by parse() and
+ * write_filtered_file(). The leading character selects, through
+ * a compile-time table, the only token comparison that can match,
+ * and a single scan over the rest of the line finds both immediate
+ * references and ".area" directives. Every SDCC port has its own
+ * dispatch table and syntax descriptor, hence its own classifier,
+ * selected once by --port. For stm8, results match those of
+ * get_global(), is_label(), is_call(), get_call() and get_ref(),
+ * besides jumps to other labels, e.g.: tail calls. */
+
+#include "classify.h"
+#include "common.h"
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLOBAL_DIRECTIVE ".globl"
+
+enum dispatch
+{
+    DISPATCH_NONE,
+    DISPATCH_DIRECTIVE,
+    DISPATCH_LABEL,
+    DISPATCH_CALL,
+    DISPATCH_DATA
+};
+
+/* Assembler syntax of an SDCC port. */
+struct syntax
+{
+    /* Instructions whose operand is a called label. */
+    const char *const *calls;
+    size_t n_calls;
+    /* Instructions jumping to their operand, only taken as
+     * references to symbols, e.g.: tail calls. */
+    const char *const *jumps;
+    size_t n_jumps;
+    /* Condition codes might precede the target, e.g.: "jp nz, _f". */
+    bool conditional;
+    /* Immediate address operands, matched from the first '#'.
+     * The referenced symbol starts at the last character. */
+    const char *const *refs;
+    size_t n_refs;
+    /* Global labels might also be defined as "_f::". */
+    bool double_colon;
+    /* Names of the areas holding functions. */
+    const char *const *code_areas;
+    size_t n_code_areas;
+    /* Directives whose operands might be addresses. */
+    const char *const *data;
+    size_t n_data;
+    /* Instructions never followed by the next line, e.g.: returns
+     * and unconditional jumps, unless given a condition code. */
+    const char *const *ends;
+    size_t n_ends;
+    const char *const *conditions;
+    size_t n_conditions;
+};
+
+struct stack_op
+{
+    const char *mnemonic;
+    long delta;
+    unsigned call;
+    bool ret, iret, sp_operand;
+};
+
+struct port
+{
+    const char *name;
+    const struct syntax *syntax;
+    /* Specialized for the syntax of this port at compile time. */
+    void (*classify)(const char *line, size_t len, struct line_info *li);
+    bool (*ends_block)(const char *line);
+    const struct stack_op *stack_ops;
+    size_t n_stack_ops;
+    const struct tail *tails;
+    size_t n_tails;
+    /* First characters of stack_ops mnemonics, for quick rejection. */
+    const char *stack_first;
+    size_t interrupt_frame;
+};
+
+/* CHAR_SPACE is the same set as isspace() in the "C" locale, and
+ * CHAR_SYMBOL that of isalnum() plus '_' and '$', regardless of
+ * the current one. */
+const unsigned char char_class[256] =
+{
+    [' '] = CHAR_SPACE,
+    ['\t'] = CHAR_SPACE,
+    ['\n'] = CHAR_SPACE,
+    ['\v'] = CHAR_SPACE,
+    ['\f'] = CHAR_SPACE,
+    ['\r'] = CHAR_SPACE,
+    ['0'] = CHAR_SYMBOL, ['1'] = CHAR_SYMBOL, ['2'] = CHAR_SYMBOL, ['3'] = CHAR_SYMBOL,
+    ['4'] = CHAR_SYMBOL, ['5'] = CHAR_SYMBOL, ['6'] = CHAR_SYMBOL, ['7'] = CHAR_SYMBOL,
+    ['8'] = CHAR_SYMBOL, ['9'] = CHAR_SYMBOL,
+    ['A'] = CHAR_SYMBOL, ['B'] = CHAR_SYMBOL, ['C'] = CHAR_SYMBOL, ['D'] = CHAR_SYMBOL,
+    ['E'] = CHAR_SYMBOL, ['F'] = CHAR_SYMBOL, ['G'] = CHAR_SYMBOL, ['H'] = CHAR_SYMBOL,
+    ['I'] = CHAR_SYMBOL, ['J'] = CHAR_SYMBOL, ['K'] = CHAR_SYMBOL, ['L'] = CHAR_SYMBOL,
+    ['M'] = CHAR_SYMBOL, ['N'] = CHAR_SYMBOL, ['O'] = CHAR_SYMBOL, ['P'] = CHAR_SYMBOL,
+    ['Q'] = CHAR_SYMBOL, ['R'] = CHAR_SYMBOL, ['S'] = CHAR_SYMBOL, ['T'] = CHAR_SYMBOL,
+    ['U'] = CHAR_SYMBOL, ['V'] = CHAR_SYMBOL, ['W'] = CHAR_SYMBOL, ['X'] = CHAR_SYMBOL,
+    ['Y'] = CHAR_SYMBOL, ['Z'] = CHAR_SYMBOL,
+    ['a'] = CHAR_SYMBOL, ['b'] = CHAR_SYMBOL, ['c'] = CHAR_SYMBOL, ['d'] = CHAR_SYMBOL,
+    ['e'] = CHAR_SYMBOL, ['f'] = CHAR_SYMBOL, ['g'] = CHAR_SYMBOL, ['h'] = CHAR_SYMBOL,
+    ['i'] = CHAR_SYMBOL, ['j'] = CHAR_SYMBOL, ['k'] = CHAR_SYMBOL, ['l'] = CHAR_SYMBOL,
+    ['m'] = CHAR_SYMBOL, ['n'] = CHAR_SYMBOL, ['o'] = CHAR_SYMBOL, ['p'] = CHAR_SYMBOL,
+    ['q'] = CHAR_SYMBOL, ['r'] = CHAR_SYMBOL, ['s'] = CHAR_SYMBOL, ['t'] = CHAR_SYMBOL,
+    ['u'] = CHAR_SYMBOL, ['v'] = CHAR_SYMBOL, ['w'] = CHAR_SYMBOL, ['x'] = CHAR_SYMBOL,
+    ['y'] = CHAR_SYMBOL, ['z'] = CHAR_SYMBOL,
+    ['_'] = CHAR_SYMBOL, ['$'] = CHAR_SYMBOL
+};
+
+static bool is_mnemonic(const char *const line, const size_t len, const char *const *const list, const size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!strncmp(line, list[i], len) && !list[i][len])
+            return true;
+    }
+
+    return false;
+}
+
+static size_t token_len(const char *const line)
+{
+    size_t len = 0;
+
+    while (line[len] && !is_space(line[len]))
+    {
+        len++;
+    }
+
+    return len;
+}
+
+static bool classify_global(const char *const line, struct line_info *const li)
+{
+    if (!strncmp(line, GLOBAL_DIRECTIVE, static_strlen(GLOBAL_DIRECTIVE)))
+    {
+        const char *const p = strchr(line + static_strlen(GLOBAL_DIRECTIVE), '_');
+
+        if (p)
+        {
+            li->kind = LINE_GLOBAL;
+            li->operand = p;
+            li->operand_len = strlen(p);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool classify_area_code(const struct syntax *const sx, const char *const line)
+{
+    /* e.g.: ".area CODE" or ".area CSEG    (CODE)". */
+    const char *p = line + static_strlen(AREA_DIRECTIVE);
+
+    if (strncmp(line, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)) || !is_space(*p))
+        return false;
+
+    while (is_space(*p))
+    {
+        p++;
+    }
+
+    const size_t len = token_len(p);
+
+    return is_mnemonic(p, len, sx->code_areas, sx->n_code_areas);
+}
+
+static bool classify_label(const struct syntax *const sx, const char *const line, const size_t len,
+    struct line_info *const li)
+{
+    /* len accounts for the null terminator. */
+    if (len >= static_strlen("_a:") && line[1] != '_' && line[len - 2] == ':')
+    {
+        li->kind = LINE_LABEL;
+        li->operand = line;
+        li->operand_len = len - 2;
+
+        if (sx->double_colon && li->operand_len > 1 && line[len - 3] == ':')
+            li->operand_len--;
+
+        return true;
+    }
+
+    return false;
+}
+
+static bool classify_call(const struct syntax *const sx, const char *const line, struct line_info *const li)
+{
+    const size_t len = token_len(line);
+    const bool call = is_mnemonic(line, len, sx->calls, sx->n_calls);
+
+    if (call || is_mnemonic(line, len, sx->jumps, sx->n_jumps))
+    {
+        const char *p = line + len;
+
+        if (*p)
+        {
+            p++;
+        }
+
+        if (sx->conditional)
+        {
+            const char *const target = strrchr(p, ',');
+
+            if (target)
+            {
+                for (p = target + 1; is_space(*p); p++)
+                    ;
+            }
+        }
+
+        /* Jumps to local labels, e.g.: "00102$", are not references. */
+        if (!call && *p != '_')
+            return false;
+
+        li->kind = LINE_CALL;
+        li->operand = p;
+        li->operand_len = strlen(p);
+        return true;
+    }
+
+    return false;
+}
+
+static bool classify_data(const struct syntax *const sx, const char *const line, struct line_info *const li)
+{
+    for (size_t i = 0; i < sx->n_data; i++)
+    {
+        const size_t n = strlen(sx->data[i]);
+
+        if (!strncmp(line, sx->data[i], n) && is_space(line[n]))
+        {
+            const char *const p = line + n + 1;
+
+            /* Only symbols starting with '_' are ever labels. */
+            if (!strchr(p, '_'))
+                return false;
+
+            li->kind = LINE_DATA;
+            li->operand = p;
+            li->operand_len = strlen(p);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void classify_ref(const struct syntax *const sx, const char *p, struct line_info *const li)
+{
+    /* Only the first '#' is taken into account. */
+    for (size_t i = 0; i < sx->n_refs; i++)
+    {
+        const size_t len = strlen(sx->refs[i]);
+
+        if (!strncmp(p, sx->refs[i], len))
+        {
+            const char *const start = p + len - 1;
+            size_t n = 0;
+
+            for (p = start; *p && *p != ')' && *p != ' ' && n < MAX_CH_PER_LINE - 1; p++)
+            {
+                n++;
+            }
+
+            li->kind = LINE_REF;
+            li->operand = start;
+            li->operand_len = n;
+            return;
+        }
+    }
+}
+
+/* Instantiated once per port below. Both sx and dispatch are
+ * constants there, so each port gets a classifier of its own
+ * rather than checking the port on every line. */
+static inline void classify_port(const struct syntax *const sx, const unsigned char *const dispatch,
+    const char *const line, const size_t len, struct line_info *const li)
+{
+    const char *hash = NULL;
+
+    *li = (struct line_info){.kind = LINE_OTHER};
+
+    /* Single scan for '#' and ".area". */
+    for (const char *p = line; (p = strpbrk(p, "#.")); p++)
+    {
+        if (*p == '#')
+        {
+            if (!hash)
+                hash = p;
+        }
+        else if (!li->area)
+        {
+            li->area = !strncmp(p, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE));
+        }
+    }
+
+    switch (dispatch[(unsigned char)*line])
+    {
+        case DISPATCH_DIRECTIVE:
+            if (classify_global(line, li))
+                return;
+
+            if (li->area && classify_area_code(sx, line))
+            {
+                li->kind = LINE_AREA_CODE;
+                return;
+            }
+
+            if (classify_data(sx, line, li))
+                return;
+
+            break;
+
+        case DISPATCH_LABEL:
+            if (classify_label(sx, line, len, li))
+                return;
+
+            break;
+
+        case DISPATCH_CALL:
+            if (classify_call(sx, line, li))
+                return;
+
+            break;
+
+        case DISPATCH_DATA:
+            if (classify_data(sx, line, li))
+                return;
+
+            break;
+
+        default:
+            break;
+    }
+
+    if (hash)
+    {
+        classify_ref(sx, hash, li);
+    }
+}
+
+static inline bool ends_block_port(const struct syntax *const sx, const char *const line)
+{
+    /* e.g.: "ret" or "jp (hl)", but not "ret nz" or "jp c, 00102$". */
+    const size_t len = token_len(line);
+
+    if (!is_mnemonic(line, len, sx->ends, sx->n_ends))
+        return false;
+
+    const char *p = line + len;
+
+    while (is_space(*p))
+    {
+        p++;
+    }
+
+    return !is_mnemonic(p, strcspn(p, ", \t"), sx->conditions, sx->n_conditions);
+}
+
+#define SYNTAX_LIST(name, member) \
+    .member = name##_##member, .n_##member = lengthof (name##_##member)
+
+#define DEFINE_PORT(name, ...)                                                  \
+    static const struct syntax name##_syntax =                                  \
+    {                                                                           \
+        SYNTAX_LIST(name, calls),                                               \
+        SYNTAX_LIST(name, jumps),                                               \
+        SYNTAX_LIST(name, refs),                                                \
+        SYNTAX_LIST(name, code_areas),                                          \
+        SYNTAX_LIST(name, data),                                                \
+        SYNTAX_LIST(name, ends),                                                \
+        __VA_ARGS__                                                             \
+    };                                                                          \
+                                                                                \
+    static void classify_##name(const char *const line, const size_t len,       \
+        struct line_info *const li)                                             \
+    {                                                                           \
+        classify_port(&name##_syntax, name##_dispatch, line, len, li);          \
+    }                                                                           \
+                                                                                \
+    static bool ends_block_##name(const char *const line)                       \
+    {                                                                           \
+        return ends_block_port(&name##_syntax, line);                           \
+    }
+
+/* stm8. */
+static const char *const stm8_calls[] = {"call", "callf", "callr"};
+static const char *const stm8_jumps[] = {"jp", "jpf", "jra"};
+static const char *const stm8_refs[] = {"#(_"};
+static const char *const stm8_code_areas[] = {"CODE"};
+/* Including interrupt vectors, e.g.: "int _TIM4_IRQHandler". */
+static const char *const stm8_data[] = {".dw", ".word", ".db", ".byte", ".3byte", "int"};
+static const char *const stm8_ends[] = {"ret", "retf", "iret", "jp", "jpf", "jra", "jrt"};
+
+static const unsigned char stm8_dispatch[256] =
+{
+    ['.'] = DISPATCH_DIRECTIVE,
+    ['_'] = DISPATCH_LABEL,
+    ['c'] = DISPATCH_CALL,
+    ['j'] = DISPATCH_CALL,
+    ['i'] = DISPATCH_DATA
+};
+
+static const struct stack_op stm8_stack_ops[] =
+{
+    {.mnemonic = "push", .delta = 1},
+    {.mnemonic = "pushw", .delta = 2},
+    {.mnemonic = "pop", .delta = -1},
+    {.mnemonic = "popw", .delta = -2},
+    {.mnemonic = "sub", .delta = 1, .sp_operand = true},
+    {.mnemonic = "subw", .delta = 1, .sp_operand = true},
+    {.mnemonic = "add", .delta = -1, .sp_operand = true},
+    {.mnemonic = "addw", .delta = -1, .sp_operand = true},
+    {.mnemonic = "call", .call = 2},
+    {.mnemonic = "callr", .call = 2},
+    {.mnemonic = "callf", .call = 3},
+    {.mnemonic = "ret", .ret = true},
+    {.mnemonic = "retf", .ret = true},
+    {.mnemonic = "iret", .ret = true, .iret = true}
+};
+
+/* Relative forms, e.g.: "callr", might not reach other targets. */
+static const struct tail stm8_tails[] =
+{
+    {.call = "call", .ret = "ret", .jump = "jp"},
+    {.call = "callf", .ret = "retf", .jump = "jpf", .far = true}
+};
+
+DEFINE_PORT(stm8, .conditional = false)
+
+/* z80 and derivatives, e.g.: "call nz, _f" or "ld hl, #_f". */
+static const char *const z80_calls[] = {"call"};
+static const char *const z80_jumps[] = {"jp", "jr"};
+static const char *const z80_refs[] = {"#_", "#(_"};
+static const char *const z80_code_areas[] = {"_CODE"};
+static const char *const z80_data[] = {".dw", ".word", ".db", ".byte"};
+static const char *const z80_ends[] = {"ret", "reti", "retn", "jp", "jr"};
+static const char *const z80_conditions[] = {"nz", "z", "nc", "c", "po", "pe", "p", "m"};
+
+static const unsigned char z80_dispatch[256] =
+{
+    ['.'] = DISPATCH_DIRECTIVE,
+    ['_'] = DISPATCH_LABEL,
+    ['c'] = DISPATCH_CALL,
+    ['j'] = DISPATCH_CALL
+};
+
+static const struct stack_op z80_stack_ops[] =
+{
+    {.mnemonic = "push", .delta = 2},
+    {.mnemonic = "pop", .delta = -2},
+    {.mnemonic = "call", .call = 2},
+    {.mnemonic = "ret", .ret = true},
+    {.mnemonic = "reti", .ret = true, .iret = true},
+    {.mnemonic = "retn", .ret = true, .iret = true}
+};
+
+static const struct tail z80_tails[] =
+{
+    {.call = "call", .ret = "ret", .jump = "jp"}
+};
+
+DEFINE_PORT(z80, .conditional = true, .double_colon = true,
+    .conditions = z80_conditions, .n_conditions = lengthof (z80_conditions))
+
+/* hc08 and s08, e.g.: "jsr _f" or "lda #<_f". */
+static const char *const hc08_calls[] = {"jsr", "bsr"};
+static const char *const hc08_jumps[] = {"jmp", "bra"};
+static const char *const hc08_refs[] = {"#_", "#<_", "#>_", "#(_"};
+static const char *const hc08_code_areas[] = {"CODE", "CSEG"};
+static const char *const hc08_data[] = {".dw", ".word", ".db", ".byte"};
+static const char *const hc08_ends[] = {"rts", "rti", "jmp", "bra"};
+
+static const unsigned char hc08_dispatch[256] =
+{
+    ['.'] = DISPATCH_DIRECTIVE,
+    ['_'] = DISPATCH_LABEL,
+    ['j'] = DISPATCH_CALL,
+    ['b'] = DISPATCH_CALL
+};
+
+static const struct stack_op hc08_stack_ops[] =
+{
+    {.mnemonic = "psha", .delta = 1},
+    {.mnemonic = "pshx", .delta = 1},
+    {.mnemonic = "pshh", .delta = 1},
+    {.mnemonic = "pula", .delta = -1},
+    {.mnemonic = "pulx", .delta = -1},
+    {.mnemonic = "pulh", .delta = -1},
+    {.mnemonic = "jsr", .call = 2},
+    {.mnemonic = "bsr", .call = 2},
+    {.mnemonic = "rts", .ret = true},
+    {.mnemonic = "rti", .ret = true, .iret = true}
+};
+
+static const struct tail hc08_tails[] =
+{
+    {.call = "jsr", .ret = "rts", .jump = "jmp"}
+};
+
+DEFINE_PORT(hc08, .double_colon = true)
+
+/* mcs51, e.g.: "lcall _f" or "mov dptr, #_f". Interrupt vectors
+ * are jumps found outside any label, e.g.: "ljmp _timer0_isr". */
+static const char *const mcs51_calls[] = {"lcall", "acall"};
+static const char *const mcs51_jumps[] = {"ljmp", "ajmp", "sjmp"};
+static const char *const mcs51_refs[] = {"#_", "#<_", "#>_", "#(_"};
+static const char *const mcs51_code_areas[] = {"CSEG"};
+static const char *const mcs51_data[] = {".dw", ".word", ".db", ".byte"};
+static const char *const mcs51_ends[] = {"ret", "reti", "ljmp", "ajmp", "sjmp", "jmp"};
+
+static const unsigned char mcs51_dispatch[256] =
+{
+    ['.'] = DISPATCH_DIRECTIVE,
+    ['_'] = DISPATCH_LABEL,
+    ['l'] = DISPATCH_CALL,
+    ['a'] = DISPATCH_CALL,
+    ['s'] = DISPATCH_CALL
+};
+
+static const struct stack_op mcs51_stack_ops[] =
+{
+    {.mnemonic = "push", .delta = 1},
+    {.mnemonic = "pop", .delta = -1},
+    {.mnemonic = "lcall", .call = 2},
+    {.mnemonic = "acall", .call = 2},
+    {.mnemonic = "ret", .ret = true},
+    {.mnemonic = "reti", .ret = true, .iret = true}
+};
+
+static const struct tail mcs51_tails[] =
+{
+    {.call = "lcall", .ret = "ret", .jump = "ljmp"}
+};
+
+DEFINE_PORT(mcs51, .double_colon = true)
+
+#define PORT(port, str)                                 \
+    {                                                   \
+        .name = str,                                    \
+        .syntax = &port##_syntax,                       \
+        .classify = classify_##port,                    \
+        .ends_block = ends_block_##port,                \
+        .stack_ops = port##_stack_ops,                  \
+        .n_stack_ops = lengthof (port##_stack_ops),     \
+        .tails = port##_tails,                          \
+        .n_tails = lengthof (port##_tails),             \
+        .stack_first = port##_stack_first,              \
+        .interrupt_frame = port##_interrupt_frame       \
+    }
+
+static const char stm8_stack_first[] = "psacri";
+static const char z80_stack_first[] = "pcr";
+static const char hc08_stack_first[] = "pjbr";
+static const char mcs51_stack_first[] = "plar";
+
+/* Bytes pushed by hardware on interrupt entry. */
+enum
+{
+    /* PCE, PCH, PCL, XH, XL, YH, YL, A and CC. */
+    stm8_interrupt_frame = 9,
+    /* Return address only. */
+    z80_interrupt_frame = 2,
+    /* PCL, PCH, X, A and CCR. */
+    hc08_interrupt_frame = 5,
+    /* Return address only. */
+    mcs51_interrupt_frame = 2
+};
+
+/* Names as given to --port. The first one is the default. */
+static const struct port ports[] =
+{
+    PORT(stm8, "stm8"),
+    PORT(z80, "z80"),
+    PORT(z80, "z180"),
+    PORT(hc08, "hc08"),
+    PORT(hc08, "s08"),
+    PORT(mcs51, "mcs51")
+};
+
+const struct port *find_port(const char *const name)
+{
+    if (!name)
+        return ports;
+
+    for (size_t i = 0; i < lengthof (ports); i++)
+    {
+        if (!strcmp(ports[i].name, name))
+            return &ports[i];
+    }
+
+    return NULL;
+}
+
+const char *port_name(const struct port *const port)
+{
+    return port->name;
+}
+
+void classify(const struct port *const port, const char *const line, const size_t len, struct line_info *const li)
+{
+    port->classify(line, len, li);
+}
+
+bool is_code_area(const struct port *const port, const char *const name, const size_t len)
+{
+    return is_mnemonic(name, len, port->syntax->code_areas, port->syntax->n_code_areas);
+}
+
+size_t interrupt_frame(const struct port *const port)
+{
+    return port->interrupt_frame;
+}
+
+bool ends_block(const struct port *const port, const char *const line)
+{
+    return port->ends_block(line);
+}
+
+const struct tail *find_tail(const struct port *const port, const char *const line, bool *const call)
+{
+    const size_t len = token_len(line);
+
+    for (size_t i = 0; i < port->n_tails; i++)
+    {
+        const struct tail *const t = &port->tails[i];
+
+        if (is_mnemonic(line, len, &t->call, 1) || is_mnemonic(line, len, &t->jump, 1))
+        {
+            *call = is_mnemonic(line, len, &t->call, 1);
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+static long immediate(const char *const operands)
+{
+    /* e.g.: "sp, #4" or "sp, #0x0a". */
+    const char *const p = strchr(operands, '#');
+
+    if (!p)
+        return 0;
+
+    const long n = strtol(p[1] == '(' ? p + 2 : p + 1, NULL, 0);
+
+    return n > 0 ? n : 0;
+}
+
+bool stack_effect(const struct port *const port, const char *const line, struct stack_effect *const se)
+{
+    /* Stack pointer changes from other instructions, e.g.:
+     * "ldw sp, x", are not tracked. */
+    const struct stack_op *const table = port->stack_ops;
+
+    /* Quick rejection for most instructions. */
+    if (!*line || !strchr(port->stack_first, *line))
+        return false;
+
+    const size_t len = token_len(line);
+
+    for (size_t i = 0; i < port->n_stack_ops; i++)
+    {
+        if (strlen(table[i].mnemonic) == len && !memcmp(line, table[i].mnemonic, len))
+        {
+            const char *operands = line + len;
+
+            while (is_space(*operands))
+            {
+                operands++;
+            }
+
+            if (table[i].sp_operand)
+            {
+                if (strncmp(operands, "sp", static_strlen("sp")))
+                    return false;
+
+                *se = (struct stack_effect){.delta = table[i].delta * immediate(operands)};
+            }
+            else
+            {
+                *se = (struct stack_effect)
+                {
+                    .delta = table[i].delta,
+                    .call = table[i].call,
+                    .ret = table[i].ret,
+                    .iret = table[i].iret
+                };
+            }
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static size_t count_operands(const char *p)
+{
+    size_t n = 1;
+
+    while ((p = strchr(p, ',')))
+    {
+        n++;
+        p++;
+    }
+
+    return n;
+}
+
+size_t estimate_size(const char *const line, const struct line_info *const li)
+{
+    static const struct
+    {
+        const char *directive;
+        /* Bytes per operand, or 0 if given by the operand itself. */
+        size_t size;
+    } table[] =
+    {
+        {.directive = ".dw", .size = 2},
+        {.directive = ".word", .size = 2},
+        {.directive = ".db", .size = 1},
+        {.directive = ".byte", .size = 1},
+        {.directive = ".3byte", .size = 3},
+        {.directive = "int", .size = 4},
+        {.directive = ".ds"},
+        {.directive = ".blkb"}
+    };
+
+    if (li->kind == LINE_LABEL || li->kind == LINE_GLOBAL || li->area)
+        return 0;
+
+    size_t len = 0;
+
+    while (line[len] && !is_space(line[len]))
+    {
+        len++;
+    }
+
+    const char *operands = line + len;
+
+    while (is_space(*operands))
+    {
+        operands++;
+    }
+
+    for (size_t i = 0; i < lengthof (table); i++)
+    {
+        if (strlen(table[i].directive) == len && !memcmp(line, table[i].directive, len))
+        {
+            if (!table[i].size)
+            {
+                const long n = strtol(operands, NULL, 0);
+
+                return n > 0 ? n : 0;
+            }
+
+            return table[i].size * count_operands(operands);
+        }
+    }
+
+    if (*line == '.')
+    {
+        /* e.g.: ".ascii "abc"". */
+        const char *const q = strchr(operands, '"');
+        const char *const end = q ? strchr(q + 1, '"') : NULL;
+
+        if (end && (!strncmp(line, ".asciz", len) || !strncmp(line, ".strz", len)))
+            return end - q;
+        else if (end)
+            return end - q - 1;
+
+        /* Any other directive emits nothing. */
+        return 0;
+    }
+
+    if (!*operands)
+        return 1;
+
+    /* Registers are encoded into the opcode. */
+    size_t size = 1;
+
+    for (const char *p = operands; p; p = strchr(p, ','))
+    {
+        if (*p == ',')
+            p++;
+
+        while (is_space(*p) || *p == '#' || *p == '(' || *p == '[')
+        {
+            p++;
+        }
+
+        if (*p == '_' || (*p >= '0' && *p <= '9' && strtol(p, NULL, 0) > 0xff))
+            size += 2;
+        else if (*p >= '0' && *p <= '9')
+            size++;
+    }
+
+    return size;
+}
@@ -17,12 +17,31 @@
  */
 
 #include "common.h"
+#include "classify.h"
+#include "alloc.h"
+#include "trace.h"
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define CALL_DIRECTIVE "call"
+
+/* Execution might fall off the last instruction found in an area
+ * into whatever comes next in it, even after other areas. */
+struct area
+{
+    const char *name;
+    size_t len;
+    bool code;
+    bool falls;
+};
+
+static bool is_digit(char c);
+static bool is_symbol(char c);
+
 const char *get_line(const char *p, char *const line, size_t *const len)
 {
     if (line && len && p)
@@ -31,7 +50,7 @@ const char *get_line(const char *p, char *const line, size_t *const len)
         {
             *len = 0;
 
-            while (isspace(*p))
+            while (is_space(*p))
             {
                 p++;
             }
@@ -48,7 +67,8 @@ const char *get_line(const char *p, char *const line, size_t *const len)
             {
                 while ((*p != '\0') && (*p != '\n') && (*p != '\r'))
                 {
-                    if (*len < (size_t)MAX_CH_PER_LINE)
+                    /* Leave room for the null terminator. */
+                    if (*len < (size_t)MAX_CH_PER_LINE - 1)
                     {
                         line[(*len)++] = *p;
                     }
@@ -74,8 +94,327 @@ const char *get_line(const char *p, char *const line, size_t *const len)
     return NULL;
 }
 
-char *open(const char *const path)
+const char *scan_line(const char *p, const char **const start)
+{
+    /* Same lines as get_line(), without copying them. */
+    while (*p)
+    {
+        while (is_space(*p))
+        {
+            p++;
+        }
+
+        if (*p == ';')
+        {
+            while (*p && *p != '\n')
+            {
+                p++;
+            }
+        }
+        else
+        {
+            *start = p;
+
+            while (*p && *p != '\n' && *p != '\r')
+            {
+                p++;
+            }
+
+            if (p != *start)
+                return p;
+        }
+    }
+
+    return NULL;
+}
+
+struct text_line *index_lines(const char *const text, size_t *const n)
+{
+    struct text_line *lines;
+    const char *p = text, *start;
+
+    *n = 0;
+
+    while ((p = scan_line(p, &start)))
+    {
+        ++*n;
+    }
+
+    if (!(lines = alloc_(NULL, sizeof *lines, *n, ALLOC_TABLE)))
+        return NULL;
+
+    p = text;
+
+    for (size_t i = 0; (p = scan_line(p, &start)); i++)
+    {
+        lines[i] = (struct text_line){.start = start, .len = p - start};
+    }
+
+    return lines;
+}
+
+size_t copy_line(const struct text_line *const tl, char *const line)
+{
+    /* Lines are truncated as get_line() does. */
+    const size_t len = tl->len < MAX_CH_PER_LINE - 1 ? tl->len : MAX_CH_PER_LINE - 1;
+
+    memcpy(line, tl->start, len);
+    line[len] = '\0';
+
+    return len;
+}
+
+int scan_areas(const struct port *const port, const struct file *const f, const struct text_line *const lines,
+    const size_t n_lines, const bool *const used, const size_t base, struct sets *const s, const scan_areas_fn fn,
+    void *const arg)
+{
+    struct scanned_line sl = {.owner = SIZE_MAX};
+    /* Area of the current line, as an index into areas. */
+    size_t n_areas = 0, k = 0, cur = SIZE_MAX;
+    struct area *areas = NULL;
+    int ret = 0;
+
+    for (size_t ln = 1; ln <= n_lines && !ret; ln++)
+    {
+        char line[MAX_CH_PER_LINE];
+        struct area *const a = cur != SIZE_MAX ? &areas[cur] : NULL;
+
+        sl.ln = ln;
+        sl.line = line;
+        sl.len = copy_line(&lines[ln - 1], line);
+
+        if (k < f->n_labels && f->labels[k].start_line == ln)
+        {
+            /* Labels falling into the next one must precede it. */
+            if (a && a->falls && used[f->labels[k].id])
+            {
+                if (sl.owner != SIZE_MAX && sl.owner + 1 == k)
+                {
+                    if (used[f->labels[sl.owner].id])
+                        join_sets(s, base + sl.owner, base + k);
+                }
+                else
+                {
+                    join_sets(s, base + k, s->pinned);
+                }
+            }
+
+            /* Empty labels fall into whatever comes next. */
+            if (a)
+                a->falls = true;
+
+            sl.kind = SCANNED_LABEL;
+            sl.owner = k++;
+            sl.code = a && a->code;
+        }
+        else if (!strncmp(line, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)))
+        {
+            const char *name;
+            const size_t n = area_name(line, &name);
+
+            /* Execution continuing after the label span ends. */
+            if (a && a->falls && sl.owner != SIZE_MAX && used[f->labels[sl.owner].id])
+                join_sets(s, base + sl.owner, s->pinned);
+
+            for (cur = 0; cur < n_areas; cur++)
+            {
+                if (areas[cur].len == n && !strncmp(areas[cur].name, name, n))
+                    break;
+            }
+
+            if (cur == n_areas)
+            {
+                if (!(areas = alloc(areas, n_areas, ALLOC_TABLE)))
+                {
+                    ret = ENOMEM;
+                    break;
+                }
+
+                classify(port, line, sl.len + 1, &sl.li);
+                /* name points into the input text, not into line. */
+                areas[n_areas++] = (struct area)
+                {
+                    .name = lines[ln - 1].start + (name - line),
+                    .len = n,
+                    .code = sl.li.kind == LINE_AREA_CODE
+                };
+            }
+
+            sl.kind = SCANNED_AREA;
+            sl.owner = SIZE_MAX;
+            sl.code = areas[cur].code;
+        }
+        else
+        {
+            classify(port, line, sl.len + 1, &sl.li);
+
+            /* Instructions, e.g.: not directives, local labels or equates. */
+            if (a && *line && strchr("abcdefghijklmnopqrstuvwxyz", *line) && !strchr(line, '=')
+                && sl.li.kind != LINE_DATA)
+            {
+                a->falls = !ends_block(port, line);
+            }
+
+            sl.kind = SCANNED_OTHER;
+            sl.code = a && a->code;
+        }
+
+        ret = fn(arg, &sl);
+    }
+
+    alloc_free(areas);
+
+    return ret;
+}
+
+size_t label_end(const struct label *const l, const size_t n_lines)
+{
+    /* A label found on the last line extends until the end of file. */
+    return l->end_line > l->start_line && l->end_line <= n_lines ? l->end_line : n_lines;
+}
+
+size_t area_name(const char *const line, const char **const name)
 {
+    /* e.g.: ".area CODE" or ".area CSEG    (CODE)". */
+    const char *p = line + static_strlen(AREA_DIRECTIVE);
+    size_t n = 0;
+
+    while (is_space(*p))
+    {
+        p++;
+    }
+
+    while (p[n] && !is_space(p[n]) && p[n] != '(')
+    {
+        n++;
+    }
+
+    *name = p;
+
+    return n;
+}
+
+static bool is_digit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool is_symbol(const char c)
+{
+    return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$' || c == '.';
+}
+
+bool is_local_label(const char *const line, unsigned long *const label)
+{
+    /* e.g.: "00102$:". */
+    const char *p = line;
+
+    while (is_digit(*p))
+    {
+        p++;
+    }
+
+    if (p == line || p[0] != '$' || p[1] != ':')
+        return false;
+
+    *label = strtoul(line, NULL, 10);
+
+    return true;
+}
+
+bool next_local(const char *const line, const char **const p, unsigned long *const label)
+{
+    /* e.g.: "jrne 00102$" or "ldw x, (#00112$, x)", but not
+     * "C$main.c$10$1_0$5". */
+    for (const char *q; (q = strchr(*p, '$')); )
+    {
+        const char *d = q;
+
+        *p = q + 1;
+
+        while (d > line && is_digit(d[-1]))
+        {
+            d--;
+        }
+
+        if (d < q && (d == line || !is_symbol(d[-1])))
+        {
+            *label = strtoul(d, NULL, 10);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int init_sets(struct sets *const s, const size_t n)
+{
+    s->parent = alloc_(NULL, sizeof *s->parent, n + 1, ALLOC_TABLE);
+    s->size = alloc_(NULL, sizeof *s->size, n + 1, ALLOC_TABLE);
+    s->pinned = n;
+
+    if (!s->parent || !s->size)
+    {
+        free_sets(s);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i <= n; i++)
+    {
+        s->parent[i] = i;
+        s->size[i] = 0;
+    }
+
+    return 0;
+}
+
+void free_sets(struct sets *const s)
+{
+    alloc_free(s->parent);
+    alloc_free(s->size);
+    s->parent = NULL;
+    s->size = NULL;
+}
+
+size_t find_set(struct sets *const s, size_t i)
+{
+    while (s->parent[i] != i)
+    {
+        /* Path halving. */
+        s->parent[i] = s->parent[s->parent[i]];
+        i = s->parent[i];
+    }
+
+    return i;
+}
+
+void join_sets(struct sets *const s, const size_t a, const size_t b)
+{
+    const size_t ra = find_set(s, a), rb = find_set(s, b);
+
+    if (ra == rb)
+        return;
+
+    const size_t root = ra == s->pinned || (rb != s->pinned && ra < rb) ? ra : rb;
+    const size_t child = root == ra ? rb : ra;
+
+    s->parent[child] = root;
+    s->size[root] += s->size[child];
+}
+
+int compare_set_sizes(const void *const a, const void *const b)
+{
+    const struct set_size *const sa = a, *const sb = b;
+
+    if (sa->size != sb->size)
+        return sa->size > sb->size ? -1 : 1;
+
+    return (sa->root > sb->root) - (sa->root < sb->root);
+}
+
+char *read_file(const char *const path, size_t *const len)
+{
+    const uint64_t start = trace_begin();
     FILE *const f = fopen(path, "rb");
 
     if (f)
@@ -86,12 +425,16 @@ char *open(const char *const path)
 
             if (!sz)
             {
+                /* Callers tell an empty file from an error by len. */
+                if (len)
+                    *len = 0;
+
                 goto f_error;
             }
 
             if (!fseek(f, 0, SEEK_SET))
             {
-                char *const buf = malloc((sz + 1) * sizeof *buf);
+                char *const buf = alloc_buf((sz + 1) * sizeof *buf, ALLOC_FILE_BUF);
 
                 if (buf)
                 {
@@ -102,12 +445,17 @@ char *open(const char *const path)
                         fclose(f);
                         /* Treat text files as a NULL-terminated string. */
                         buf[sz] = '\0';
+
+                        if (len)
+                            *len = sz;
+
+                        trace_end(start, "read", &(const struct trace_args){.file = path, .bytes = sz});
                         return buf;
                     }
                     else
                     {
                         fprintf(stderr, "Only %ld out of %ld bytes were read from %s\n", read, sz, path);
-                        free(buf);
+                        alloc_free(buf);
                         goto f_error;
                     }
                 }
@@ -141,6 +489,38 @@ f_error:
     return NULL;
 }
 
+bool strbuf_append(struct strbuf *const b, const char *const s, const size_t len)
+{
+    if (b->len + len + 1 > b->cap)
+    {
+        size_t cap = b->cap ? b->cap : 256;
+
+        while (b->len + len + 1 > cap)
+        {
+            cap *= 2;
+        }
+
+        /* alloc_() allocates (elem + 1) elements. */
+        char *const data = alloc_(b->data, sizeof *data, cap - 1, ALLOC_FILE_BUF);
+
+        if (!data)
+        {
+            b->data = NULL;
+            b->len = b->cap = 0;
+            return false;
+        }
+
+        b->data = data;
+        b->cap = cap;
+    }
+
+    memcpy(b->data + b->len, s, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+
+    return true;
+}
+
 const char *get_global(const char *const line)
 {
     if (line)
@@ -167,3 +547,69 @@ const char *get_global(const char *const line)
 
     return NULL;
 }
+
+const char *get_ref(const char *const line)
+{
+    const char *p;
+
+    for (p = line; *p != '#' && *p; p++);
+
+    if (*p)
+    {
+        static const char pattern[] = "#(_";
+
+        if (!strncmp(p, pattern, static_strlen(pattern)))
+        {
+            /* Thread-local so concurrent contexts do not clash. */
+            static _Thread_local char l[MAX_CH_PER_LINE];
+
+            /* Substract one position so the '_' is also returned. */
+            const size_t offset = static_strlen(pattern) - 1;
+            size_t i = 0;
+
+            for (p += offset; *p && *p != ')' && *p != ' ' && i < lengthof (l) - 1; p++)
+            {
+                l[i++] = *p;
+            }
+
+            l[i] = '\0';
+
+            return l;
+        }
+    }
+
+    /* No reference was found. */
+    return NULL;
+}
+
+bool is_label(const char *const line, const size_t length)
+{
+    if (line && length >= static_strlen("_a:"))
+    {
+        return line[0] == '_' && line[1] != '_' && line[length - 2] == ':';
+    }
+
+    return false;
+}
+
+const char *get_call(const char *line)
+{
+    if (line)
+    {
+        for (char c = *line; !is_space(c); c = *(++line));
+
+        return ++line;
+    }
+
+    return NULL;
+}
+
+bool is_call(const char *const line)
+{
+    if (line)
+    {
+        return !strncmp(line, CALL_DIRECTIVE, static_strlen(CALL_DIRECTIVE));
+    }
+
+    return false;
+}
@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "exclude.h"
+#include "alloc.h"
+#include "common.h"
+#include "classify.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+enum op
+{
+    /* Matches a literal run of characters. */
+    OP_LITERAL,
+    /* Matches any single character. */
+    OP_ANY,
+    /* Matches a single character from a set. */
+    OP_SET,
+    /* Matches any run of characters, possibly empty. */
+    OP_STAR
+};
+
+struct insn
+{
+    enum op op;
+    size_t len;
+    const char *literal;
+    uint32_t set[256 / 32];
+};
+
+struct pattern
+{
+    char *text;
+    struct insn *insns;
+    size_t n_insns;
+    /* Shortest name able to match, used for quick rejection. */
+    size_t min_len;
+};
+
+static uint32_t hash(const char *s)
+{
+    /* FNV-1a. */
+    uint32_t h = 2166136261u;
+
+    while (*s)
+    {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+
+    return h;
+}
+
+static bool is_glob(const char *const s)
+{
+    return strpbrk(s, "*?[");
+}
+
+static char *copy_string(const char *const s)
+{
+    const size_t len = strlen(s) + 1;
+    char *const d = alloc_buf(len * sizeof *d, ALLOC_LABEL_NAME);
+
+    if (d)
+    {
+        memcpy(d, s, len);
+    }
+
+    return d;
+}
+
+static char **find_slot(char **const slots, const size_t cap, const char *const name)
+{
+    /* Linear probing. cap is always a power of two. */
+    for (size_t i = hash(name) & (cap - 1);; i = (i + 1) & (cap - 1))
+    {
+        if (!slots[i] || !strcmp(slots[i], name))
+        {
+            return &slots[i];
+        }
+    }
+}
+
+static int grow(struct exclusions *const e)
+{
+    const size_t cap = e->cap ? e->cap * 2 : 64;
+    char **const slots = alloc_buf(cap * sizeof *slots, ALLOC_TABLE);
+
+    if (!slots)
+        return ENOMEM;
+
+    memset(slots, 0, cap * sizeof *slots);
+
+    for (size_t i = 0; i < e->cap; i++)
+    {
+        if (e->names[i])
+        {
+            *find_slot(slots, cap, e->names[i]) = e->names[i];
+        }
+    }
+
+    alloc_free(e->names);
+    e->names = slots;
+    e->cap = cap;
+
+    return 0;
+}
+
+static int add_name(struct exclusions *const e, const char *const name)
+{
+    /* Keep load factor under 1/2. */
+    if ((e->n_names + 1) * 2 > e->cap)
+    {
+        const int ret = grow(e);
+
+        if (ret)
+            return ret;
+    }
+
+    char **const slot = find_slot(e->names, e->cap, name);
+
+    if (*slot)
+        return EEXIST;
+
+    if (!(*slot = copy_string(name)))
+        return ENOMEM;
+
+    e->n_names++;
+
+    return 0;
+}
+
+static const char *compile_set(const char *p, struct insn *const in)
+{
+    /* p points right after '['. Returns NULL for unterminated
+     * sets, which are then handled as literals by the caller. */
+    bool negate = false;
+
+    memset(in->set, 0, sizeof in->set);
+
+    if (*p == '!' || *p == '^')
+    {
+        negate = true;
+        p++;
+    }
+
+    /* A leading ']' is part of the set. */
+    if (*p == ']')
+    {
+        in->set[']' / 32] |= UINT32_C(1) << (']' % 32);
+        p++;
+    }
+
+    for (; *p && *p != ']'; p++)
+    {
+        unsigned char lo = *p, hi = *p;
+
+        if (p[1] == '-' && p[2] && p[2] != ']')
+        {
+            hi = p[2];
+            p += 2;
+        }
+
+        for (unsigned c = lo; c <= hi; c++)
+        {
+            in->set[c / 32] |= UINT32_C(1) << (c % 32);
+        }
+    }
+
+    if (!*p)
+        return NULL;
+
+    if (negate)
+    {
+        for (size_t i = 0; i < lengthof (in->set); i++)
+        {
+            in->set[i] = ~in->set[i];
+        }
+
+        /* Never match the null terminator. */
+        in->set[0] &= ~UINT32_C(1);
+    }
+
+    return p + 1;
+}
+
+static int compile(const char *const text, struct pattern *const pt)
+{
+    *pt = (struct pattern){0};
+
+    if (!(pt->text = copy_string(text)))
+        return ENOMEM;
+
+    /* Each character yields at most one instruction. */
+    if (!(pt->insns = alloc_buf((strlen(text) + 1) * sizeof *pt->insns, ALLOC_TABLE)))
+    {
+        alloc_free(pt->text);
+        return ENOMEM;
+    }
+
+    for (const char *p = pt->text; *p; )
+    {
+        struct insn *const in = &pt->insns[pt->n_insns++];
+        const char *next;
+
+        if (*p == '*')
+        {
+            /* Consecutive stars are equivalent to a single one. */
+            while (*p == '*')
+                p++;
+
+            in->op = OP_STAR;
+        }
+        else if (*p == '?')
+        {
+            in->op = OP_ANY;
+            pt->min_len++;
+            p++;
+        }
+        else if (*p == '[' && (next = compile_set(p + 1, in)))
+        {
+            in->op = OP_SET;
+            pt->min_len++;
+            p = next;
+        }
+        else
+        {
+            /* Literal run until next metacharacter. An unterminated
+             * set is taken literally. */
+            const char *const start = p;
+
+            do
+            {
+                p++;
+            } while (*p && !strchr("*?[", *p));
+
+            in->op = OP_LITERAL;
+            in->literal = start;
+            in->len = p - start;
+            pt->min_len += in->len;
+        }
+    }
+
+    return 0;
+}
+
+static bool match_one(const struct insn *const in, const char *const s)
+{
+    switch (in->op)
+    {
+        case OP_LITERAL:
+            return !strncmp(s, in->literal, in->len);
+
+        case OP_ANY:
+            return *s;
+
+        case OP_SET:
+            return in->set[(unsigned char)*s / 32] & (UINT32_C(1) << ((unsigned char)*s % 32));
+
+        default:
+            return false;
+    }
+}
+
+static size_t insn_len(const struct insn *const in)
+{
+    return in->op == OP_LITERAL ? in->len : 1;
+}
+
+static bool match(const struct pattern *const pt, const char *s, const size_t len)
+{
+    /* Classic wildcard matching: on mismatch, backtrack to the last
+     * star and let it swallow one more character. Linear for patterns
+     * with a single star, which covers the usual prefix/suffix cases. */
+    const struct insn *in = pt->insns;
+    const struct insn *const end = pt->insns + pt->n_insns;
+    const struct insn *star = NULL;
+    const char *star_s = NULL;
+
+    if (len < pt->min_len)
+        return false;
+
+    for (;;)
+    {
+        if (in < end && in->op == OP_STAR)
+        {
+            star = ++in;
+            star_s = s;
+        }
+        else if (in < end && match_one(in, s))
+        {
+            s += insn_len(in);
+            in++;
+        }
+        else if (in == end && !*s)
+        {
+            return true;
+        }
+        else if (star && *star_s)
+        {
+            in = star;
+            s = ++star_s;
+        }
+        else
+        {
+            return false;
+        }
+    }
+}
+
+int exclusions_add(struct exclusions *const e, const char *const text)
+{
+    if (!is_glob(text))
+    {
+        return add_name(e, text);
+    }
+
+    for (size_t i = 0; i < e->n_patterns; i++)
+    {
+        if (!strcmp(e->patterns[i].text, text))
+            return EEXIST;
+    }
+
+    struct pattern pt;
+    int ret = compile(text, &pt);
+
+    if (ret)
+        return ret;
+
+    e->patterns = alloc(e->patterns, e->n_patterns, ALLOC_TABLE);
+
+    if (!e->patterns)
+    {
+        e->n_patterns = 0;
+        alloc_free(pt.text);
+        alloc_free(pt.insns);
+        return ENOMEM;
+    }
+
+    e->patterns[e->n_patterns++] = pt;
+
+    return 0;
+}
+
+int exclusions_add_file(struct exclusions *const e, const char *const path)
+{
+    size_t len = SIZE_MAX;
+    char *const buf = read_file(path, &len);
+
+    if (!buf)
+    {
+        /* An empty file is a valid list without patterns. */
+        if (!len)
+            return 0;
+
+        return errno ? errno : EIO;
+    }
+
+    /* One pattern per line. Blank lines and lines
+     * starting with '#' or ';' are ignored. */
+    int ret = 0;
+
+    for (char *p = buf; *p && !ret; )
+    {
+        char *eol = p + strcspn(p, "\r\n");
+        const char next = *eol;
+
+        *eol = '\0';
+
+        while (is_space(*p))
+        {
+            p++;
+        }
+
+        for (char *q = eol; q > p && is_space(q[-1]); )
+        {
+            *--q = '\0';
+        }
+
+        if (*p && *p != '#' && *p != ';')
+        {
+            ret = exclusions_add(e, p);
+
+            if (ret == EEXIST)
+                ret = 0;
+        }
+
+        p = next ? eol + 1 : eol;
+    }
+
+    alloc_free(buf);
+
+    return ret;
+}
+
+bool exclusions_match(const struct exclusions *const e, const char *const name)
+{
+    if (e->n_names && *find_slot(e->names, e->cap, name))
+    {
+        return true;
+    }
+
+    if (e->n_patterns)
+    {
+        const size_t len = strlen(name);
+
+        for (size_t i = 0; i < e->n_patterns; i++)
+        {
+            if (match(&e->patterns[i], name, len))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void exclusions_free(struct exclusions *const e)
+{
+    for (size_t i = 0; i < e->cap; i++)
+    {
+        alloc_free(e->names[i]);
+    }
+
+    for (size_t i = 0; i < e->n_patterns; i++)
+    {
+        alloc_free(e->patterns[i].text);
+        alloc_free(e->patterns[i].insns);
+    }
+
+    alloc_free(e->names);
+    alloc_free(e->patterns);
+    *e = (struct exclusions){0};
+}
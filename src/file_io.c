@@ -0,0 +1,800 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Batched file I/O. On Linux, opens, size queries, reads, writes and
+ * closes for many files are submitted together through io_uring, so
+ * many small files cost a handful of system calls instead of several
+ * per file. Completed reads are handed over in order while the rest
+ * are still in flight. Wherever io_uring is not available, or an
+ * operation is not supported by the running kernel, files are read
+ * and written one by one through stdio instead. */
+
+#define _GNU_SOURCE
+
+#include "file_io.h"
+#include "alloc.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#if defined(__linux__) && __has_include(<linux/fs.h>)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_CLONE 1
+#endif
+
+/* Implemented in common.c. Declared here since common.h
+ * conflicts with POSIX open(), needed by io_uring below. */
+char *read_file(const char *path, size_t *len);
+
+static int read_fallback(const size_t i, const char *const path, const read_done_fn done, void *const arg)
+{
+    errno = 0;
+
+    size_t len;
+    char *const buf = read_file(path, &len);
+
+    if (!buf)
+        return errno ? errno : EIO;
+
+    return done(arg, i, buf, len);
+}
+
+static int write_fallback(const char *const path, const char *const buf, const size_t len)
+{
+    const uint64_t start = trace_begin();
+    FILE *const f = fopen(path, "wb");
+    int error = 0;
+
+    if (f)
+    {
+        if (fwrite(buf, sizeof *buf, len, f) != len)
+        {
+            error = errno ? errno : EIO;
+        }
+
+        if (fclose(f) && !error)
+        {
+            error = errno ? errno : EIO;
+        }
+    }
+    else
+    {
+        error = errno ? errno : EIO;
+    }
+
+    if (error)
+    {
+        fprintf(stderr, "Could not write %s\n", path);
+    }
+
+    trace_end(start, "write", &(const struct trace_args){.file = path, .bytes = len});
+
+    return error;
+}
+
+#ifdef HAVE_IO_URING
+
+enum
+{
+    RING_ENTRIES = 64,
+    /* Operations per file in flight at once: open and size query. */
+    MAX_OPS_PER_FILE = 2
+};
+
+enum op
+{
+    OP_OPEN,
+    OP_STAT,
+    OP_READ,
+    OP_WRITE,
+    OP_CLOSE,
+
+    N_OPS
+};
+
+struct ring
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqes_sz;
+    unsigned queued;
+    unsigned in_flight;
+};
+
+/* Per-file state for a batch. */
+struct job
+{
+    const char *path;
+    char *buf;
+    const char *wbuf;
+    size_t size;
+    size_t off;
+    int fd;
+    int error;
+    unsigned pending;
+    bool started;
+    bool done;
+    struct statx stx;
+    uint64_t start;
+};
+
+static int ring_setup(struct ring *const r, const unsigned entries)
+{
+    struct io_uring_params p = {0};
+
+    *r = (struct ring){.fd = -1};
+
+    if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+        return errno;
+
+    r->entries = p.sq_entries;
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    r->sqes_sz = p.sq_entries * sizeof (struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_sz > r->sq_sz)
+            r->sq_sz = r->cq_sz;
+
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+
+    if (r->sq_ptr == MAP_FAILED)
+        goto failed_sq;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->cq_ptr = r->sq_ptr;
+    }
+    else if ((r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        goto failed_cq;
+    }
+
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+    if (r->sqes == MAP_FAILED)
+        goto failed_sqes;
+
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+    return 0;
+
+failed_sqes:
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+
+failed_cq:
+    munmap(r->sq_ptr, r->sq_sz);
+
+failed_sq:
+    close(r->fd);
+    return ENOMEM;
+}
+
+static void ring_release(struct ring *const r)
+{
+    munmap(r->sqes, r->sqes_sz);
+
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->fd);
+}
+
+static struct io_uring_sqe *ring_sqe(struct ring *const r, const size_t job, const enum op op)
+{
+    /* Callers never exceed r->entries operations in flight,
+     * so there is always a free submission entry. */
+    const unsigned tail = *r->sq_tail;
+    const unsigned i = tail & *r->sq_mask;
+    struct io_uring_sqe *const sqe = &r->sqes[i];
+
+    memset(sqe, 0, sizeof *sqe);
+    sqe->user_data = (uint64_t)job * N_OPS + op;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+    r->in_flight++;
+
+    return sqe;
+}
+
+static int ring_submit_and_wait(struct ring *const r)
+{
+    for (;;)
+    {
+        const int ret = syscall(__NR_io_uring_enter, r->fd, r->queued,
+            r->in_flight ? 1 : 0, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (ret >= 0)
+        {
+            r->queued -= ret;
+            return 0;
+        }
+        else if (errno != EINTR)
+        {
+            return errno;
+        }
+    }
+}
+
+static void queue_open(struct ring *const r, struct job *const j, const size_t i, const int flags)
+{
+    struct io_uring_sqe *const sqe = ring_sqe(r, i, OP_OPEN);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)j->path;
+    sqe->len = 0666;
+    sqe->open_flags = flags | O_CLOEXEC;
+    j->pending++;
+}
+
+static void queue_rw(struct ring *const r, struct job *const j, const size_t i, const enum op op)
+{
+    struct io_uring_sqe *const sqe = ring_sqe(r, i, op);
+
+    sqe->opcode = op == OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = j->fd;
+    sqe->addr = op == OP_READ ? (uintptr_t)(j->buf + j->off) : (uintptr_t)(j->wbuf + j->off);
+    sqe->len = j->size - j->off;
+    sqe->off = j->off;
+    j->pending++;
+}
+
+static void queue_close(struct ring *const r, struct job *const j, const size_t i)
+{
+    struct io_uring_sqe *const sqe = ring_sqe(r, i, OP_CLOSE);
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = j->fd;
+    j->pending++;
+}
+
+static void job_fail(struct ring *const r, struct job *const j, const size_t i, const int error)
+{
+    if (!j->error)
+        j->error = error;
+
+    if (!j->pending && j->fd >= 0)
+    {
+        queue_close(r, j, i);
+        j->fd = -1;
+    }
+    else if (!j->pending)
+    {
+        j->done = true;
+    }
+}
+
+static void read_advance(struct ring *const r, struct job *const j, const size_t i)
+{
+    if (j->pending)
+    {
+        /* Still waiting for the open or the size query. */
+    }
+    else if (j->error)
+    {
+        job_fail(r, j, i, j->error);
+    }
+    else if (j->off < j->size)
+    {
+        queue_rw(r, j, i, OP_READ);
+    }
+    else
+    {
+        queue_close(r, j, i);
+        j->fd = -1;
+    }
+}
+
+static void read_complete(struct ring *const r, struct job *const j, const size_t i,
+    const enum op op, const int res)
+{
+    j->pending--;
+
+    switch (op)
+    {
+        case OP_OPEN:
+            if (res < 0)
+                j->error = -res;
+            else
+                j->fd = res;
+
+            break;
+
+        case OP_STAT:
+            if (res < 0)
+            {
+                j->error = -res;
+            }
+            else if (!(j->size = j->stx.stx_size))
+            {
+                /* Empty files are rejected, as read_file() does. */
+                j->error = EINVAL;
+            }
+            else if (!(j->buf = alloc_buf((j->size + 1) * sizeof *j->buf, ALLOC_FILE_BUF)))
+            {
+                j->error = ENOMEM;
+            }
+
+            break;
+
+        case OP_READ:
+            if (res == -EINTR || res == -EAGAIN)
+            {
+                /* Retried below. */
+            }
+            else if (res < 0)
+            {
+                j->error = -res;
+            }
+            else if (!res)
+            {
+                /* File was truncated meanwhile. */
+                j->size = j->off;
+            }
+            else
+            {
+                j->off += res;
+            }
+
+            break;
+
+        case OP_CLOSE:
+            j->done = true;
+            return;
+
+        default:
+            break;
+    }
+
+    read_advance(r, j, i);
+}
+
+static int read_uring(struct ring *const r, const size_t n, const char *const *const paths,
+    const read_done_fn done, void *const arg)
+{
+    struct job *const jobs = alloc_buf(n * sizeof *jobs, ALLOC_TABLE);
+    size_t next_start = 0, next_commit = 0;
+    int ret = 0;
+    bool stop = false, ring_failed = false;
+
+    if (!jobs)
+        return ENOMEM;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        jobs[i] = (struct job){.path = paths[i], .fd = -1};
+    }
+
+    while (next_commit < n)
+    {
+        while (!stop && next_start < n && r->in_flight + MAX_OPS_PER_FILE <= r->entries)
+        {
+            struct job *const j = &jobs[next_start];
+            struct io_uring_sqe *sqe;
+
+            j->start = trace_begin();
+            j->started = true;
+            queue_open(r, j, next_start, O_RDONLY);
+
+            sqe = ring_sqe(r, next_start, OP_STAT);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)j->path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (uintptr_t)&j->stx;
+            j->pending++;
+
+            next_start++;
+        }
+
+        if (r->in_flight)
+        {
+            const int error = ring_submit_and_wait(r);
+
+            if (error)
+            {
+                /* Nothing can be reaped: give up on the ring. Buffers
+                 * still owned by the kernel are deliberately leaked. */
+                ring_failed = true;
+                break;
+            }
+        }
+
+        unsigned head = *r->cq_head;
+
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe *const cqe = &r->cqes[head & *r->cq_mask];
+            const size_t i = cqe->user_data / N_OPS;
+
+            r->in_flight--;
+            read_complete(r, &jobs[i], i, cqe->user_data % N_OPS, cqe->res);
+            head++;
+        }
+
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+        /* Hand over completed files in order. */
+        while (next_commit < n && jobs[next_commit].done)
+        {
+            struct job *const j = &jobs[next_commit];
+
+            if (stop)
+            {
+                alloc_free(j->buf);
+            }
+            else if (j->error)
+            {
+                /* The running kernel might lack some operation,
+                 * so try the portable path before giving up. */
+                alloc_free(j->buf);
+
+                if ((ret = read_fallback(next_commit, j->path, done, arg)))
+                    stop = true;
+            }
+            else
+            {
+                trace_end(j->start, "read", &(const struct trace_args)
+                    {
+                        .file = j->path,
+                        .bytes = j->size
+                    });
+
+                j->buf[j->size] = '\0';
+
+                /* Ownership is transferred to the callback. */
+                if ((ret = done(arg, next_commit, j->buf, j->size)))
+                    stop = true;
+            }
+
+            j->buf = NULL;
+            next_commit++;
+        }
+
+        if (stop && next_commit == next_start && !r->in_flight)
+            break;
+    }
+
+    for (; ring_failed && !ret && next_commit < n; next_commit++)
+    {
+        ret = read_fallback(next_commit, paths[next_commit], done, arg);
+    }
+
+    alloc_free(jobs);
+    return ret;
+}
+
+static void write_complete(struct ring *const r, struct job *const j, const size_t i,
+    const enum op op, const int res)
+{
+    j->pending--;
+
+    switch (op)
+    {
+        case OP_OPEN:
+            if (res < 0)
+            {
+                j->error = -res;
+                j->done = true;
+            }
+            else
+            {
+                j->fd = res;
+
+                if (j->size)
+                {
+                    queue_rw(r, j, i, OP_WRITE);
+                }
+                else
+                {
+                    queue_close(r, j, i);
+                }
+            }
+
+            break;
+
+        case OP_WRITE:
+            if (res < 0 && res != -EINTR && res != -EAGAIN)
+            {
+                j->error = -res;
+            }
+            else if (!res)
+            {
+                j->error = EIO;
+            }
+            else if (res > 0)
+            {
+                j->off += res;
+            }
+
+            if (!j->error && j->off < j->size)
+            {
+                queue_rw(r, j, i, OP_WRITE);
+            }
+            else
+            {
+                queue_close(r, j, i);
+            }
+
+            break;
+
+        case OP_CLOSE:
+            if (res < 0 && !j->error)
+                j->error = -res;
+
+            j->done = true;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static int write_uring(struct ring *const r, const size_t n, const char *const *const paths,
+    const char *const *const bufs, const size_t *const lens)
+{
+    struct job *const jobs = alloc_buf(n * sizeof *jobs, ALLOC_TABLE);
+    size_t next_start = 0, n_done = 0;
+    int ret = 0;
+
+    if (!jobs)
+        return ENOMEM;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        jobs[i] = (struct job)
+        {
+            .path = paths[i],
+            .wbuf = bufs[i],
+            .size = lens[i],
+            .fd = -1
+        };
+    }
+
+    while (n_done < n)
+    {
+        while (next_start < n && r->in_flight < r->entries)
+        {
+            struct job *const j = &jobs[next_start];
+
+            j->start = trace_begin();
+            queue_open(r, j, next_start, O_WRONLY | O_CREAT | O_TRUNC);
+            next_start++;
+        }
+
+        if (r->in_flight)
+        {
+            const int error = ring_submit_and_wait(r);
+
+            if (error)
+            {
+                /* Rewrite whatever is left through stdio. */
+                for (size_t i = 0; i < n; i++)
+                {
+                    if (!jobs[i].done)
+                    {
+                        const int e = write_fallback(paths[i], bufs[i], lens[i]);
+
+                        if (e && !ret)
+                            ret = e;
+                    }
+                }
+
+                break;
+            }
+        }
+
+        unsigned head = *r->cq_head;
+
+        while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe *const cqe = &r->cqes[head & *r->cq_mask];
+            const size_t i = cqe->user_data / N_OPS;
+            struct job *const j = &jobs[i];
+
+            r->in_flight--;
+            write_complete(r, j, i, cqe->user_data % N_OPS, cqe->res);
+
+            if (j->done)
+            {
+                if (j->error)
+                {
+                    /* Retry through stdio, which also reports the error. */
+                    const int error = write_fallback(j->path, j->wbuf, j->size);
+
+                    if (error && !ret)
+                        ret = error;
+                }
+                else
+                {
+                    trace_end(j->start, "write", &(const struct trace_args)
+                        {
+                            .file = j->path,
+                            .bytes = j->size
+                        });
+                }
+
+                n_done++;
+            }
+
+            head++;
+        }
+
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    alloc_free(jobs);
+    return ret;
+}
+
+#endif /* HAVE_IO_URING */
+
+int read_files(const size_t n, const char *const *const paths, const read_done_fn done, void *const arg)
+{
+#ifdef HAVE_IO_URING
+    struct ring r;
+
+    if (n > 1 && !ring_setup(&r, RING_ENTRIES))
+    {
+        const int ret = read_uring(&r, n, paths, done, arg);
+
+        ring_release(&r);
+        return ret;
+    }
+#endif
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const int ret = read_fallback(i, paths[i], done, arg);
+
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+int write_files(const size_t n, const char *const *const paths, const char *const *const bufs,
+    const size_t *const lens)
+{
+    int ret = 0;
+
+#ifdef HAVE_IO_URING
+    struct ring r;
+
+    if (n > 1 && !ring_setup(&r, RING_ENTRIES))
+    {
+        ret = write_uring(&r, n, paths, bufs, lens);
+        ring_release(&r);
+        return ret;
+    }
+#endif
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const int error = write_fallback(paths[i], bufs[i], lens[i]);
+
+        if (error && !ret)
+            ret = error;
+    }
+
+    return ret;
+}
+
+#ifdef HAVE_CLONE
+static int clone_fd(const int in, const int out)
+{
+    struct stat st;
+
+    /* Reflinks share extents, so nothing is copied at all. */
+    if (!ioctl(out, FICLONE, in))
+        return 0;
+    else if (fstat(in, &st))
+        return errno;
+
+    /* Still avoids copying through user space. */
+    for (off_t left = st.st_size; left > 0; )
+    {
+        const ssize_t n = copy_file_range(in, NULL, out, NULL, left, 0);
+
+        if (n <= 0)
+            return n ? errno : EIO;
+
+        left -= n;
+    }
+
+    return 0;
+}
+#endif
+
+int copy_file(const char *const src, const char *const dst)
+{
+    int ret = ENOTSUP;
+
+#ifdef HAVE_CLONE
+    /* Failures are returned and callers fall back to writing the
+     * file out, so errno, which the CLI exits with, is kept. */
+    const int saved = errno;
+    const uint64_t start = trace_begin();
+    const int in = open(src, O_RDONLY | O_CLOEXEC);
+    const int out = in < 0 ? -1 : open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (in < 0 || out < 0)
+        ret = errno;
+    else
+        ret = clone_fd(in, out);
+
+    if (out >= 0 && close(out) && !ret)
+        ret = errno;
+
+    if (in >= 0)
+        close(in);
+
+    trace_end(start, "copy", &(const struct trace_args){.file = dst});
+    errno = saved;
+#else
+    (void)src;
+    (void)dst;
+#endif
+
+    return ret;
+}
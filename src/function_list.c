@@ -19,303 +19,725 @@
 #include "function_list.h"
 #include "alloc.h"
 #include "common.h"
-#include "options.h"
+#include "log.h"
+#include "classify.h"
+#include "trace.h"
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
-#include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-
-#define CALL_DIRECTIVE "call"
-
-static bool is_label(const char *line, size_t length);
-static bool is_call(const char *line);
-static const char *get_ref(const char *line);
-static const char *get_call(const char *line);
-static struct file parse(const char *buf);
-static void append_called_label(const char *const called_label, struct file *const f);
-static void append_label(const char *p, size_t line_no, const char *line, struct label *l);
-static void append_global_label(const char *p, size_t line_no, const char *line, struct label *l);
-static void append_static_label(const char *p, size_t line_no, const char *line, struct label *l);
-static size_t get_label_end(const char *p, size_t line_no);
-
-struct tree get_function_list(const size_t n_files, const char *const *const files)
-{
-    struct tree t = {0};
+#include <unistd.h>
 
-    for (size_t i = 0; i < n_files; i++)
+enum
+{
+    /* Inputs from this size onwards are tokenized in parallel,
+     * in chunks of at least PARSE_CHUNK_MIN bytes. */
+    PARSE_CHUNK_THRESHOLD = 4 << 20,
+    PARSE_CHUNK_MIN = 1 << 20
+};
+
+/* Everything parse_line() needs from a line, so lines can be
+ * tokenized and classified in parallel, then parsed in order. */
+struct line_record
+{
+    enum line_kind kind;
+    bool area;
+    bool has_effect;
+    struct stack_effect se;
+    /* Consecutive lines with nothing to parse, i.e.: LINE_OTHER
+     * with no stack effect, might be merged into one record. */
+    size_t n_lines;
+    size_t size;
+    /* Null-terminated operand, as an offset into the line
+     * or the text of the chunk holding the record. */
+    size_t operand;
+    size_t operand_len;
+    /* Instruction never followed by the next line, e.g.: "ret". */
+    bool ends;
+    /* Local label defined by the line, e.g.: "00102$:", or the
+     * first one an instruction branches to, e.g.: "jrne 00102$". */
+    enum
     {
-        const char *const file_name = files[i];
-        char *const buf = open(file_name);
+        LOCAL_NONE,
+        LOCAL_DEF,
+        LOCAL_BRANCH
+    } local;
+    unsigned long local_label;
+};
+
+/* Stack bytes in use when branching to a local label. */
+struct branch
+{
+    unsigned long label;
+    size_t depth;
+};
+
+struct chunk
+{
+    const struct port *port;
+    const char *begin;
+    /* Newline ending the chunk, or NULL for the last one. */
+    char *seam;
+    struct line_record *records;
+    size_t n_records;
+    size_t cap;
+    struct strbuf text;
+    bool error;
+};
+
+/* State carried from one line to the next one. */
+struct parser
+{
+    const struct sdccrm *c;
+    struct file f;
+    size_t line_no;
+    bool area_code_found;
+    /* Labels from this index onwards have not found their end yet. */
+    size_t first_open;
+    /* Stack bytes in use by the last label found, and whether
+     * the last block found ended, e.g.: on an early return. */
+    size_t depth;
+    bool ended;
+    /* Worst depth found for every local label branched to
+     * from the last label found. */
+    struct branch *branches;
+    size_t n_branches;
+    /* Whether the last label found extends up to this line. */
+    bool in_label;
+};
+
+static struct file parse(const struct sdccrm *c, const char *name, char *buf, size_t len, size_t n_chunks);
+static void read_line(const struct port *port, char *line, size_t len, struct line_record *r);
+static void parse_line(struct parser *ps, const struct line_record *r, const char *operand);
+static size_t count_chunks(size_t len);
+static bool parse_chunks(struct parser *ps, char *buf, size_t len, size_t n_chunks);
+static void *tokenize(void *arg);
+static void close_labels(struct file *f, size_t *first_open, size_t line_no);
+static void append_called_label(const char *called_label, size_t len, size_t depth, struct file *f);
+static void track_stack(struct parser *ps, const struct line_record *r, const char *operand);
+static struct branch *find_branch(const struct parser *ps, unsigned long label);
+static void append_data_refs(struct file *f, const char *operand, bool in_label);
+static void append_root(struct file *f, const char *name, size_t len);
+static void append_label(size_t line_no, const char *line, struct label *l);
+static void append_global_label(size_t line_no, const char *line, struct label *l);
+static void append_static_label(size_t line_no, const char *line, struct label *l);
+
+struct file get_function_list(const struct sdccrm *const c, const struct input *const in)
+{
+    const uint64_t start = trace_begin();
+    const struct file label_list = parse(c, in->name, in->buf, in->len, count_chunks(in->len));
 
-        if (buf)
+    trace_end(start, "parse", &(const struct trace_args)
         {
-            const struct file label_list = parse(buf);
+            .file = in->name,
+            .bytes = in->len,
+            .labels = label_list.n_labels
+        });
 
-            t.files = alloc(t.files, t.n_files);
+    return label_list;
+}
 
-            if (t.files)
-            {
-                t.files[t.n_files] = label_list;
-                t.files[t.n_files].name = file_name;
+struct file get_function_list_serial(const struct sdccrm *const c, const struct input *const in)
+{
+    return parse(c, in->name, in->buf, in->len, 1);
+}
 
-                t.n_files++;
-            }
+static struct file parse(const struct sdccrm *const c, const char *const name, char *const buf, const size_t len,
+    const size_t n_chunks)
+{
+    struct parser ps = {.c = c, .f.name = name, .line_no = 1};
 
-            free(buf);
-        }
-        else
+    /* Any chunk failing to allocate its records falls back to
+     * parsing serially, rather than missing any reference. */
+    if (n_chunks < 2 || !parse_chunks(&ps, buf, len, n_chunks))
+    {
+        const char *p = buf;
+        char line[MAX_CH_PER_LINE];
+        size_t line_len;
+
+        while ((p = get_line(p, line, &line_len)))
         {
-            /* File could not be read for some reason. */
-            break;
+            struct line_record r;
+
+            read_line(c->port, line, line_len, &r);
+            /* Operands point into line. */
+            parse_line(&ps, &r, line + r.operand);
         }
     }
 
-    return t;
+    /* Remaining labels extend until the end of file. */
+    for (size_t i = ps.first_open; i < ps.f.n_labels; i++)
+    {
+        ps.f.labels[i].end_line = ps.line_no - 1;
+    }
+
+    alloc_free(ps.branches);
+
+    return ps.f;
 }
 
-static struct file parse(const char *const buf)
+static void read_line(const struct port *const port, char *const line, const size_t len, struct line_record *const r)
 {
-    const char *p = buf;
-    char line[MAX_CH_PER_LINE];
-    size_t len;
+    struct line_info li;
+
+    classify(port, line, len, &li);
+
+    *r = (struct line_record)
+    {
+        .kind = li.kind,
+        .area = li.area,
+        .n_lines = 1,
+        .operand = li.operand ? li.operand - line : 0,
+        .operand_len = li.operand_len
+    };
+
+    r->has_effect = stack_effect(port, line, &r->se);
+    r->size = estimate_size(line, &li);
+
+    if (li.kind == LINE_OTHER && is_local_label(line, &r->local_label))
+    {
+        r->local = LOCAL_DEF;
+    }
+    else if (*line >= 'a' && *line <= 'z' && li.kind != LINE_DATA)
+    {
+        const char *p = line;
+
+        /* Instructions only, unlike e.g.: "ar2 = 0x02". */
+        r->ends = ends_block(port, line) && !strchr(line, '=');
+
+        if (next_local(line, &p, &r->local_label) && !strchr(line, '='))
+            r->local = LOCAL_BRANCH;
+    }
+
+    if (li.operand)
+    {
+        /* e.g.: suppress ':' from labels. */
+        line[r->operand + r->operand_len] = '\0';
+    }
+}
+
+static void parse_line(struct parser *const ps, const struct line_record *const r, const char *const operand)
+{
+    struct file *const f = &ps->f;
+    const size_t line_no = ps->line_no;
+
+    ps->line_no += r->n_lines;
 
-    struct
+    if (r->kind == LINE_LABEL || r->area)
     {
-        char **names;
-        size_t n;
-    } global = {0};
+        close_labels(f, &ps->first_open, line_no);
+
+        if (r->area)
+            ps->in_label = false;
+    }
+
+    if (r->kind == LINE_GLOBAL)
+    {
+        f->globals = alloc(f->globals, f->n_globals, ALLOC_TABLE);
+
+        if (f->globals)
+        {
+            f->globals[f->n_globals] = alloc_buf(sizeof (**f->globals) * (r->operand_len + 1), ALLOC_LABEL_NAME);
 
-    struct file f = {0};
-    bool area_code_found = false;
+            /* Dump global label name into the list. */
+            if (f->globals[f->n_globals])
+                strcpy(f->globals[f->n_globals++], operand);
+        }
+        else
+        {
+            f->n_globals = 0;
+        }
+    }
+    else if (r->kind == LINE_DATA)
+    {
+        /* Address tables, e.g.: interrupt vectors or
+         * function pointer arrays, found in any area. */
+        append_data_refs(f, operand, ps->in_label);
 
-    for (size_t line_no = 1; (p = get_line(p, line, &len)); line_no++)
+        if (ps->in_label)
+            f->labels[f->n_labels - 1].size += r->size;
+    }
+    else if (!ps->in_label && (r->kind == LINE_CALL || r->kind == LINE_REF))
+    {
+        /* References from outside any label, e.g.: startup code
+         * or interrupt vectors jumping to their handlers. */
+        append_root(f, operand, r->operand_len);
+    }
+    else if (!ps->area_code_found)
     {
-        const char *const global_label = get_global(line);
+        if (r->kind == LINE_AREA_CODE)
+            ps->area_code_found = true;
+    }
+    else if (r->kind == LINE_LABEL)
+    {
+        /* Check whether found label is global. */
+        bool match = false;
+
+        f->labels = alloc(f->labels, f->n_labels, ALLOC_TABLE);
 
-        if (global_label)
+        if (f->labels)
         {
-            global.names = alloc(global.names, global.n);
+            struct label *l = &f->labels[f->n_labels];
+
+            /* Clear newly allocated data. */
+            memset(l, 0, sizeof *l);
 
-            if (global.names)
+            for (size_t i = 0; i < f->n_globals; i++)
             {
-                global.names[global.n] = malloc(sizeof (**global.names) * len);
+                if (!strcmp(f->globals[i], operand))
+                {
+                    append_global_label(line_no, operand, l);
 
-                /* Dump global label name into the list. */
-                strcpy(global.names[global.n++], global_label);
+                    match = true;
+                    break;
+                }
             }
-            else
+
+            if (!match)
             {
+                append_static_label(line_no, operand, &f->labels[f->n_labels]);
             }
+
+            f->n_labels++;
+            ps->depth = 0;
+            ps->ended = false;
+            ps->n_branches = 0;
+            ps->in_label = true;
         }
-        else if (!area_code_found)
+    }
+    else
+    {
+        /* e.g.: startup code in GSINIT belongs to no label. */
+        if (ps->in_label)
         {
-            if (!strcmp(".area CODE", line))
-                area_code_found = true;
+            f->labels[f->n_labels - 1].size += r->size;
+            track_stack(ps, r, operand);
         }
-        else if (is_label(line, len))
+
+        if (r->kind == LINE_REF)
         {
-            /* Suppress ':'. */
-            line[len -= 2] = '\0';
+            /* Reference to a specific label. */
+            LOG(ps->c, SDCCRM_LOG_DEBUG, ps->f.name, operand, "referenced");
+        }
+    }
+}
 
-            /* Check whether found label is global. */
-            bool match = false;
+static size_t count_chunks(const size_t len)
+{
+    if (len < PARSE_CHUNK_THRESHOLD)
+        return 1;
 
-            f.labels = alloc(f.labels, f.n_labels);
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t n = len / PARSE_CHUNK_MIN;
 
-            if (f.labels)
-            {
-                struct label *l = &f.labels[f.n_labels];
+    return cpus < 2 ? 1 : n < (size_t)cpus ? n : (size_t)cpus;
+}
 
-                /* Clear newly allocated data. */
-                memset(l, 0, sizeof *l);
+static bool parse_chunks(struct parser *const ps, char *const buf, const size_t len, const size_t n_chunks)
+{
+    struct chunk *const chunks = alloc_(NULL, sizeof *chunks, n_chunks, ALLOC_TABLE);
+    pthread_t *const threads = alloc_(NULL, sizeof *threads, n_chunks, ALLOC_TABLE);
+    size_t n = 0, n_threads = 0;
+    bool error = false;
 
-                for (size_t i = 0; i < global.n; i++)
-                {
-                    if (!strcmp(global.names[i], line))
-                    {
-                        append_global_label(p, line_no, line, l);
+    if (!chunks || !threads)
+    {
+        alloc_free(chunks);
+        alloc_free(threads);
+        return false;
+    }
 
-                        match = true;
-                        break;
-                    }
-                }
+    /* Chunks are split right after a newline, which is temporarily
+     * replaced by a null terminator so get_line() stops there. */
+    for (char *p = buf, *const end = buf + len; p < end; n++)
+    {
+        char *seam = n + 1 < n_chunks && (size_t)(end - p) > len / n_chunks
+            ? memchr(p + len / n_chunks, '\n', end - p - len / n_chunks) : NULL;
 
-                if (!match)
-                {
-                    append_static_label(p, line_no, line, &f.labels[f.n_labels]);
-                }
+        chunks[n] = (struct chunk){.port = ps->c->port, .begin = p, .seam = seam};
 
-                f.n_labels++;
-            }
+        if (!seam)
+        {
+            n++;
+            break;
         }
-        else if (is_call(line))
+
+        *seam = '\0';
+        p = seam + 1;
+    }
+
+    /* The last chunk is tokenized by the calling thread. */
+    for (size_t i = 0; i + 1 < n; i++, n_threads++)
+    {
+        if (pthread_create(&threads[i], NULL, tokenize, &chunks[i]))
+            break;
+    }
+
+    for (size_t i = n_threads; i < n; i++)
+    {
+        tokenize(&chunks[i]);
+    }
+
+    for (size_t i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (chunks[i].seam)
+            *chunks[i].seam = '\n';
+
+        error |= chunks[i].error;
+    }
+
+    /* Labels, spans and calls are then stitched together in
+     * order, carrying the area and .globl state across seams. */
+    for (size_t i = 0; i < n; i++)
+    {
+        struct chunk *const ch = &chunks[i];
+
+        for (size_t j = 0; !error && j < ch->n_records; j++)
         {
-            /* Call to a specific label. */
-            append_called_label(get_call(line), &f);
+            const struct line_record *const r = &ch->records[j];
+
+            parse_line(ps, r, ch->text.data + r->operand);
         }
-        else
+
+        alloc_free(ch->records);
+        alloc_free(ch->text.data);
+    }
+
+    alloc_free(chunks);
+    alloc_free(threads);
+
+    return !error;
+}
+
+static void *tokenize(void *const arg)
+{
+    const uint64_t start = trace_begin();
+    struct chunk *const ch = arg;
+    const char *p = ch->begin;
+    char line[MAX_CH_PER_LINE];
+    size_t len;
+
+    while (!ch->error && (p = get_line(p, line, &len)))
+    {
+        struct line_record r;
+
+        read_line(ch->port, line, len, &r);
+
+        if (r.kind == LINE_OTHER && !r.area && !r.has_effect && !r.ends && !r.local)
         {
-            /* Determine whether there is a reference to a specific label. */
-            const char *const ref = get_ref(line);
+            struct line_record *const prev = ch->n_records ? &ch->records[ch->n_records - 1] : NULL;
 
-            if (ref)
+            /* Consecutive lines with nothing to parse
+             * are merged, only keeping their size. */
+            if (prev && prev->kind == LINE_OTHER && !prev->area && !prev->has_effect && !prev->ends && !prev->local)
             {
-                LOG("Function %s is being referrenced", ref);
-                append_called_label(ref, &f);
+                prev->n_lines++;
+                prev->size += r.size;
+                continue;
             }
+
+            r.operand_len = 0;
         }
-    }
 
-    /* Clean up locally allocated data. */
-    if (global.names)
-    {
-        for (size_t i = 0; i < global.n; i++)
+        if (ch->n_records == ch->cap)
         {
-            if (global.names[i])
+            /* Records grow geometrically, as there might be millions. */
+            ch->cap = ch->cap ? ch->cap * 2 : 1024;
+
+            if (!(ch->records = alloc_(ch->records, sizeof *ch->records, ch->cap - 1, ALLOC_TABLE)))
             {
-                free(global.names[i]);
+                ch->error = true;
+                break;
             }
         }
 
-        free(global.names);
+        /* Operands are copied into the chunk text. */
+        const size_t operand = ch->text.len;
+
+        if (!strbuf_append(&ch->text, line + r.operand, r.operand_len)
+            || !strbuf_append(&ch->text, "", 1))
+        {
+            ch->error = true;
+            break;
+        }
+
+        r.operand = operand;
+        ch->records[ch->n_records++] = r;
     }
 
-    return f;
+    trace_end(start, "tokenize", &(const struct trace_args)
+        {
+            .bytes = ch->seam ? (size_t)(ch->seam - ch->begin) : strlen(ch->begin)
+        });
+    return NULL;
 }
 
-static const char *get_ref(const char *const line)
+static void close_labels(struct file *const f, size_t *const first_open, const size_t line_no)
 {
-    const char *p;
+    /* A label span ends right before the next label or ".area"
+     * directive, but the line right after the label is always
+     * part of it. Open labels are always the last ones in the
+     * list, since spans are closed in order. */
+    while (*first_open < f->n_labels)
+    {
+        struct label *const l = &f->labels[*first_open];
 
-    for (p = line; *p != '#' && *p; p++);
+        if (l->start_line + 1 >= line_no)
+            break;
 
-    if (*p)
+        l->end_line = line_no - 1;
+        ++*first_open;
+    }
+}
+
+static void track_stack(struct parser *const ps, const struct line_record *const r, const char *const operand)
+{
+    /* Stack usage is tracked down the label, carrying the worst
+     * depth found on every branch into the local label it leads
+     * to, so an early epilogue, e.g.: "addw sp, #16" and "ret",
+     * does not hide deeper paths. Blocks no branch was found to
+     * yet, e.g.: loop heads or jump table targets, start with the
+     * depth the previous one ended with. */
+    struct file *const f = &ps->f;
+    struct label *const l = &f->labels[f->n_labels - 1];
+    struct stack_effect se = r->se;
+
+    if (r->local == LOCAL_DEF)
     {
-        static const char pattern[] = "#(_";
+        const struct branch *const b = find_branch(ps, r->local_label);
 
-        if (!strncmp(p, pattern, static_strlen(pattern)))
-        {
-            static char l[MAX_CH_PER_LINE];
+        if (b && (ps->ended || b->depth > ps->depth))
+            ps->depth = b->depth;
 
-            /* Substract one position so the '_' is also returned. */
-            const size_t offset = static_strlen(pattern) - 1;
-            size_t i = 0;
+        ps->ended = false;
+    }
 
-            for (p += offset; *p && *p != ')' && *p != ' ' && i < lengthof (l); p++)
-            {
-                l[i++] = *p;
-            }
+    if (r->has_effect)
+    {
+        if (se.delta < 0 && (size_t)-se.delta > ps->depth)
+            ps->depth = 0;
+        else
+            ps->depth += se.delta;
+
+        if (ps->depth > l->frame)
+            l->frame = ps->depth;
+
+        if (se.iret)
+            l->interrupt = true;
+    }
+    else
+    {
+        se = (struct stack_effect){0};
+    }
+
+    if (r->kind == LINE_CALL)
+    {
+        /* Call to a specific label, or jump to it, e.g.: a tail
+         * call, which pushes no return address. */
+        append_called_label(operand, r->operand_len, ps->depth + se.call, f);
+    }
+    else if (r->kind == LINE_REF)
+    {
+        /* Reference to a specific label, which might
+         * be called indirectly from around this point. */
+        append_called_label(operand, r->operand_len, ps->depth + 2, f);
+    }
 
-            l[i] = '\0';
+    if (r->local == LOCAL_BRANCH)
+    {
+        struct branch *b = find_branch(ps, r->local_label);
 
-            return l;
+        if (!b && (b = alloc_grow(ps->branches, ps->n_branches, ALLOC_TABLE)))
+        {
+            ps->branches = b;
+            b = &ps->branches[ps->n_branches++];
+            *b = (struct branch){.label = r->local_label, .depth = ps->depth};
         }
+        else if (b && ps->depth > b->depth)
+        {
+            b->depth = ps->depth;
+        }
+    }
+
+    if (r->ends)
+        ps->ended = true;
+}
+
+static struct branch *find_branch(const struct parser *const ps, const unsigned long label)
+{
+    for (size_t i = 0; i < ps->n_branches; i++)
+    {
+        if (ps->branches[i].label == label)
+            return &ps->branches[i];
     }
 
-    /* No reference was found. */
     return NULL;
 }
 
-static void append_called_label(const char *const called_label, struct file *const f)
+static void append_called_label(const char *const called_label, const size_t len, const size_t depth, struct file *const f)
 {
-    if (f && called_label)
+    if (f && called_label && len)
     {
         if (f->n_labels)
         {
             struct label *const l = &f->labels[f->n_labels - 1];
 
-            l->calls = alloc(l->calls, l->n_calls);
+            l->calls = alloc(l->calls, l->n_calls, ALLOC_CALL_LIST);
+            l->call_depths = alloc(l->call_depths, l->n_calls, ALLOC_CALL_LIST);
 
-            if (l->calls)
+            if (l->calls && l->call_depths)
             {
                 char **const calls = &l->calls[l->n_calls];
-                const size_t called_label_len = strlen(called_label) + 1;
 
-                *calls = malloc(called_label_len * sizeof *called_label);
+                *calls = alloc_buf((len + 1) * sizeof *called_label, ALLOC_CALL_LIST);
 
                 if (*calls)
                 {
-                    strncpy(*calls, called_label, called_label_len);
+                    memcpy(*calls, called_label, len);
+                    (*calls)[len] = '\0';
+                    l->call_depths[l->n_calls] = depth;
                     l->n_calls++;
                 }
             }
+            else
+            {
+                /* alloc() released any previous block. */
+                for (size_t i = 0; l->calls && i < l->n_calls; i++)
+                {
+                    alloc_free(l->calls[i]);
+                }
+
+                alloc_free(l->calls);
+                alloc_free(l->call_depths);
+                l->calls = NULL;
+                l->call_depths = NULL;
+                l->n_calls = 0;
+            }
+        }
+    }
+}
+
+static void append_data_refs(struct file *const f, const char *const operand, const bool in_label)
+{
+    /* e.g.: "_f", "_a, _b" or "(_f + 0)". */
+    for (const char *p = operand; (p = strchr(p, '_')); )
+    {
+        size_t len = 0;
+
+        if (p > operand && is_symbol_char(p[-1]))
+        {
+            /* Not the start of a symbol, e.g.: "s_GSINIT". */
+            p++;
+            continue;
+        }
+
+        while (is_symbol_char(p[len]))
+        {
+            len++;
         }
+
+        /* Tables found within a label are only kept along with it,
+         * while any other table, e.g.: the interrupt vector table,
+         * keeps every label it references. */
+        if (in_label)
+            append_called_label(p, len, 0, f);
+        else
+            append_root(f, p, len);
+
+        p += len;
+    }
+}
+
+static void append_root(struct file *const f, const char *const name, const size_t len)
+{
+    char **const roots = alloc(f->roots, f->n_roots, ALLOC_CALL_LIST);
+    char *const root = roots ? alloc_buf((len + 1) * sizeof *root, ALLOC_CALL_LIST) : NULL;
+
+    f->roots = roots;
+
+    if (!roots)
+    {
+        /* alloc() released any previous block. */
+        f->n_roots = 0;
+        return;
+    }
+    else if (root)
+    {
+        memcpy(root, name, len);
+        root[len] = '\0';
+        f->roots[f->n_roots++] = root;
     }
 }
 
-static void append_label(const char *const p, const size_t line_no, const char *const line, struct label *const l)
+static void append_label(const size_t line_no, const char *const line, struct label *const l)
 {
-    if ((l->name = malloc((strlen(line) + 1) * sizeof *line)))
+    if ((l->name = alloc_buf((strlen(line) + 1) * sizeof *line, ALLOC_LABEL_NAME)))
     {
         strcpy(l->name, line);
     }
 
+    /* end_line is known once the next label or area is found. */
     l->start_line = line_no;
-    l->end_line = get_label_end(p, line_no);
 }
 
-static void append_global_label(const char *const p, const size_t line_no, const char *const line, struct label *const l)
+static void append_global_label(const size_t line_no, const char *const line, struct label *const l)
 {
     l->global = true;
-    append_label(p, line_no, line, l);
+    append_label(line_no, line, l);
 }
 
-static void append_static_label(const char *const p, const size_t line_no, const char *const line, struct label *const l)
+static void append_static_label(const size_t line_no, const char *const line, struct label *const l)
 {
     l->global = false;
-    append_label(p, line_no, line, l);
+    append_label(line_no, line, l);
 }
 
-static size_t get_label_end(const char *p, size_t line_no)
+void free_file(struct file *const f)
 {
-    size_t len;
-    char line[MAX_CH_PER_LINE];
-    bool search = false;
-
-    for (line_no += 1; (p = get_line(p, line, &len)); line_no++)
+    for (size_t i = 0; i < f->n_globals; i++)
     {
-        if (!search)
-        {
-            search = true;
-        }
-        else if (is_label(line, len) || strstr(line, ".area"))
-        {
-            break;
-        }
+        alloc_free(f->globals[i]);
     }
 
-    return line_no - 1;
-}
+    alloc_free(f->globals);
 
-static bool is_label(const char *const line, const size_t length)
-{
-    if (line && length >= static_strlen("_a:"))
+    for (size_t i = 0; i < f->n_roots; i++)
     {
-        return line[0] == '_' && line[1] != '_' && line[length - 2] == ':';
+        alloc_free(f->roots[i]);
     }
 
-    return false;
-}
+    alloc_free(f->roots);
 
-static const char *get_call(const char *line)
-{
-    if (line)
+    if (f->labels)
     {
-        for (char c = *line; !isspace(c); c = *(++line));
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            struct label *const l = &f->labels[j];
 
-        return ++line;
-    }
+            if (l->calls)
+            {
+                for (size_t k = 0; k < l->n_calls; k++)
+                {
+                    alloc_free(l->calls[k]);
+                }
 
-    return NULL;
-}
+                alloc_free(l->calls);
+            }
 
-static bool is_call(const char *const line)
-{
-    if (line)
-    {
-        return !strncmp(line, CALL_DIRECTIVE, static_strlen(CALL_DIRECTIVE));
-    }
+            alloc_free(l->call_depths);
 
-    return false;
+            if (l->name)
+            {
+                alloc_free(l->name);
+            }
+        }
+
+        alloc_free(f->labels);
+    }
 }
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "graph.h"
+#include "alloc.h"
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_labels(const void *a, const void *b);
+static size_t lower_bound(const struct tree *t, const char *name);
+static int resolve_calls(const struct tree *t, struct label *l);
+static int resolve_roots(struct tree *t, size_t file);
+
+int resolve_graph(struct tree *const t)
+{
+    size_t n = 0;
+
+    free_graph(t);
+
+    for (size_t i = 0; i < t->n_files; i++)
+    {
+        n += t->files[i].n_labels;
+    }
+
+    t->labels = alloc_(NULL, sizeof *t->labels, n, ALLOC_TABLE);
+    t->by_name = alloc_(NULL, sizeof *t->by_name, n, ALLOC_TABLE);
+
+    if (!t->labels || !t->by_name)
+    {
+        free_graph(t);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < t->n_files; i++)
+    {
+        struct file *const f = &t->files[i];
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            struct label *const l = &f->labels[j];
+
+            l->id = t->n_labels;
+            l->file = i;
+            t->labels[t->n_labels] = t->by_name[t->n_labels] = l;
+            t->n_labels++;
+        }
+    }
+
+    qsort(t->by_name, t->n_labels, sizeof *t->by_name, compare_labels);
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        if (resolve_calls(t, t->labels[i]))
+        {
+            free_graph(t);
+            return ENOMEM;
+        }
+    }
+
+    for (size_t i = 0; i < t->n_files; i++)
+    {
+        if (resolve_roots(t, i))
+        {
+            free_graph(t);
+            return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+void free_graph(struct tree *const t)
+{
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        struct label *const l = t->labels[i];
+
+        alloc_free(l->callees);
+        alloc_free(l->callee_depths);
+        l->callees = NULL;
+        l->callee_depths = NULL;
+        l->n_callees = 0;
+    }
+
+    alloc_free(t->labels);
+    alloc_free(t->by_name);
+    alloc_free(t->roots);
+    t->labels = t->by_name = NULL;
+    t->roots = NULL;
+    t->n_labels = t->n_roots = 0;
+}
+
+const struct label *find_label(const struct tree *const t, const char *const name)
+{
+    const size_t i = lower_bound(t, name);
+
+    if (i < t->n_labels && !strcmp(t->by_name[i]->name, name))
+    {
+        return t->by_name[i];
+    }
+
+    return NULL;
+}
+
+size_t resolve_label(const struct tree *const t, const size_t file, const char *const name)
+{
+    size_t id = SIZE_MAX;
+
+    for (size_t i = lower_bound(t, name); i < t->n_labels && !strcmp(t->by_name[i]->name, name); i++)
+    {
+        const struct label *const l = t->by_name[i];
+
+        if (l->global || l->file == file)
+        {
+            if (id != SIZE_MAX)
+                return SIZE_MAX;
+
+            id = l->id;
+        }
+    }
+
+    return id;
+}
+
+static int compare_labels(const void *const a, const void *const b)
+{
+    const struct label *const la = *(const struct label *const *)a;
+    const struct label *const lb = *(const struct label *const *)b;
+    const int cmp = strcmp(la->name, lb->name);
+
+    /* Ties keep file order, so callees are visited as before. */
+    if (cmp)
+        return cmp;
+
+    return (la->id > lb->id) - (la->id < lb->id);
+}
+
+static size_t lower_bound(const struct tree *const t, const char *const name)
+{
+    size_t lo = 0, hi = t->n_labels;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(t->by_name[mid]->name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int resolve_calls(const struct tree *const t, struct label *const l)
+{
+    for (size_t i = 0; i < l->n_calls; i++)
+    {
+        const char *const ref = l->calls[i];
+
+        for (size_t j = lower_bound(t, ref);
+            j < t->n_labels && !strcmp(t->by_name[j]->name, ref); j++)
+        {
+            const struct label *const called_l = t->by_name[j];
+
+            /* Static labels are only visible from the same file. */
+            if (called_l->global || called_l->file == l->file)
+            {
+                l->callees = alloc(l->callees, l->n_callees, ALLOC_CALL_LIST);
+                l->callee_depths = alloc(l->callee_depths, l->n_callees, ALLOC_CALL_LIST);
+
+                if (!l->callees || !l->callee_depths)
+                {
+                    /* Released by free_graph(). */
+                    return ENOMEM;
+                }
+
+                l->callees[l->n_callees] = called_l->id;
+                l->callee_depths[l->n_callees++] = l->call_depths[i];
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int resolve_roots(struct tree *const t, const size_t file)
+{
+    const struct file *const f = &t->files[file];
+
+    for (size_t i = 0; i < f->n_roots; i++)
+    {
+        const char *const ref = f->roots[i];
+
+        for (size_t j = lower_bound(t, ref);
+            j < t->n_labels && !strcmp(t->by_name[j]->name, ref); j++)
+        {
+            const struct label *const l = t->by_name[j];
+
+            if (l->global || l->file == file)
+            {
+                if (!(t->roots = alloc(t->roots, t->n_roots, ALLOC_TABLE)))
+                {
+                    /* Released by free_graph(). */
+                    return ENOMEM;
+                }
+
+                t->roots[t->n_roots++] = l->id;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Layout stage, run once labels kept are known. Kept labels in code
+ * areas are placed into windows of c->window bytes, e.g.: the 64 KB
+ * sections stm8 "call" and "jp" can reach, so as many far calls as
+ * possible are made between labels in the same window. Labels that
+ * must share a window are grouped first: those falling through into
+ * the next one, and those calling or jumping to each other with
+ * near mnemonics. Groups holding labels whose address is taken, or
+ * referenced in any other way than by calls and jumps found in text,
+ * stay in window 0, i.e.: where they are found. The rest are merged
+ * along the most far calls between them while they fit into a
+ * window, then packed into windows, largest first. Sizes are only
+ * estimated, so part of every window is left free. */
+
+#include "layout.h"
+#include "classify.h"
+#include "graph.h"
+#include "peephole.h"
+#include "alloc.h"
+#include "common.h"
+#include "trace.h"
+#include "log.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    /* Windows are only filled up to all but 1/WINDOW_RESERVE of
+     * their size, since estimate_size() undercounts some lines,
+     * e.g.: stm8 prefix bytes and 16-bit immediates count as one
+     * byte. Overflowing windows would give wrong near call targets
+     * once linked, but this is no guarantee: exact sizes are only
+     * known to the linker. */
+    WINDOW_RESERVE = 4
+};
+
+/* Far calls or jumps between two labels. */
+struct edge
+{
+    size_t from;
+    size_t to;
+    size_t weight;
+};
+
+struct groups
+{
+    /* Sets of label ids sharing a window, where pinned (i.e.:
+     * n_labels) stands for window 0. */
+    struct sets sets;
+    /* Kept label found in a code area. */
+    bool *placed;
+    /* Calls and jumps found in text to every label. */
+    size_t *seen;
+    struct edge *edges;
+    size_t n_edges;
+};
+
+static int scan_file(const struct sdccrm *c, const struct config *cfg, size_t file, struct groups *g);
+static int visit_line(void *arg, const struct scanned_line *sl);
+static int add_reference(const struct sdccrm *c, struct groups *g, size_t file, size_t from, const char *line,
+    const struct line_info *li);
+static void cluster(const struct sdccrm *c, struct groups *g, size_t *within, size_t *total);
+static int pack(const struct sdccrm *c, struct groups *g, size_t *window_of, size_t *n_windows);
+static size_t capacity(const struct sdccrm *c);
+
+int place_labels(const struct sdccrm *const c, struct config *const cfg)
+{
+    const struct tree *const t = &c->tree;
+    const size_t n = t->n_labels;
+    const uint64_t start = trace_begin();
+    struct groups g = {0};
+    size_t *const refs = alloc_(NULL, sizeof *refs, n, ALLOC_TABLE);
+    size_t *const window_of = alloc_(NULL, sizeof *window_of, n + 1, ALLOC_TABLE);
+    size_t n_placed = 0, n_windows = 0, within = 0, total = 0;
+    int ret = 0;
+
+    cfg->windows = alloc_(NULL, sizeof *cfg->windows, n, ALLOC_TABLE);
+    ret = init_sets(&g.sets, n);
+    g.placed = alloc_(NULL, sizeof *g.placed, n, ALLOC_TABLE);
+    g.seen = alloc_(NULL, sizeof *g.seen, n, ALLOC_TABLE);
+
+    if (ret || !refs || !window_of || !cfg->windows || !g.placed || !g.seen)
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    for (size_t i = 0; i <= n; i++)
+    {
+        window_of[i] = SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        cfg->windows[i] = SIZE_MAX;
+        g.placed[i] = false;
+        g.seen[i] = refs[i] = 0;
+    }
+
+    /* Labels without assembly text are never placed. */
+    for (size_t i = 0; i < t->n_files && !ret; i++)
+    {
+        if (c->inputs[i].buf)
+            ret = scan_file(c, cfg, i, &g);
+    }
+
+    if (ret)
+        goto end;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct label *const l = t->labels[i];
+
+        for (size_t j = 0; cfg->used[i] && j < l->n_callees; j++)
+        {
+            refs[l->callees[j]]++;
+        }
+    }
+
+    for (size_t i = 0; i < t->n_roots; i++)
+    {
+        join_sets(&g.sets, t->roots[i], g.sets.pinned);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        /* e.g.: function pointers, interrupt handlers, startup code
+         * calling the entry label or labels in other areas. */
+        if (cfg->used[i] && (!g.placed[i] || refs[i] != g.seen[i] || is_label_excluded(c, cfg, t->labels[i])))
+            join_sets(&g.sets, i, g.sets.pinned);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (g.placed[i])
+        {
+            g.sets.size[find_set(&g.sets, i)] += t->labels[i]->size;
+            n_placed++;
+        }
+    }
+
+    cluster(c, &g, &within, &total);
+
+    if ((ret = pack(c, &g, window_of, &n_windows)))
+        goto end;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct label *const l = t->labels[i];
+
+        if (g.placed[i])
+        {
+            cfg->windows[i] = window_of[find_set(&g.sets, i)];
+            LOG(c, SDCCRM_LOG_DEBUG, t->files[l->file].name, l->name, "placed into window %zu", cfg->windows[i]);
+        }
+    }
+
+    for (size_t i = 0; i < g.n_edges; i++)
+    {
+        const struct edge *const e = &g.edges[i];
+
+        if (window_of[find_set(&g.sets, e->from)] == window_of[find_set(&g.sets, e->to)])
+            within += e->weight;
+    }
+
+    LOG(c, SDCCRM_LOG_INFO, NULL, NULL, "%zu labels placed into %zu windows, %zu out of %zu far calls within one",
+        n_placed, n_windows, within, total);
+
+end:
+    alloc_free(refs);
+    alloc_free(window_of);
+    free_sets(&g.sets);
+    alloc_free(g.placed);
+    alloc_free(g.seen);
+    alloc_free(g.edges);
+
+    if (ret)
+    {
+        alloc_free(cfg->windows);
+        cfg->windows = NULL;
+    }
+
+    trace_end(start, "layout", &(const struct trace_args){.labels = n_placed});
+
+    return ret;
+}
+
+/* Arguments to visit_line(). */
+struct scan
+{
+    const struct sdccrm *c;
+    const struct config *cfg;
+    size_t file;
+    struct groups *g;
+};
+
+static int scan_file(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    struct groups *const g)
+{
+    const struct file *const f = &c->tree.files[file];
+    size_t n_lines;
+    struct text_line *const lines = index_lines(c->inputs[file].buf, &n_lines);
+    struct scan sc = {.c = c, .cfg = cfg, .file = file, .g = g};
+    int ret = ENOMEM;
+
+    /* Label ids in a file follow each other. */
+    if (lines)
+        ret = scan_areas(c->port, f, lines, n_lines, cfg->used, f->n_labels ? f->labels[0].id : 0, &g->sets,
+            visit_line, &sc);
+
+    alloc_free(lines);
+
+    return ret;
+}
+
+static int visit_line(void *const arg, const struct scanned_line *const sl)
+{
+    const struct scan *const sc = arg;
+    const struct label *const l = sl->owner != SIZE_MAX ? &sc->c->tree.files[sc->file].labels[sl->owner] : NULL;
+
+    if (sl->kind == SCANNED_LABEL)
+        sc->g->placed[l->id] = sc->cfg->used[l->id] && sl->code;
+    else if (sl->kind == SCANNED_OTHER && l && sc->cfg->used[l->id] && sl->li.kind == LINE_CALL)
+        return add_reference(sc->c, sc->g, sc->file, l->id, sl->line, &sl->li);
+
+    return 0;
+}
+
+static int add_reference(const struct sdccrm *const c, struct groups *const g, const size_t file, const size_t from,
+    const char *const line, const struct line_info *const li)
+{
+    const size_t digits = strspn(li->operand, "0123456789");
+    bool call;
+
+    /* Jumps within the label, e.g.: "jp 00102$". */
+    if (digits && li->operand[digits] == '$')
+        return 0;
+
+    const struct tail *const tail = find_tail(c->port, line, &call);
+    const size_t to = resolve_label(&c->tree, file, li->operand);
+
+    if (to != SIZE_MAX && tail)
+        g->seen[to]++;
+
+    if (tail && tail->far)
+    {
+        if (to == SIZE_MAX)
+            return 0;
+        else if (!(g->edges = alloc(g->edges, g->n_edges, ALLOC_TABLE)))
+        {
+            g->n_edges = 0;
+            return ENOMEM;
+        }
+
+        g->edges[g->n_edges++] = (struct edge){.from = from, .to = to, .weight = 1};
+    }
+    else if (to == SIZE_MAX || !tail)
+    {
+        /* Relative forms, e.g.: "jra _f", or targets not known by
+         * name, e.g.: "call (x)", stay where they are. */
+        join_sets(&g->sets, from, g->sets.pinned);
+    }
+    else
+    {
+        join_sets(&g->sets, from, to);
+
+        /* Calls to trampolines might go to their targets instead. */
+        if (c->trampolines && c->trampolines[to].target != SIZE_MAX)
+            join_sets(&g->sets, from, c->trampolines[to].target);
+    }
+
+    return 0;
+}
+
+static int compare_ends(const void *const a, const void *const b)
+{
+    const struct edge *const ea = a, *const eb = b;
+
+    if (ea->from != eb->from)
+        return ea->from < eb->from ? -1 : 1;
+
+    return (ea->to > eb->to) - (ea->to < eb->to);
+}
+
+static int compare_weights(const void *const a, const void *const b)
+{
+    const struct edge *const ea = a, *const eb = b;
+
+    /* Heaviest first, ties in a stable order. */
+    if (ea->weight != eb->weight)
+        return ea->weight > eb->weight ? -1 : 1;
+
+    return compare_ends(a, b);
+}
+
+static void cluster(const struct sdccrm *const c, struct groups *const g, size_t *const within, size_t *const total)
+{
+    size_t n = 0;
+
+    *within = *total = 0;
+
+    /* Edges between the same groups are merged. */
+    for (size_t i = 0; i < g->n_edges; i++)
+    {
+        const size_t a = find_set(&g->sets, g->edges[i].from), b = find_set(&g->sets, g->edges[i].to);
+
+        *total += g->edges[i].weight;
+        g->edges[i].from = a < b ? a : b;
+        g->edges[i].to = a < b ? b : a;
+    }
+
+    if (g->n_edges)
+        qsort(g->edges, g->n_edges, sizeof *g->edges, compare_ends);
+
+    for (size_t i = 0; i < g->n_edges; i++)
+    {
+        struct edge *const e = &g->edges[i];
+
+        if (e->from == e->to)
+            *within += e->weight;
+        else if (n && g->edges[n - 1].from == e->from && g->edges[n - 1].to == e->to)
+            g->edges[n - 1].weight += e->weight;
+        else
+            g->edges[n++] = *e;
+    }
+
+    g->n_edges = n;
+
+    if (n)
+        qsort(g->edges, n, sizeof *g->edges, compare_weights);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const size_t a = find_set(&g->sets, g->edges[i].from), b = find_set(&g->sets, g->edges[i].to);
+
+        if (a != b && g->sets.size[a] + g->sets.size[b] <= capacity(c))
+            join_sets(&g->sets, a, b);
+    }
+}
+
+static int pack(const struct sdccrm *const c, struct groups *const g, size_t *const window_of,
+    size_t *const n_windows)
+{
+    const struct tree *const t = &c->tree;
+    const size_t cap = capacity(c);
+    struct set_size *groups = NULL;
+    /* Bytes left in every window. */
+    size_t *left = NULL, n_groups = 0;
+
+    for (size_t i = 0; i < g->sets.pinned; i++)
+    {
+        const size_t r = g->placed[i] ? find_set(&g->sets, i) : g->sets.pinned;
+
+        if (r != g->sets.pinned && window_of[r] == SIZE_MAX)
+        {
+            if (!(groups = alloc(groups, n_groups, ALLOC_TABLE)))
+                return ENOMEM;
+
+            window_of[r] = n_groups;
+            groups[n_groups++] = (struct set_size){.root = r, .size = g->sets.size[r]};
+        }
+    }
+
+    if (!(left = alloc_(NULL, sizeof *left, n_groups, ALLOC_TABLE)))
+    {
+        alloc_free(groups);
+        return ENOMEM;
+    }
+
+    if (n_groups)
+        qsort(groups, n_groups, sizeof *groups, compare_set_sizes);
+
+    /* Window 0 holds every label left where it is. */
+    window_of[g->sets.pinned] = 0;
+    left[0] = cap > g->sets.size[g->sets.pinned] ? cap - g->sets.size[g->sets.pinned] : 0;
+    *n_windows = 1;
+
+    if (g->sets.size[g->sets.pinned] > cap)
+    {
+        WARNING(c, NULL, NULL, "labels left in place take %zu bytes, more than a window", g->sets.size[g->sets.pinned]);
+    }
+
+    for (size_t i = 0; i < n_groups; i++)
+    {
+        const struct set_size *const gr = &groups[i];
+        size_t w = 0;
+
+        while (w < *n_windows && left[w] < gr->size)
+        {
+            w++;
+        }
+
+        if (w == *n_windows)
+        {
+            if (gr->size > cap)
+            {
+                WARNING(c, t->files[t->labels[gr->root]->file].name, t->labels[gr->root]->name,
+                    "%zu bytes of labels sharing a window do not fit into one", gr->size);
+            }
+
+            left[(*n_windows)++] = cap;
+        }
+
+        left[w] -= left[w] < gr->size ? left[w] : gr->size;
+        window_of[gr->root] = w;
+    }
+
+    alloc_free(groups);
+    alloc_free(left);
+
+    return 0;
+}
+
+int plan_layout(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    const char *const text, struct plan *const p)
+{
+    const struct file *const f = &c->tree.files[file];
+    size_t n_lines, k = 0, in_effect = 0;
+    struct text_line *const lines = index_lines(text, &n_lines);
+    /* Last .area directive found, as written. */
+    char area[MAX_CH_PER_LINE] = "";
+    int ret = lines ? 0 : ENOMEM;
+
+    for (size_t ln = 1; ln <= n_lines && k < f->n_labels && !ret; ln++)
+    {
+        char line[MAX_CH_PER_LINE];
+
+        copy_line(&lines[ln - 1], line);
+
+        if (!strncmp(line, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)))
+        {
+            strcpy(area, line);
+            in_effect = 0;
+        }
+        else if (f->labels[k].start_line == ln)
+        {
+            const size_t w = cfg->windows[f->labels[k++].id];
+
+            if (w != SIZE_MAX && w != in_effect)
+            {
+                char edit[3 * MAX_CH_PER_LINE];
+                const char *name;
+                const size_t n = area_name(area, &name);
+                const int prefix = name - area + n;
+
+                /* e.g.: ".area CODE_1" or ".area CSEG_1    (CODE)". */
+                if (w)
+                    snprintf(edit, sizeof edit, "%.*s_%zu%s\n%s", prefix, area, w, area + prefix, line);
+                else
+                    snprintf(edit, sizeof edit, "%s\n%s", area, line);
+
+                ret = add_edit(p, ln, edit);
+                in_effect = w;
+            }
+        }
+    }
+
+    alloc_free(lines);
+
+    return ret;
+}
+
+static size_t capacity(const struct sdccrm *const c)
+{
+    return c->window - c->window / WINDOW_RESERVE;
+}
+
+int report_layout(const struct sdccrm *const c, const struct config *const cfg, FILE *const f)
+{
+    const struct tree *const t = &c->tree;
+    size_t n_windows = 0;
+
+    if (!cfg->windows)
+        return EINVAL;
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        if (cfg->windows[i] != SIZE_MAX && cfg->windows[i] >= n_windows)
+            n_windows = cfg->windows[i] + 1;
+    }
+
+    if (cfg->name)
+        fprintf(f, "Layout (%s):\n", cfg->name);
+    else
+        fprintf(f, "Layout:\n");
+
+    fprintf(f, "  Sizes are estimated, so windows are only filled up to %zu bytes\n", capacity(c));
+
+    for (size_t w = 0; w < n_windows; w++)
+    {
+        size_t bytes = 0;
+
+        for (size_t i = 0; i < t->n_labels; i++)
+        {
+            if (cfg->windows[i] == w)
+                bytes += t->labels[i]->size;
+        }
+
+        fprintf(f, "  Window %zu: %zu bytes\n", w, bytes);
+
+        for (size_t i = 0; i < t->n_labels; i++)
+        {
+            const struct label *const l = t->labels[i];
+
+            if (cfg->windows[i] == w)
+                fprintf(f, "    %s (%s), %zu bytes\n", l->name, t->files[l->file].name, l->size);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1023 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sdccrm.h"
+#include "context.h"
+#include "common.h"
+#include "alloc.h"
+#include "trace.h"
+#include "function_list.h"
+#include "references.h"
+#include "remove_unused.h"
+#include "file_io.h"
+#include "graph.h"
+#include "stack.h"
+#include "summary.h"
+#include "rel.h"
+#include "why.h"
+#include "log.h"
+#include "reference.h"
+#include "classify.h"
+#include "peephole.h"
+#include "layout.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static void free_results(struct sdccrm *c);
+static void free_config(struct config *cfg);
+static struct config *current_config(struct sdccrm *c);
+static void *run_config(void *arg);
+static int prepare_graph(struct sdccrm *c);
+static struct config *active_configs(struct sdccrm *c, size_t *n);
+static int add_read_file(void *arg, size_t i, char *buf, size_t len);
+static int explain(struct sdccrm *c, const char *label, FILE *f);
+static char *part_name(const char *path, size_t k);
+
+static char *copy_string(const char *const s, const enum alloc_tag tag)
+{
+    const size_t len = strlen(s) + 1;
+    char *const d = alloc_buf(len * sizeof *d, tag);
+
+    if (d)
+    {
+        memcpy(d, s, len);
+    }
+
+    return d;
+}
+
+struct sdccrm *sdccrm_new(void)
+{
+    struct sdccrm *const c = alloc_buf(sizeof *c, ALLOC_TABLE);
+
+    if (c)
+    {
+        *c = (struct sdccrm){.port = find_port(NULL)};
+
+        /* Default configuration. */
+        if (!(c->configs = alloc(c->configs, 0, ALLOC_TABLE)))
+        {
+            alloc_free(c);
+            return NULL;
+        }
+
+        c->configs[c->n_configs++] = (struct config){0};
+    }
+
+    return c;
+}
+
+void sdccrm_free(struct sdccrm *const c)
+{
+    if (c)
+    {
+        free_results(c);
+        /* The graph points into labels owned by files. */
+        free_graph(&c->tree);
+
+        for (size_t i = 0; i < c->n_inputs; i++)
+        {
+            alloc_free(c->inputs[i].name);
+            alloc_free(c->inputs[i].buf);
+            free_file(&c->tree.files[i]);
+        }
+
+        alloc_free(c->tree.files);
+
+        alloc_free(c->inputs);
+
+        for (size_t i = 0; i < c->n_configs; i++)
+        {
+            free_config(&c->configs[i]);
+        }
+
+        alloc_free(c->configs);
+        alloc_free(c);
+    }
+}
+
+void sdccrm_set_verbose(struct sdccrm *const c, const bool verbose)
+{
+    c->log_level = verbose ? SDCCRM_LOG_INFO : SDCCRM_LOG_NONE;
+}
+
+void sdccrm_set_log_level(struct sdccrm *const c, const enum sdccrm_log_level level)
+{
+    c->log_level = level;
+}
+
+void sdccrm_set_log_format(struct sdccrm *const c, const enum sdccrm_log_format format)
+{
+    c->log_format = format;
+}
+
+void sdccrm_set_log(struct sdccrm *const c, FILE *const f)
+{
+    c->log = f;
+}
+
+int sdccrm_set_port(struct sdccrm *const c, const char *const name)
+{
+    const struct port *const port = find_port(name);
+
+    if (!port)
+        return EINVAL;
+
+    c->port = port;
+
+    return 0;
+}
+
+void sdccrm_set_remove_blocks(struct sdccrm *const c, const bool enable)
+{
+    c->remove_blocks = enable;
+}
+
+void sdccrm_set_peephole(struct sdccrm *const c, const bool enable)
+{
+    c->peephole = enable;
+}
+
+void sdccrm_set_layout(struct sdccrm *const c, const size_t window)
+{
+    c->window = window;
+}
+
+void sdccrm_set_split(struct sdccrm *const c, const size_t n)
+{
+    c->split = n;
+}
+
+int sdccrm_add_config(struct sdccrm *const c, const char *const name)
+{
+    char *const n = copy_string(name, ALLOC_LABEL_NAME);
+    struct config *configs;
+
+    if (!n)
+        return ENOMEM;
+
+    for (size_t i = 1; i < c->n_configs; i++)
+    {
+        if (!strcmp(c->configs[i].name, name))
+        {
+            alloc_free(n);
+            return EEXIST;
+        }
+    }
+
+    /* Not using alloc() since it would release existing configurations on failure. */
+    if (!(configs = alloc_(NULL, sizeof *configs, c->n_configs, ALLOC_TABLE)))
+    {
+        alloc_free(n);
+        return ENOMEM;
+    }
+
+    memcpy(configs, c->configs, c->n_configs * sizeof *configs);
+    alloc_free(c->configs);
+    c->configs = configs;
+    c->configs[c->n_configs++] = (struct config){.name = n};
+
+    return 0;
+}
+
+static struct config *current_config(struct sdccrm *const c)
+{
+    return &c->configs[c->n_configs - 1];
+}
+
+int sdccrm_set_entry(struct sdccrm *const c, const char *const label)
+{
+    struct config *const cfg = current_config(c);
+    char *const l = copy_string(label, ALLOC_LABEL_NAME);
+
+    if (!l)
+        return ENOMEM;
+
+    alloc_free(cfg->entry_label);
+    cfg->entry_label = l;
+
+    return 0;
+}
+
+const char *get_entry_label(const struct sdccrm *const c, const struct config *const cfg)
+{
+    if (cfg->entry_label)
+        return cfg->entry_label;
+    else if (c->configs[0].entry_label)
+        return c->configs[0].entry_label;
+
+    return SDCCRM_DEFAULT_ENTRY_LABEL;
+}
+
+bool is_label_excluded(const struct sdccrm *const c, const struct config *const cfg, const struct label *const l)
+{
+    const struct config *const defaults = c->configs;
+
+    /* Entry label must never be removed. */
+    if (!strcmp(l->name, get_entry_label(c, cfg)))
+    {
+        return true;
+    }
+
+    /* Given a removal list, any other global label is kept. */
+    if (l->global && (cfg->has_removals || defaults->has_removals)
+        && !exclusions_match(&cfg->removals, l->name)
+        && (cfg == defaults || !exclusions_match(&defaults->removals, l->name)))
+    {
+        return true;
+    }
+
+    return exclusions_match(&cfg->excluded, l->name)
+        || (cfg != defaults && exclusions_match(&defaults->excluded, l->name));
+}
+
+int sdccrm_exclude(struct sdccrm *const c, const char *const label)
+{
+    const int ret = exclusions_add(&current_config(c)->excluded, label);
+
+    if (ret == EEXIST)
+    {
+        fprintf(stderr, "Label %s set as excluded more than once\n", label);
+        return 0;
+    }
+
+    return ret;
+}
+
+int sdccrm_exclude_file(struct sdccrm *const c, const char *const path)
+{
+    return exclusions_add_file(&current_config(c)->excluded, path);
+}
+
+int sdccrm_remove_file(struct sdccrm *const c, const char *const path)
+{
+    struct config *const cfg = current_config(c);
+    const int ret = exclusions_add_file(&cfg->removals, path);
+
+    if (!ret)
+        cfg->has_removals = true;
+
+    return ret;
+}
+
+static int add_input(struct sdccrm *const c, const char *const name, char *const buf, const size_t len, struct file *const parsed)
+{
+    /* Inputs are parsed as soon as they are added, so parsing
+     * overlaps with reading any remaining inputs. Inputs added
+     * from summaries are given already parsed instead. */
+    char *const n = copy_string(name, ALLOC_OUTPUT_NAME);
+    /* Earlier inputs stay valid and owned by c on failure. */
+    struct input *const inputs = n ? alloc_grow(c->inputs, c->n_inputs, ALLOC_TABLE) : NULL;
+    struct file *files = NULL;
+
+    if (inputs)
+    {
+        c->inputs = inputs;
+        files = alloc_grow(c->tree.files, c->tree.n_files, ALLOC_TABLE);
+    }
+
+    if (!files)
+    {
+        alloc_free(n);
+        alloc_free(buf);
+
+        if (parsed)
+            free_file(parsed);
+
+        return ENOMEM;
+    }
+
+    struct input *const in = &inputs[c->n_inputs++];
+
+    *in = (struct input)
+    {
+        .name = n,
+        .buf = buf,
+        .len = len
+    };
+
+    c->inputs = inputs;
+    c->tree.files = files;
+
+    if (parsed)
+    {
+        parsed->name = in->name;
+        c->tree.files[c->tree.n_files++] = *parsed;
+    }
+    else
+    {
+        c->tree.files[c->tree.n_files++] = get_function_list(c, in);
+        log_flush(c, NULL);
+    }
+
+    /* Label ids change with every new input. */
+    free_graph(&c->tree);
+
+    return 0;
+}
+
+int sdccrm_add_buffer(struct sdccrm *const c, const char *const name, const char *const buf, const size_t len)
+{
+    /* Inputs are treated as null-terminated strings, so a copy is needed. */
+    char *const b = alloc_buf((len + 1) * sizeof *b, ALLOC_FILE_BUF);
+
+    if (!b)
+        return ENOMEM;
+
+    memcpy(b, buf, len);
+    b[len] = '\0';
+
+    return add_input(c, name, b, len, NULL);
+}
+
+int sdccrm_add_file(struct sdccrm *const c, const char *const path)
+{
+    size_t len;
+    char *const buf = read_file(path, &len);
+
+    if (!buf)
+        return errno ? errno : EIO;
+
+    const int ret = add_input(c, path, buf, len, NULL);
+
+    if (!ret)
+        c->inputs[c->n_inputs - 1].from_file = true;
+
+    return ret;
+}
+
+struct add_files
+{
+    struct sdccrm *c;
+    const char *const *paths;
+};
+
+static int add_read_file(void *const arg, const size_t i, char *const buf, const size_t len)
+{
+    const struct add_files *const a = arg;
+    const int ret = add_input(a->c, a->paths[i], buf, len, NULL);
+
+    if (!ret)
+        a->c->inputs[a->c->n_inputs - 1].from_file = true;
+
+    return ret;
+}
+
+int sdccrm_add_files(struct sdccrm *const c, const size_t n, const char *const *const paths)
+{
+    struct add_files a = {.c = c, .paths = paths};
+
+    return read_files(n, paths, add_read_file, &a);
+}
+
+static char *part_name(const char *const path, const size_t k)
+{
+    const char *const slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash : path, '.');
+    /* e.g.: "main_1.asm", or "main_1" without any extension. */
+    const size_t base = dot && dot != path && dot != slash + 1 ? (size_t)(dot - path) : strlen(path);
+    const size_t len = snprintf(NULL, 0, "%.*s_%zu%s", (int)base, path, k, path + base) + 1;
+    char *const name = alloc_buf(len * sizeof *name, ALLOC_OUTPUT_NAME);
+
+    if (name)
+        snprintf(name, len, "%.*s_%zu%s", (int)base, path, k, path + base);
+
+    return name;
+}
+
+/* Tells whether a module path names another input or output,
+ * e.g.: module 1 of "foo.asm" and the output of "foo_1.asm". */
+static bool collides(const struct sdccrm *const c, const char *const *const paths,
+    char *const *const names, const size_t n_names, const char *const name)
+{
+    for (size_t i = 0; i < c->n_inputs; i++)
+    {
+        if (!strcmp(name, c->inputs[i].name))
+            return true;
+    }
+
+    for (size_t i = 0; i < c->n_results; i++)
+    {
+        if (!strcmp(name, paths[i]))
+            return true;
+    }
+
+    for (size_t i = 0; i < n_names; i++)
+    {
+        if (!strcmp(name, names[i]))
+            return true;
+    }
+
+    return false;
+}
+
+int sdccrm_write_files(const struct sdccrm *const c, const char *const *const paths)
+{
+    size_t n_parts = 0;
+
+    for (size_t i = 0; i < c->n_results; i++)
+    {
+        n_parts += c->results[i].n_parts;
+    }
+
+    /* Results not split are written as one part. */
+    const size_t n_max = c->n_results + n_parts;
+    const char **const bufs = alloc_(NULL, sizeof *bufs, n_max, ALLOC_TABLE);
+    size_t *const lens = alloc_(NULL, sizeof *lens, n_max, ALLOC_TABLE);
+    /* Paths of the outputs actually written. */
+    const char **const batch = alloc_(NULL, sizeof *batch, n_max, ALLOC_TABLE);
+    /* Paths made for modules split off outputs. */
+    char **const names = alloc_(NULL, sizeof *names, n_parts, ALLOC_TABLE);
+    size_t n = 0, n_names = 0;
+    int ret = ENOMEM;
+
+    if (bufs && lens && batch && names)
+    {
+        ret = 0;
+
+        /* Module paths are checked before anything is written. */
+        for (size_t i = 0; i < c->n_results && !ret; i++)
+        {
+            for (size_t k = 1; k < c->results[i].n_parts; k++)
+            {
+                char *const name = part_name(paths[i], k);
+
+                if (!name)
+                {
+                    ret = ENOMEM;
+                    break;
+                }
+                else if (collides(c, paths, names, n_names, name))
+                {
+                    fprintf(stderr, "Module %zu of %s would overwrite %s\n", k, paths[i], name);
+                    alloc_free(name);
+                    ret = EEXIST;
+                    break;
+                }
+
+                names[n_names++] = name;
+            }
+        }
+
+        for (size_t i = 0, j = 0; i < c->n_results && !ret; i++)
+        {
+            const struct sdccrm_result *const r = &c->results[i];
+            const struct input *const in = &c->inputs[i % c->n_inputs];
+
+            if (r->n_parts)
+            {
+                batch[n] = paths[i];
+                bufs[n] = r->parts[0].output;
+                lens[n++] = r->parts[0].output_len;
+
+                for (size_t k = 1; k < r->n_parts; k++)
+                {
+                    batch[n] = names[j++];
+                    bufs[n] = r->parts[k].output;
+                    lens[n++] = r->parts[k].output_len;
+                }
+
+                continue;
+            }
+            else if (r->unchanged && in->from_file)
+            {
+                /* e.g.: replacing an input by itself. */
+                if (!strcmp(paths[i], in->name))
+                    continue;
+                else if (!copy_file(in->name, paths[i]))
+                    continue;
+            }
+
+            batch[n] = paths[i];
+            bufs[n] = r->output;
+            lens[n++] = r->output_len;
+        }
+
+        if (!ret)
+            ret = write_files(n, batch, bufs, lens);
+    }
+
+    for (size_t i = 0; names && i < n_names; i++)
+    {
+        alloc_free(names[i]);
+    }
+
+    alloc_free(bufs);
+    alloc_free(lens);
+    alloc_free(batch);
+    alloc_free(names);
+
+    return ret;
+}
+
+struct run_job
+{
+    const struct sdccrm *c;
+    struct config *cfg;
+    struct sdccrm_result *results;
+    struct plan *plans;
+    struct log_buf log;
+    int error;
+};
+
+static void *run_config(void *const arg)
+{
+    struct run_job *const job = arg;
+    const struct sdccrm *const c = job->c;
+    struct config *const cfg = job->cfg;
+
+    if (!(cfg->used = alloc_(NULL, sizeof *cfg->used, c->tree.n_labels, ALLOC_TABLE)))
+    {
+        job->error = ENOMEM;
+        return NULL;
+    }
+
+    log_bind(&job->log);
+
+    memset(cfg->used, 0, c->tree.n_labels * sizeof *cfg->used);
+
+    const uint64_t start = trace_begin();
+
+    job->error = find_references(c, cfg);
+    trace_end(start, "reachability", NULL);
+
+    if (!job->error && c->window)
+        job->error = place_labels(c, cfg);
+
+    if (!job->error)
+        remove_unused(c, cfg, job->results, job->plans);
+
+    alloc_free(cfg->used);
+    alloc_free(cfg->windows);
+    cfg->used = NULL;
+    cfg->windows = NULL;
+    log_bind(NULL);
+
+    return NULL;
+}
+
+static struct config *active_configs(struct sdccrm *const c, size_t *const n)
+{
+    /* The default configuration only runs when no other is given. */
+    *n = c->n_configs > 1 ? c->n_configs - 1 : 1;
+
+    return c->n_configs > 1 ? &c->configs[1] : c->configs;
+}
+
+static int prepare_graph(struct sdccrm *const c)
+{
+    int ret = 0;
+
+    if (!c->tree.labels)
+    {
+        const uint64_t start = trace_begin();
+
+        ret = resolve_graph(&c->tree);
+        trace_end(start, "graph", &(const struct trace_args){.labels = c->tree.n_labels});
+    }
+
+    return ret;
+}
+
+int sdccrm_run(struct sdccrm *const c)
+{
+    size_t n_configs;
+    struct config *const configs = active_configs(c, &n_configs);
+    const size_t n_files = c->tree.n_files;
+    struct run_job *jobs;
+    pthread_t *threads;
+    int ret;
+
+    /* Allow running the same context more than once. */
+    free_results(c);
+
+    if ((ret = prepare_graph(c)))
+        return ret;
+
+    if (c->peephole)
+    {
+        ret = find_trampolines(c);
+        log_flush(c, NULL);
+
+        if (ret)
+            return ret;
+    }
+
+    c->results = alloc_(NULL, sizeof *c->results, n_configs * n_files, ALLOC_TABLE);
+    c->plans = alloc_(NULL, sizeof *c->plans, n_configs * n_files, ALLOC_TABLE);
+    jobs = alloc_(NULL, sizeof *jobs, n_configs, ALLOC_TABLE);
+    threads = alloc_(NULL, sizeof *threads, n_configs, ALLOC_TABLE);
+
+    if (!c->results || !c->plans || !jobs || !threads)
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    /* Configurations failing early leave their results zeroed. */
+    memset(c->results, 0, n_configs * n_files * sizeof *c->results);
+    memset(c->plans, 0, n_configs * n_files * sizeof *c->plans);
+
+    for (size_t i = 0; i < n_configs; i++)
+    {
+        jobs[i] = (struct run_job)
+        {
+            .c = c,
+            .cfg = &configs[i],
+            .results = &c->results[i * n_files],
+            .plans = &c->plans[i * n_files]
+        };
+    }
+
+    /* Configurations only share read-only data, so every
+     * configuration but the last one runs on its own thread. */
+    size_t n_threads = 0;
+
+    for (size_t i = 0; i + 1 < n_configs; i++, n_threads++)
+    {
+        if (pthread_create(&threads[i], NULL, run_config, &jobs[i]))
+        {
+            break;
+        }
+    }
+
+    for (size_t i = n_threads; i < n_configs; i++)
+    {
+        run_config(&jobs[i]);
+    }
+
+    for (size_t i = 0; i < n_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Records are written in configuration order, as if run serially. */
+    for (size_t i = 0; i < n_configs; i++)
+    {
+        log_flush(c, &jobs[i].log);
+    }
+
+    c->n_results = n_configs * n_files;
+
+    for (size_t i = 0; i < n_configs && !ret; i++)
+    {
+        ret = jobs[i].error;
+    }
+
+end:
+    alloc_free(jobs);
+    alloc_free(threads);
+
+    if (ret)
+        free_results(c);
+
+    return ret;
+}
+
+int sdccrm_add_rel(struct sdccrm *const c, const char *const name, const char *const buf, const size_t len)
+{
+    /* Object files are read as null-terminated strings, too. */
+    char *const b = alloc_buf((len + 1) * sizeof *b, ALLOC_FILE_BUF);
+
+    if (!b)
+        return ENOMEM;
+
+    memcpy(b, buf, len);
+    b[len] = '\0';
+
+    const uint64_t start = trace_begin();
+    struct file f;
+    int ret = parse_rel(c->port, b, &f);
+
+    alloc_free(b);
+
+    trace_end(start, "parse", &(const struct trace_args)
+        {
+            .file = name,
+            .bytes = len,
+            .labels = f.n_labels
+        });
+
+    if (ret)
+    {
+        free_file(&f);
+        return ret;
+    }
+
+    /* There is no text to filter, only labels to report. */
+    return add_input(c, name, NULL, 0, &f);
+}
+
+int sdccrm_add_summary(struct sdccrm *const c, const void *const data, const size_t len)
+{
+    struct file f;
+    char *name;
+    uint64_t checksum;
+    int ret = read_summary(data, len, &f, &name, &checksum);
+
+    if (ret)
+        return ret;
+
+    if (!(ret = add_input(c, name, NULL, 0, &f)))
+    {
+        c->inputs[c->n_inputs - 1].checksum = checksum;
+    }
+
+    alloc_free(name);
+    return ret;
+}
+
+int sdccrm_get_summary(const struct sdccrm *const c, const size_t i, void **const data, size_t *const len)
+{
+    if (i >= c->n_inputs)
+        return EINVAL;
+
+    const struct input *const in = &c->inputs[i];
+    const uint64_t checksum = in->buf ? text_checksum(in->buf, in->len) : in->checksum;
+    struct strbuf out = {0};
+    const int ret = write_summary(&c->tree.files[i], in->name, checksum, &out);
+
+    if (ret)
+    {
+        alloc_free(out.data);
+        return ret;
+    }
+
+    *data = out.data;
+    *len = out.len;
+    return 0;
+}
+
+int sdccrm_get_plan(const struct sdccrm *const c, const size_t i, void **const data, size_t *const len)
+{
+    if (i >= c->n_results)
+        return EINVAL;
+
+    /* Results are grouped by configuration. */
+    const struct input *const in = &c->inputs[i % c->n_inputs];
+    const uint64_t checksum = in->buf ? text_checksum(in->buf, in->len) : in->checksum;
+    struct strbuf out = {0};
+    const int ret = write_plan(&c->plans[i], checksum, &out);
+
+    if (ret)
+    {
+        alloc_free(out.data);
+        return ret;
+    }
+
+    *data = out.data;
+    *len = out.len;
+    return 0;
+}
+
+int sdccrm_apply_plan(const char *const buf, const size_t len, const void *const plan, const size_t plan_len,
+    char **const out, size_t *const out_len)
+{
+    struct plan p;
+    uint64_t checksum;
+    struct strbuf filtered = {0};
+    int ret = read_plan(plan, plan_len, &p, &checksum);
+
+    if (ret)
+        return ret;
+
+    if (checksum != text_checksum(buf, len))
+    {
+        /* Plan was made for another revision of this file. */
+        free_plan(&p);
+        return ESTALE;
+    }
+
+    /* Text is expected to be NUL-terminated, as with any other input. */
+    char *const text = alloc_buf((len + 1) * sizeof *text, ALLOC_FILE_BUF);
+
+    if (!text)
+    {
+        free_plan(&p);
+        return ENOMEM;
+    }
+
+    memcpy(text, buf, len);
+    text[len] = '\0';
+
+    if (!p.n_spans && !p.n_drop && !p.n_edits)
+    {
+        /* Nothing to remove, as with sdccrm_run(). */
+        free_plan(&p);
+        *out = text;
+        *out_len = len;
+        return 0;
+    }
+
+    write_filtered_file(&filtered, &p, text);
+    alloc_free(text);
+    free_plan(&p);
+
+    if (!filtered.data && !strbuf_append(&filtered, "", 0))
+        return ENOMEM;
+
+    *out = filtered.data;
+    *out_len = filtered.len;
+    return 0;
+}
+
+void sdccrm_free_data(void *const data)
+{
+    alloc_free(data);
+}
+
+int sdccrm_stack_report(struct sdccrm *const c, FILE *const f)
+{
+    size_t n_configs;
+    const struct config *const configs = active_configs(c, &n_configs);
+    int ret = prepare_graph(c);
+
+    for (size_t i = 0; i < n_configs && !ret; i++)
+    {
+        const uint64_t start = trace_begin();
+
+        ret = report_stack(c, &configs[i], f);
+        trace_end(start, "stack", NULL);
+    }
+
+    return ret;
+}
+
+int sdccrm_layout_report(struct sdccrm *const c, FILE *const f)
+{
+    size_t n_configs;
+    struct config *const configs = active_configs(c, &n_configs);
+    const size_t n = c->tree.n_labels;
+    int ret = c->window ? prepare_graph(c) : EINVAL;
+
+    for (size_t i = 0; i < n_configs && !ret; i++)
+    {
+        struct config *const cfg = &configs[i];
+
+        if (!(cfg->used = alloc_(NULL, sizeof *cfg->used, n, ALLOC_TABLE)))
+        {
+            ret = ENOMEM;
+            break;
+        }
+
+        memset(cfg->used, 0, n * sizeof *cfg->used);
+
+        if (!(ret = find_references(c, cfg)) && !(ret = place_labels(c, cfg)))
+            ret = report_layout(c, cfg, f);
+
+        alloc_free(cfg->used);
+        alloc_free(cfg->windows);
+        cfg->used = NULL;
+        cfg->windows = NULL;
+    }
+
+    log_flush(c, NULL);
+
+    return ret;
+}
+
+int sdccrm_why(struct sdccrm *const c, const char *const label, FILE *const f)
+{
+    return explain(c, label, f);
+}
+
+int sdccrm_why_all(struct sdccrm *const c, FILE *const f)
+{
+    return explain(c, NULL, f);
+}
+
+int sdccrm_verify(struct sdccrm *const c, FILE *const f, size_t *const n_diff)
+{
+    size_t n_configs;
+    struct config *const configs = active_configs(c, &n_configs);
+    int ret = sdccrm_run(c);
+
+    if (!ret)
+    {
+        const uint64_t start = trace_begin();
+
+        ret = verify_engines(c, configs, n_configs, f, n_diff);
+        trace_end(start, "verify", NULL);
+    }
+
+    log_flush(c, NULL);
+
+    return ret;
+}
+
+/* Runs reachability again for every configuration, this
+ * time recording predecessors, and reports on label or,
+ * if NULL, on every root. */
+static int explain(struct sdccrm *const c, const char *const label, FILE *const f)
+{
+    size_t n_configs;
+    struct config *const configs = active_configs(c, &n_configs);
+    const size_t n = c->tree.n_labels;
+    int ret = prepare_graph(c);
+
+    for (size_t i = 0; i < n_configs && !ret; i++)
+    {
+        struct config *const cfg = &configs[i];
+
+        cfg->used = alloc_(NULL, sizeof *cfg->used, n, ALLOC_TABLE);
+        cfg->pred = alloc_(NULL, sizeof *cfg->pred, n, ALLOC_TABLE);
+
+        if (!cfg->used || !cfg->pred)
+        {
+            ret = ENOMEM;
+        }
+        else
+        {
+            const uint64_t start = trace_begin();
+
+            memset(cfg->used, 0, n * sizeof *cfg->used);
+
+            if (!(ret = find_references(c, cfg)))
+            {
+                ret = label ? report_why(c, cfg, label, f) : report_why_all(c, cfg, f);
+            }
+
+            trace_end(start, "why", NULL);
+        }
+
+        alloc_free(cfg->used);
+        alloc_free(cfg->pred);
+        cfg->used = NULL;
+        cfg->pred = NULL;
+    }
+
+    log_flush(c, NULL);
+
+    return ret;
+}
+
+size_t sdccrm_n_inputs(const struct sdccrm *const c)
+{
+    return c->n_inputs;
+}
+
+size_t sdccrm_n_results(const struct sdccrm *const c)
+{
+    return c->n_results;
+}
+
+const struct sdccrm_result *sdccrm_get_result(const struct sdccrm *const c, const size_t i)
+{
+    return i < c->n_results ? &c->results[i] : NULL;
+}
+
+static void free_results(struct sdccrm *const c)
+{
+    for (size_t i = 0; i < c->n_results; i++)
+    {
+        struct sdccrm_result *const r = &c->results[i];
+
+        if (!r->unchanged)
+            alloc_free((char *)r->output);
+
+        for (size_t j = 0; j < r->n_parts; j++)
+        {
+            alloc_free((char *)r->parts[j].output);
+        }
+
+        alloc_free((struct sdccrm_part *)r->parts);
+        alloc_free((const char **)r->removed);
+        free_plan(&c->plans[i]);
+    }
+
+    alloc_free(c->results);
+    alloc_free(c->plans);
+    alloc_free(c->trampolines);
+    c->results = NULL;
+    c->plans = NULL;
+    c->trampolines = NULL;
+    c->n_results = 0;
+}
+
+static void free_config(struct config *const cfg)
+{
+    alloc_free(cfg->name);
+    alloc_free(cfg->entry_label);
+    exclusions_free(&cfg->excluded);
+    exclusions_free(&cfg->removals);
+}
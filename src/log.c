@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Leveled logging. Records are formatted into per-thread buffers
+ * and written in large blocks, either as text or as one JSON
+ * object per line. */
+
+#include "log.h"
+#include "context.h"
+#include "alloc.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+    /* Own buffers are written once they reach this size. */
+    LOG_FLUSH_SIZE = 64 << 10,
+    /* Longer messages are truncated. */
+    LOG_MAX_MSG = 256,
+    /* Bytes taken by a record besides its strings, e.g.: JSON keys. */
+    LOG_RECORD_OVERHEAD = 128,
+    /* Worst case for escaped characters, e.g.: "\u0000". */
+    LOG_MAX_ESCAPE = sizeof "\\u0000" - 1
+};
+
+static bool reserve(struct log_text *b, size_t n);
+static void append(struct log_text *b, const char *s, size_t len);
+static void append_string(struct log_text *b, const char *s);
+static void append_json(struct log_text *b, const char *key, const char *s);
+static void write_text(struct log_text *t, FILE *f);
+
+static const char *const level_names[] =
+{
+    [SDCCRM_LOG_NONE] = "none",
+    [SDCCRM_LOG_WARNING] = "warning",
+    [SDCCRM_LOG_INFO] = "info",
+    [SDCCRM_LOG_DEBUG] = "debug"
+};
+
+static _Thread_local struct log_buf own;
+static _Thread_local struct log_buf *bound;
+
+void log_bind(struct log_buf *const b)
+{
+    bound = b;
+}
+
+void log_record(const struct sdccrm *const c, const enum sdccrm_log_level level, const char *const func,
+    const char *const file, const char *const symbol, const char *const fmt, ...)
+{
+    struct log_buf *const lb = bound ? bound : &own;
+    /* Only the CLI default keeps warnings off stdout, so records
+     * written to a stream of the caller stay in order. */
+    struct log_text *const b = level == SDCCRM_LOG_WARNING && !c->log ? &lb->warnings : &lb->out;
+    char msg[LOG_MAX_MSG];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof msg, fmt, ap);
+    va_end(ap);
+
+    /* Room for the whole record is made up front, so failing to
+     * allocate it drops this record alone, never a partial one. */
+    if (!reserve(b, LOG_RECORD_OVERHEAD + LOG_MAX_ESCAPE * (strlen(msg) + strlen(func)
+        + (file ? strlen(file) : 0) + (symbol ? strlen(symbol) : 0))))
+        return;
+
+    if (c->log_format == SDCCRM_LOG_JSON)
+    {
+        append_string(b, "{");
+        append_json(b, "level", level_names[level]);
+
+        if (file)
+        {
+            append_string(b, ", ");
+            append_json(b, "file", file);
+        }
+
+        if (symbol)
+        {
+            append_string(b, ", ");
+            append_json(b, "symbol", symbol);
+        }
+
+        append_string(b, ", ");
+        append_json(b, "func", func);
+        append_string(b, ", ");
+        append_json(b, "msg", msg);
+        append_string(b, "}\n");
+    }
+    else
+    {
+        append_string(b, level_names[level]);
+        append_string(b, ": ");
+
+        if (file)
+        {
+            append_string(b, file);
+            append_string(b, ": ");
+        }
+
+        if (symbol)
+        {
+            append_string(b, symbol);
+            append_string(b, ": ");
+        }
+
+        append_string(b, msg);
+        append_string(b, "\n");
+    }
+
+    /* Bound buffers are written by whoever bound them. */
+    if (lb == &own && own.out.len + own.warnings.len >= LOG_FLUSH_SIZE)
+    {
+        log_flush(c, NULL);
+    }
+}
+
+void log_flush(const struct sdccrm *const c, struct log_buf *b)
+{
+    if (!b)
+        b = &own;
+
+    write_text(&b->out, c->log ? c->log : stdout);
+    write_text(&b->warnings, stderr);
+}
+
+static void write_text(struct log_text *const t, FILE *const f)
+{
+    if (t->len)
+    {
+        fwrite(t->data, sizeof *t->data, t->len, f);
+    }
+
+    alloc_free(t->data);
+    *t = (struct log_text){0};
+}
+
+static bool reserve(struct log_text *const b, const size_t n)
+{
+    if (b->len + n > b->size)
+    {
+        size_t size = b->size ? b->size * 2 : LOG_FLUSH_SIZE / 4;
+
+        while (size < b->len + n)
+            size *= 2;
+
+        /* Records already buffered are kept. */
+        char *const data = alloc_grow_(b->data, sizeof *b->data, size - 1, ALLOC_LOG);
+
+        if (!data)
+            return false;
+
+        b->data = data;
+        b->size = size;
+    }
+
+    return true;
+}
+
+static void append(struct log_text *const b, const char *const s, const size_t len)
+{
+    if (reserve(b, len))
+    {
+        memcpy(&b->data[b->len], s, len);
+        b->len += len;
+    }
+}
+
+static void append_string(struct log_text *const b, const char *const s)
+{
+    append(b, s, strlen(s));
+}
+
+static void append_json(struct log_text *const b, const char *const key, const char *s)
+{
+    append_string(b, "\"");
+    append_string(b, key);
+    append_string(b, "\": \"");
+
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            const char esc[] = {'\\', *s};
+
+            append(b, esc, sizeof esc);
+        }
+        else if ((unsigned char)*s < ' ')
+        {
+            char esc[sizeof "\\u0000"];
+
+            snprintf(esc, sizeof esc, "\\u%04x", *s);
+            append_string(b, esc);
+        }
+        else
+        {
+            append(b, s, 1);
+        }
+    }
+
+    append_string(b, "\"");
+}
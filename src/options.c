@@ -17,8 +17,11 @@
  */
 
 #include "options.h"
+#include "sdccrm.h"
 #include "common.h"
 #include "alloc.h"
+#include "trace.h"
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -27,6 +30,34 @@
 #define PARAM_STR "[param]"
 #define APP_NAME "sdccrm"
 
+static void enable_verbose(struct sdccrm *c);
+static void set_log_level(struct sdccrm *c, const char *level);
+static void set_log_format(struct sdccrm *c, const char *format);
+static void set_port(struct sdccrm *c, const char *name);
+static void enable_replace(struct sdccrm *c);
+static void enable_remove_blocks(struct sdccrm *c);
+static void enable_peephole(struct sdccrm *c);
+static void enable_mem_stats(struct sdccrm *c);
+static void enable_stack(struct sdccrm *c);
+static void set_layout(struct sdccrm *c, const char *window);
+static void set_split(struct sdccrm *c, const char *n);
+static void set_why(struct sdccrm *c, const char *label);
+static void enable_why_all(struct sdccrm *c);
+static void set_summarize(struct sdccrm *c);
+static void set_merge(struct sdccrm *c);
+static void set_apply(struct sdccrm *c);
+static void set_rel(struct sdccrm *c);
+static void set_verify(struct sdccrm *c);
+static void remove_file(struct sdccrm *c, const char *path);
+static void exclude_label(struct sdccrm *c, const char *l);
+static void exclude_file(struct sdccrm *c, const char *path);
+static void set_entry_label(struct sdccrm *c, const char *l);
+static void set_trace(struct sdccrm *c, const char *path);
+static void add_config(struct sdccrm *c, const char *name);
+static void set_output_dir(struct sdccrm *c, const char *dir);
+static void set_output_suffix(struct sdccrm *c, const char *suffix);
+static void version(struct sdccrm *c);
+
 static const struct
 {
     const char *flag;
@@ -35,18 +66,42 @@ static const struct
     bool exits;
     union
     {
-        void (*f)(void);
-        void (*f_param)(const char *);
+        void (*f)(struct sdccrm *);
+        void (*f_param)(struct sdccrm *, const char *);
     };
 } options[] =
 {
     {
         .flag = "-v",
-        .descr = "Enables verbose mode",
+        .descr = "Enables verbose mode, i.e.: --log-level info",
         .param = false,
         .f = enable_verbose
     },
 
+    {
+        .flag = "--log-level",
+        .descr = "Sets log level " PARAM_STR ": none, warning, info (files and labels "
+            "removed) or debug (every reference found and label kept). Defaults to none",
+        .param = true,
+        .f_param = set_log_level
+    },
+
+    {
+        .flag = "--log-format",
+        .descr = "Writes log records as " PARAM_STR ": text or json, one record per line. "
+            "Defaults to text",
+        .param = true,
+        .f_param = set_log_format
+    },
+
+    {
+        .flag = "--port",
+        .descr = "Sets the SDCC port " PARAM_STR " inputs were generated for: stm8 "
+            "(default), z80, z180, hc08, s08 or mcs51",
+        .param = true,
+        .f_param = set_port
+    },
+
     {
         .flag = "-r",
         .descr = "Replaces existing .asm file instead of creating .asmrm file",
@@ -54,123 +109,550 @@ static const struct
         .f = enable_replace 
     },
 
+    {
+        .flag = "--remove-blocks",
+        .descr = "Also removes unreachable code within labels being kept, e.g.: "
+            "instructions after a return or unconditional jump that no local label leads to",
+        .param = false,
+        .f = enable_remove_blocks
+    },
+
+    {
+        .flag = "--peephole",
+        .descr = "Rewrites calls right before a return into jumps, and calls to labels "
+            "only jumping to another label into calls to the latter, removing them if left unused",
+        .param = false,
+        .f = enable_peephole
+    },
+
 
     {
         .flag = "-x",
-        .descr = "Excludes a given label " PARAM_STR " from being removed",
+        .descr = "Excludes a given label " PARAM_STR " from being removed. "
+            "Glob patterns such as '_*_IRQHandler' are accepted",
         .param = true,
         .f_param = exclude_label
     },
 
+    {
+        .flag = "-X",
+        .descr = "Excludes labels or patterns listed in file " PARAM_STR ", one per line",
+        .param = true,
+        .f_param = exclude_file
+    },
+
     {
         .flag = "-e",
-        .descr = "Sets " PARAM_STR " as entry label. Defaults to " DEFAULT_ENTRY_LABEL,
+        .descr = "Sets " PARAM_STR " as entry label. Defaults to " SDCCRM_DEFAULT_ENTRY_LABEL,
         .param = true,
         .f_param = set_entry_label
     },
 
+    {
+        .flag = "--config",
+        .descr = "Starts configuration " PARAM_STR ". -e, -x, -X, --removed, -o and -s given "
+            "afterwards apply to it only, while -e, -x, -X, --removed and -s given before are "
+            "shared by all configurations. Inputs are parsed once for all of them",
+        .param = true,
+        .f_param = add_config
+    },
+
+    {
+        .flag = "-o",
+        .descr = "Writes output files into directory " PARAM_STR ". Defaults to "
+            "the configuration name, if any",
+        .param = true,
+        .f_param = set_output_dir
+    },
+
+    {
+        .flag = "-s",
+        .descr = "Sets " PARAM_STR " as output file suffix. Defaults to rm",
+        .param = true,
+        .f_param = set_output_suffix
+    },
+
+    {
+        .flag = "--stack",
+        .descr = "Prints worst-case stack usage from the entry label, interrupt "
+            "handlers and excluded labels, including recursion and critical paths",
+        .param = false,
+        .f = enable_stack
+    },
+
+    {
+        .flag = "--layout",
+        .descr = "Places kept functions into windows of " PARAM_STR " bytes, e.g.: 65536, "
+            "so as many far calls as possible stay within one, moving those outside the "
+            "first window into areas such as CODE_1. Prints every window and its functions",
+        .param = true,
+        .f_param = set_layout
+    },
+
+    {
+        .flag = "--split",
+        .descr = "Splits every output into up to " PARAM_STR " modules of about the same "
+            "size, keeping functions calling each other together, so they can be assembled "
+            "in parallel. Modules are written next to the output, e.g.: main_1.asmrm",
+        .param = true,
+        .f_param = set_split
+    },
+
+    {
+        .flag = "--why",
+        .descr = "Prints the shortest chain of references from the entry label "
+            "or any other root to label " PARAM_STR ", i.e.: why it is kept. Can be given "
+            "more than once",
+        .param = true,
+        .f_param = set_why
+    },
+
+    {
+        .flag = "--why-all",
+        .descr = "Prints how many bytes every root keeps alive, both on its own "
+            "and shared with other roots",
+        .param = false,
+        .f = enable_why_all
+    },
+
+    {
+        .flag = "--summarize",
+        .descr = "Writes a compact summary of every input file into a .sum file, "
+            "for a later --merge step",
+        .param = false,
+        .f = set_summarize
+    },
+
+    {
+        .flag = "--merge",
+        .descr = "Reads .sum files instead of assembly files, and writes a "
+            "removal plan for every original file into a .plan file",
+        .param = false,
+        .f = set_merge
+    },
+
+    {
+        .flag = "--apply",
+        .descr = "Filters every input file according to its .plan file, "
+            "without any further analysis",
+        .param = false,
+        .f = set_apply
+    },
+
+    {
+        .flag = "--rel",
+        .descr = "Reads SDCC object (.rel) files instead of assembly files, and "
+            "writes the names of their unused labels into a .removed file",
+        .param = false,
+        .f = set_rel
+    },
+
+    {
+        .flag = "--removed",
+        .descr = "Only removes labels listed in file " PARAM_STR ", e.g.: as "
+            "written by --rel, plus static labels only they reference",
+        .param = true,
+        .f_param = remove_file
+    },
+
+    {
+        .flag = "--verify",
+        .descr = "Checks labels found, labels removed and output text against a "
+            "straightforward reference engine, without writing any file. Exits "
+            "with an error if they differ",
+        .param = false,
+        .f = set_verify
+    },
+
+    {
+        .flag = "--mem-stats",
+        .descr = "Prints heap usage per subsystem on exit",
+        .param = false,
+        .f = enable_mem_stats
+    },
+
+    {
+        .flag = "--trace",
+        .descr = "Writes a Chrome trace-event timeline to " PARAM_STR,
+        .param = true,
+        .f_param = set_trace
+    },
+
     {
         .flag = "--version",
         .descr = "Prints version",
         .exits = true,
-        .f = show_version
+        .f = version
     }
 };
 
+/* Options only relevant to the command line interface.
+ * Analysis options are stored into the libsdccrm context. */
 static struct
 {
-    bool verbose;
     bool replace;
-    const char **excluded_labels;
-    size_t n_excluded_labels;
-    const char *entry_label;
+    bool stack;
+    bool layout;
+    bool split;
+    /* Labels given by --why. */
+    const char **why;
+    size_t n_why;
+    bool why_all;
+    enum mode mode;
+    /* outputs[0] holds the defaults. */
+    struct output *outputs;
+    size_t n_outputs;
+    /* Set by any invalid option, so nothing is written. */
+    int error;
 } config;
 
-bool verbose(void)
+bool replace(void)
 {
-    return config.verbose;
+    return config.replace;
 }
 
-bool replace(void)
+enum mode mode(void)
 {
-    return config.replace;
+    return config.mode;
 }
 
-void enable_verbose(void)
+bool stack(void)
 {
-    config.verbose = true;
+    return config.stack;
 }
 
-void enable_replace(void)
+bool layout(void)
 {
-    config.replace = true;
+    return config.layout;
 }
 
-const char *get_entry_label(void)
+bool split(void)
 {
-    return config.entry_label ? config.entry_label : DEFAULT_ENTRY_LABEL;
+    return config.split;
 }
 
-void set_entry_label(const char *const l)
+size_t n_why(void)
 {
-    config.entry_label = l;
+    return config.n_why;
 }
 
-bool is_label_excluded(const char *const l)
+const char *why(const size_t i)
 {
-    if (config.excluded_labels)
+    return i < config.n_why ? config.why[i] : NULL;
+}
+
+bool why_all(void)
+{
+    return config.why_all;
+}
+
+const struct output *get_output(const char *const name)
+{
+    static const struct output defaults;
+
+    for (size_t i = 1; name && i < config.n_outputs; i++)
     {
-        for (size_t i = 0; i < config.n_excluded_labels; i++)
+        if (!strcmp(config.outputs[i].config, name))
         {
-            const char *const excl_l = config.excluded_labels[i];
-
-            if (excl_l)
-            {
-                if (!strcmp(l, excl_l))
-                {
-                    return true;
-                }
-            }
+            return &config.outputs[i];
         }
     }
 
-    return false;
+    return config.outputs ? &config.outputs[0] : &defaults;
+}
+
+void free_options(void)
+{
+    alloc_free(config.outputs);
+    alloc_free(config.why);
+    config.outputs = NULL;
+    config.why = NULL;
+    config.n_outputs = config.n_why = 0;
 }
 
-void exclude_label(const char *const l)
+static struct output *current_output(void)
 {
-    if (config.excluded_labels)
+    if (!config.n_outputs)
     {
-        if (!is_label_excluded(l))
-        {
-            config.excluded_labels = alloc(config.excluded_labels, config.n_excluded_labels);
-        }
-        else
+        if (!(config.outputs = alloc(config.outputs, 0, ALLOC_TABLE)))
+            return NULL;
+
+        config.outputs[config.n_outputs++] = (struct output){0};
+    }
+
+    return &config.outputs[config.n_outputs - 1];
+}
+
+static void enable_verbose(struct sdccrm *const c)
+{
+    sdccrm_set_verbose(c, true);
+}
+
+static void set_log_level(struct sdccrm *const c, const char *const level)
+{
+    static const char *const levels[] =
+    {
+        [SDCCRM_LOG_NONE] = "none",
+        [SDCCRM_LOG_WARNING] = "warning",
+        [SDCCRM_LOG_INFO] = "info",
+        [SDCCRM_LOG_DEBUG] = "debug"
+    };
+
+    for (size_t i = 0; i < lengthof (levels); i++)
+    {
+        if (!strcmp(level, levels[i]))
         {
-            fprintf(stderr, "Label %s set as excluded more than once\n", l);
+            sdccrm_set_log_level(c, i);
             return;
         }
     }
+
+    fprintf(stderr, "Unknown log level %s\n", level);
+    config.error = EINVAL;
+}
+
+static void set_log_format(struct sdccrm *const c, const char *const format)
+{
+    if (!strcmp(format, "text"))
+        sdccrm_set_log_format(c, SDCCRM_LOG_TEXT);
+    else if (!strcmp(format, "json"))
+        sdccrm_set_log_format(c, SDCCRM_LOG_JSON);
     else
     {
-        config.excluded_labels = malloc(sizeof *config.excluded_labels);
+        fprintf(stderr, "Unknown log format %s\n", format);
+        config.error = EINVAL;
+    }
+}
+
+static void set_port(struct sdccrm *const c, const char *const name)
+{
+    if (sdccrm_set_port(c, name))
+    {
+        fprintf(stderr, "Unknown port %s\n", name);
+        config.error = EINVAL;
+    }
+}
+
+static void enable_replace(struct sdccrm *const c)
+{
+    (void)c;
+    config.replace = true;
+}
+
+static void enable_remove_blocks(struct sdccrm *const c)
+{
+    sdccrm_set_remove_blocks(c, true);
+}
+
+static void enable_peephole(struct sdccrm *const c)
+{
+    sdccrm_set_peephole(c, true);
+}
+
+static void enable_stack(struct sdccrm *const c)
+{
+    (void)c;
+    config.stack = true;
+}
+
+static void set_layout(struct sdccrm *const c, const char *const window)
+{
+    char *end;
+    const unsigned long bytes = strtoul(window, &end, 0);
+
+    if (!*window || *end || !bytes)
+    {
+        fprintf(stderr, "Invalid window size %s\n", window);
+        config.error = EINVAL;
+        return;
+    }
+
+    sdccrm_set_layout(c, bytes);
+    config.layout = true;
+}
+
+static void set_split(struct sdccrm *const c, const char *const n)
+{
+    char *end;
+    const unsigned long modules = strtoul(n, &end, 0);
+
+    if (!*n || *end || !modules)
+    {
+        fprintf(stderr, "Invalid number of modules %s\n", n);
+        config.error = EINVAL;
+        return;
+    }
+
+    sdccrm_set_split(c, modules);
+    config.split = true;
+}
+
+static void set_why(struct sdccrm *const c, const char *const label)
+{
+    (void)c;
+
+    if (!(config.why = alloc(config.why, config.n_why, ALLOC_TABLE)))
+    {
+        fprintf(stderr, "Could not add label %s\n", label);
+        config.n_why = 0;
+        config.error = ENOMEM;
+        return;
+    }
+
+    config.why[config.n_why++] = label;
+}
+
+static void enable_why_all(struct sdccrm *const c)
+{
+    (void)c;
+    config.why_all = true;
+}
+
+static void set_summarize(struct sdccrm *const c)
+{
+    (void)c;
+    config.mode = MODE_SUMMARIZE;
+}
+
+static void set_merge(struct sdccrm *const c)
+{
+    (void)c;
+    config.mode = MODE_MERGE;
+}
+
+static void set_apply(struct sdccrm *const c)
+{
+    (void)c;
+    config.mode = MODE_APPLY;
+}
+
+static void set_rel(struct sdccrm *const c)
+{
+    (void)c;
+    config.mode = MODE_REL;
+}
+
+static void set_verify(struct sdccrm *const c)
+{
+    (void)c;
+    config.mode = MODE_VERIFY;
+}
+
+static void enable_mem_stats(struct sdccrm *const c)
+{
+    (void)c;
+    enable_alloc_stats();
+}
+
+static void exclude_label(struct sdccrm *const c, const char *const l)
+{
+    const int ret = sdccrm_exclude(c, l);
+
+    if (ret)
+    {
+        fprintf(stderr, "Could not exclude label %s\n", l);
+        config.error = ret;
     }
+}
+
+static void exclude_file(struct sdccrm *const c, const char *const path)
+{
+    const int ret = sdccrm_exclude_file(c, path);
 
-    if (config.excluded_labels)
+    if (ret)
     {
-        config.excluded_labels[config.n_excluded_labels++] = l;
+        fprintf(stderr, "Could not read exclusions from %s\n", path);
+        config.error = ret;
     }
 }
 
-void options_cleanup(void)
+static void remove_file(struct sdccrm *const c, const char *const path)
 {
-    if (config.excluded_labels)
+    const int ret = sdccrm_remove_file(c, path);
+
+    if (ret)
     {
-        free(config.excluded_labels);
+        fprintf(stderr, "Could not read removal list from %s\n", path);
+        config.error = ret;
     }
 }
 
-int parse_options(const int offset, const int argc, const char *const *const argv, bool *const exit)
+static void set_entry_label(struct sdccrm *const c, const char *const l)
+{
+    const int ret = sdccrm_set_entry(c, l);
+
+    if (ret)
+    {
+        fprintf(stderr, "Could not set entry label %s\n", l);
+        config.error = ret;
+    }
+}
+
+static void set_trace(struct sdccrm *const c, const char *const path)
+{
+    (void)c;
+    enable_trace(path);
+}
+
+static void add_config(struct sdccrm *const c, const char *const name)
+{
+    const int ret = sdccrm_add_config(c, name);
+
+    if (ret)
+    {
+        fprintf(stderr, ret == EEXIST ? "Configuration %s given more than once\n"
+            : "Could not add configuration %s\n", name);
+        config.error = ret;
+        return;
+    }
+
+    struct output *outputs;
+
+    if (!current_output()
+        || !(outputs = alloc(config.outputs, config.n_outputs, ALLOC_TABLE)))
+    {
+        fprintf(stderr, "Could not add configuration %s\n", name);
+        config.outputs = NULL;
+        config.n_outputs = 0;
+        config.error = ENOMEM;
+        return;
+    }
+
+    config.outputs = outputs;
+    config.outputs[config.n_outputs++] = (struct output)
+    {
+        .config = name,
+        .suffix = config.outputs[0].suffix
+    };
+}
+
+static void set_output_dir(struct sdccrm *const c, const char *const dir)
+{
+    struct output *const o = current_output();
+
+    (void)c;
+
+    if (o)
+        o->dir = dir;
+}
+
+static void set_output_suffix(struct sdccrm *const c, const char *const suffix)
+{
+    struct output *const o = current_output();
+
+    (void)c;
+
+    if (o)
+        o->suffix = suffix;
+}
+
+static void version(struct sdccrm *const c)
+{
+    (void)c;
+    show_version();
+}
+
+int parse_options(struct sdccrm *const c, const int offset, const int argc, const char *const *const argv, bool *const exit)
 {
     /* Calculate where file list starts. If options
      * are given, this index shall be increased. */
@@ -184,7 +666,8 @@ int parse_options(const int offset, const int argc, const char *const *const arg
     {
         const char *const option = argv[i];
 
-        if (*option == '-')
+        /* A single '-' stands for stdin and is not an option switch. */
+        if (*option == '-' && option[1])
         {
             for (size_t j = 0; j < lengthof (options); j++)
             {
@@ -199,7 +682,7 @@ int parse_options(const int offset, const int argc, const char *const *const arg
                     {
                         if (options[j].f)
                         {
-                            options[j].f();
+                            options[j].f(c);
                         }
                     }
 
@@ -217,11 +700,11 @@ int parse_options(const int offset, const int argc, const char *const *const arg
         {
             if (options[param_i].f_param)
             {
-                options[param_i].f_param(option);
+                options[param_i].f_param(c, option);
             }
             else
             {
-                WARNING("No callback defined for flag %s", options[param_i].flag);
+                fprintf(stderr, "No callback defined for flag %s\n", options[param_i].flag);
             }
 
             reading_parameter = false;
@@ -231,6 +714,14 @@ int parse_options(const int offset, const int argc, const char *const *const arg
             /* End of option switches. */
             break;
         }
+
+        if (config.error)
+        {
+            /* Returned as exit status, without writing anything. */
+            *exit = true;
+            errno = config.error;
+            return i;
+        }
     }
 
     return i;
@@ -239,6 +730,10 @@ int parse_options(const int offset, const int argc, const char *const *const arg
 void usage(void)
 {
     printf("Usage:\n" APP_NAME " [options] file1 file2 ... filen\n");
+    printf(APP_NAME " [options] - < in.asm > out.asm\n");
+    printf("When reading from stdin, files are concatenated and each one is "
+        "preceded by a \"" FILE_MARKER "name\" line. The filtered stream, "
+        "including markers, is written to stdout.\n");
 
     printf("Options:\n");
 
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Peephole stage, run once unused labels are known. Calls right
+ * before a matching return become jumps, e.g.: "call _f" and "ret"
+ * become "jp _f". Labels whose only line is a jump to another label
+ * are trampolines, and calls and jumps to them using mnemonics of the
+ * same reach go straight to their final targets instead. Trampolines
+ * whose references are all retargeted this way are then bypassed by
+ * find_references(), so they are removed unless kept otherwise. */
+
+#include "peephole.h"
+#include "classify.h"
+#include "graph.h"
+#include "alloc.h"
+#include "common.h"
+#include "trace.h"
+#include "log.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static void find_jumps(struct sdccrm *c, size_t file, const struct text_line *lines, size_t n_lines);
+static int follow_chains(struct sdccrm *c);
+static void count_retargeted(const struct sdccrm *c, size_t file, const struct text_line *lines, size_t n_lines,
+    size_t *retargeted);
+static size_t retarget(const struct sdccrm *c, size_t file, const char *line, size_t len, const char **operand);
+static bool is_ret(const char *line, const struct tail *tail);
+
+int find_trampolines(struct sdccrm *const c)
+{
+    const struct tree *const t = &c->tree;
+    const uint64_t start = trace_begin();
+    struct trampoline *const tr = alloc_(NULL, sizeof *tr, t->n_labels, ALLOC_TABLE);
+    /* References found by resolve_graph(), SIZE_MAX for roots. */
+    size_t *const refs = alloc_(NULL, sizeof *refs, t->n_labels, ALLOC_TABLE);
+    size_t *const retargeted = alloc_(NULL, sizeof *retargeted, t->n_labels, ALLOC_TABLE);
+    size_t n_bypassed = 0;
+    int ret = 0;
+
+    c->trampolines = tr;
+
+    if (!tr || !refs || !retargeted)
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        tr[i] = (struct trampoline){.target = SIZE_MAX};
+        refs[i] = retargeted[i] = 0;
+    }
+
+    /* Trampolines are only looked for within assembly text, and
+     * lines are indexed twice, as targets must be known first. */
+    for (size_t pass = 0; pass < 2 && !ret; pass++)
+    {
+        for (size_t i = 0; i < t->n_files && !ret; i++)
+        {
+            const char *const text = c->inputs[i].buf;
+            struct text_line *lines;
+            size_t n_lines;
+
+            if (!text)
+                continue;
+            else if (!(lines = index_lines(text, &n_lines)))
+                ret = ENOMEM;
+            else if (!pass)
+                find_jumps(c, i, lines, n_lines);
+            else
+                count_retargeted(c, i, lines, n_lines, retargeted);
+
+            alloc_free(lines);
+        }
+
+        if (!pass && !ret)
+            ret = follow_chains(c);
+    }
+
+    if (ret)
+        goto end;
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        const struct label *const l = t->labels[i];
+
+        for (size_t j = 0; j < l->n_callees; j++)
+        {
+            refs[l->callees[j]]++;
+        }
+    }
+
+    /* References from outside any label are never retargeted. */
+    for (size_t i = 0; i < t->n_roots; i++)
+    {
+        refs[t->roots[i]] = SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        const struct label *const l = t->labels[i];
+
+        if (tr[i].target != SIZE_MAX)
+        {
+            tr[i].bypass = refs[i] == retargeted[i];
+            n_bypassed += tr[i].bypass;
+            LOG(c, SDCCRM_LOG_DEBUG, t->files[l->file].name, l->name, "trampoline to %s%s",
+                t->labels[tr[i].target]->name, tr[i].bypass ? ", bypassed" : "");
+        }
+    }
+
+end:
+    alloc_free(refs);
+    alloc_free(retargeted);
+
+    if (ret)
+    {
+        alloc_free(tr);
+        c->trampolines = NULL;
+    }
+
+    trace_end(start, "trampolines", &(const struct trace_args)
+        {
+            .labels = t->n_labels,
+            .removed = n_bypassed
+        });
+
+    return ret;
+}
+
+static void find_jumps(struct sdccrm *const c, const size_t file, const struct text_line *const lines,
+    const size_t n_lines)
+{
+    const struct file *const f = &c->tree.files[file];
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        const struct label *const l = &f->labels[i];
+        char line[MAX_CH_PER_LINE];
+        struct line_info li;
+        bool call;
+
+        /* e.g.: "_f:" followed by "jp _g" and nothing else. */
+        if (l->interrupt || l->n_calls != 1 || l->n_callees != 1 || l->callees[0] == l->id
+            || l->start_line >= n_lines || label_end(l, n_lines) != l->start_line + 1)
+            continue;
+
+        const size_t len = copy_line(&lines[l->start_line], line);
+
+        classify(c->port, line, len + 1, &li);
+
+        const struct tail *const tail = li.kind == LINE_CALL ? find_tail(c->port, line, &call) : NULL;
+
+        if (tail && !call && !strcmp(li.operand, l->calls[0]) && ends_block(c->port, line))
+            c->trampolines[l->id] = (struct trampoline){.target = l->callees[0], .tail = tail};
+    }
+}
+
+static int follow_chains(struct sdccrm *const c)
+{
+    const size_t n = c->tree.n_labels;
+    struct trampoline *const tr = c->trampolines;
+    size_t *const final = alloc_(NULL, sizeof *final, n, ALLOC_TABLE);
+
+    if (!final)
+        return ENOMEM;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t target = tr[i].target, steps = 0;
+
+        /* Only through jumps of the same reach. A chain longer than
+         * the number of labels runs in circles, so it is left alone. */
+        while (target != SIZE_MAX && steps < n && tr[target].target != SIZE_MAX && tr[target].tail == tr[i].tail)
+        {
+            target = tr[target].target;
+            steps++;
+        }
+
+        final[i] = steps < n ? target : SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        tr[i].target = final[i];
+
+        if (final[i] == SIZE_MAX)
+            tr[i].tail = NULL;
+    }
+
+    alloc_free(final);
+
+    return 0;
+}
+
+static void count_retargeted(const struct sdccrm *const c, const size_t file, const struct text_line *const lines,
+    const size_t n_lines, size_t *const retargeted)
+{
+    const struct file *const f = &c->tree.files[file];
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        const struct label *const l = &f->labels[i];
+        const size_t end = label_end(l, n_lines);
+
+        /* Same lines parse() takes references from. */
+        for (size_t ln = l->start_line + 1; ln <= end; ln++)
+        {
+            char line[MAX_CH_PER_LINE];
+            const char *operand;
+            const size_t len = copy_line(&lines[ln - 1], line);
+
+            if (!strncmp(line, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)))
+                break;
+
+            const size_t id = retarget(c, file, line, len, &operand);
+
+            if (id != SIZE_MAX)
+                retargeted[id]++;
+        }
+    }
+}
+
+static size_t retarget(const struct sdccrm *const c, const size_t file, const char *const line, const size_t len,
+    const char **const operand)
+{
+    const struct tree *const t = &c->tree;
+    struct line_info li;
+    bool call;
+
+    classify(c->port, line, len + 1, &li);
+
+    const struct tail *const tail = li.kind == LINE_CALL ? find_tail(c->port, line, &call) : NULL;
+
+    if (!tail)
+        return SIZE_MAX;
+
+    const size_t id = resolve_label(t, file, li.operand);
+
+    if (id == SIZE_MAX || c->trampolines[id].target == SIZE_MAX || c->trampolines[id].tail != tail)
+        return SIZE_MAX;
+
+    const size_t target = c->trampolines[id].target;
+    const char *const name = t->labels[target]->name;
+
+    /* Targets must be visible from this file by name, e.g.: not
+     * static labels from other files, and fit into a line. */
+    if (resolve_label(t, file, name) != target || (size_t)(li.operand - line) + strlen(name) >= MAX_CH_PER_LINE)
+        return SIZE_MAX;
+
+    *operand = li.operand;
+
+    return id;
+}
+
+static bool is_ret(const char *const line, const struct tail *const tail)
+{
+    /* e.g.: "ret", but not "ret nz". */
+    const size_t n = strlen(tail->ret);
+    const char *p = line + n;
+
+    if (strncmp(line, tail->ret, n) || (*p && !is_space(*p)))
+        return false;
+
+    while (is_space(*p))
+    {
+        p++;
+    }
+
+    return !*p || *p == ';';
+}
+
+int plan_peephole(const struct sdccrm *const c, const size_t file, const char *const text, struct plan *const p)
+{
+    const struct tree *const t = &c->tree;
+    size_t n_lines, n_tails = 0, n_retargeted = 0;
+    struct text_line *const lines = index_lines(text, &n_lines);
+    int ret = lines ? 0 : ENOMEM;
+
+    for (size_t ln = 1; ln <= n_lines && !ret; ln++)
+    {
+        char line[MAX_CH_PER_LINE], next[MAX_CH_PER_LINE], edit[2 * MAX_CH_PER_LINE];
+        const size_t len = copy_line(&lines[ln - 1], line);
+        const char *operand;
+        const size_t id = retarget(c, file, line, len, &operand);
+        const struct tail *tail;
+        bool call, edited = false;
+
+        if (id != SIZE_MAX)
+        {
+            snprintf(edit, sizeof edit, "%.*s%s", (int)(operand - line), line,
+                t->labels[c->trampolines[id].target]->name);
+            n_retargeted++;
+            edited = true;
+        }
+        else
+        {
+            strcpy(edit, line);
+        }
+
+        if ((tail = find_tail(c->port, edit, &call)) && call && !strchr(edit, ',') && ln < n_lines)
+        {
+            copy_line(&lines[ln], next);
+
+            if (is_ret(next, tail))
+            {
+                char jump[sizeof edit];
+
+                /* Same operands, e.g.: "call _f" into "jp _f". */
+                snprintf(jump, sizeof jump, "%s%s", tail->jump, edit + strlen(tail->call));
+                strcpy(edit, jump);
+
+                if (!(p->spans = alloc(p->spans, p->n_spans, ALLOC_TABLE)))
+                {
+                    p->n_spans = 0;
+                    ret = ENOMEM;
+                    break;
+                }
+
+                p->spans[p->n_spans++] = (struct span){.start = ln + 1, .end = ln + 1};
+                n_tails++;
+                edited = true;
+            }
+        }
+
+        if (edited)
+            ret = add_edit(p, ln, edit);
+    }
+
+    if (n_tails || n_retargeted)
+    {
+        LOG(c, SDCCRM_LOG_INFO, t->files[file].name, NULL, "%zu tail calls and %zu calls to trampolines rewritten",
+            n_tails, n_retargeted);
+    }
+
+    alloc_free(lines);
+
+    return ret;
+}
@@ -0,0 +1,1631 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Reference engine: inputs are parsed serially, line by line, by
+ * get_global(), is_label(), is_call(), get_call() and get_ref(),
+ * labels are marked by looking their names up on every reference,
+ * and outputs are written from copies of every line using
+ * get_line(). Neither the line classifier, the chunked tokenizer,
+ * the resolved label graph nor plan based filtering are used, so
+ * they can be checked against it, while stack effects and size
+ * estimates come from the same tables. Those helpers only know
+ * stm8 syntax, so lines are classified by classify() on any other
+ * port. Speed is not a goal, only being obvious. */
+
+#include "reference.h"
+#include "function_list.h"
+#include "references.h"
+#include "layout.h"
+#include "classify.h"
+#include "alloc.h"
+#include "common.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Identifies a label by its file and index within it. */
+struct label_ref
+{
+    const char *name;
+    size_t file;
+    size_t label;
+};
+
+/* Label whose only line is a jump to another label. */
+struct jump
+{
+    /* Final target, or NULL if not a trampoline. */
+    const struct label_ref *target;
+    const struct tail *tail;
+    /* Every reference to it is retargeted. */
+    bool bypass;
+};
+
+struct engine
+{
+    /* Parallel to c->tree.files. Files without assembly text,
+     * e.g.: from object files or summaries, are shared with c. */
+    struct file *files;
+    bool *parsed;
+    size_t n_files;
+    /* used[file][label]. */
+    bool **used;
+    /* Every label, sorted by name, then file order. */
+    struct label_ref *names;
+    size_t n_names;
+    /* Labels marked, but whose references are not marked yet. */
+    struct label_ref *pending;
+    size_t n_pending;
+    /* jumps[file][label], only with c->peephole. */
+    struct jump **jumps;
+};
+
+/* Worst stack depth found when branching to a local label. */
+struct local_depth
+{
+    unsigned long label;
+    size_t depth;
+};
+
+/* Label defined by a module an output is split into. */
+struct definition
+{
+    const char *name;
+    size_t module;
+};
+
+static int load(const struct sdccrm *c, struct engine *e);
+static int parse_file(const struct sdccrm *c, const struct input *in, struct file *f);
+static void classify_line(const struct sdccrm *c, const char *line, size_t len, struct line_info *li);
+static int add_name(char ***names, size_t *n, const char *name, size_t len);
+static int add_call(struct label *l, const char *name, size_t len, size_t depth);
+static bool is_instruction(const struct sdccrm *c, const char *line, size_t len);
+static size_t find_locals(const char *line, unsigned long *labels);
+static bool is_local_def(const char *line, size_t len);
+static void unload(struct engine *e);
+static void find_used(const struct sdccrm *c, const struct config *cfg, struct engine *e);
+static void mark_name(struct engine *e, size_t from, const char *name);
+static const struct label_ref *find_first(const struct engine *e, const char *name);
+static const struct label_ref *find_visible(const struct engine *e, size_t from, const char *name);
+static const char **index_text(const char *p, size_t *n_lines);
+static int load_jumps(const struct sdccrm *c, struct engine *e);
+static const struct label_ref *retarget(const struct sdccrm *c, const struct engine *e, size_t file,
+    const char *line, size_t len, const char **operand);
+static bool rewrite(const struct sdccrm *c, const struct engine *e, size_t file, const char *const *lines,
+    size_t n_lines, size_t line_no, char *text, bool *tail_call);
+static size_t write_output(const struct sdccrm *c, const struct config *cfg, const struct engine *e, size_t file,
+    const char *p, struct strbuf *out);
+static size_t find_window(const struct sdccrm *c, const struct config *cfg, size_t file, const struct label *l);
+static void write_area(struct strbuf *out, const char *area, size_t window);
+static int remove_unreachable(const struct sdccrm *c, const char *const *lines, size_t start, size_t end,
+    bool *removed);
+static bool compare_files(const struct file *fast, const struct file *ref, FILE *f);
+static size_t compare_used(const struct sdccrm *c, const struct config *cfg, const struct engine *e, size_t file, FILE *f);
+static bool compare_output(const struct sdccrm *c, const struct config *cfg, const struct engine *e, size_t file,
+    const char *text, const struct sdccrm_result *r, FILE *f);
+static bool compare_parts(const struct config *cfg, const char *text, const struct sdccrm_result *r, FILE *f);
+static bool check_statics(const struct config *cfg, const char *text, const struct sdccrm_result *r, FILE *f);
+static size_t append_body(const char *p, struct strbuf *b);
+static const char **index_strings(const struct strbuf *b, size_t n);
+static void report(FILE *f, const char *file, const struct config *cfg, const char *fmt, ...);
+
+int verify_engines(const struct sdccrm *const c, struct config *const configs, const size_t n_configs, FILE *const f,
+    size_t *const n_diff)
+{
+    struct engine e = {0};
+    bool *same = NULL;
+    int ret = load(c, &e);
+
+    *n_diff = 0;
+
+    if (!ret && !(same = alloc_(NULL, sizeof *same, e.n_files, ALLOC_TABLE)))
+        ret = ENOMEM;
+
+    for (size_t i = 0; i < e.n_files && !ret; i++)
+    {
+        same[i] = compare_files(&c->tree.files[i], &e.files[i], f);
+
+        if (!same[i])
+            ++*n_diff;
+    }
+
+    for (size_t i = 0; i < n_configs && !ret; i++)
+    {
+        struct config *const cfg = &configs[i];
+
+        if (!(cfg->used = alloc_(NULL, sizeof *cfg->used, c->tree.n_labels, ALLOC_TABLE)))
+        {
+            ret = ENOMEM;
+            break;
+        }
+
+        memset(cfg->used, 0, c->tree.n_labels * sizeof *cfg->used);
+
+        if (!(ret = find_references(c, cfg)) && !(c->window && (ret = place_labels(c, cfg))))
+        {
+            find_used(c, cfg, &e);
+
+            for (size_t j = 0; j < e.n_files; j++)
+            {
+                const struct input *const in = &c->inputs[j];
+
+                /* Label indices only match if both parsed the same. */
+                if (same[j])
+                    *n_diff += compare_used(c, cfg, &e, j, f);
+
+                if (in->buf && !compare_output(c, cfg, &e, j, in->buf, &c->results[i * e.n_files + j], f))
+                    ++*n_diff;
+            }
+        }
+
+        alloc_free(cfg->used);
+        alloc_free(cfg->windows);
+        cfg->used = NULL;
+        cfg->windows = NULL;
+    }
+
+    alloc_free(same);
+    unload(&e);
+
+    return ret;
+}
+
+static int compare_refs(const void *const a, const void *const b)
+{
+    const struct label_ref *const ra = a, *const rb = b;
+    const int cmp = strcmp(ra->name, rb->name);
+
+    if (cmp)
+        return cmp;
+    else if (ra->file != rb->file)
+        return ra->file < rb->file ? -1 : 1;
+
+    return (ra->label > rb->label) - (ra->label < rb->label);
+}
+
+static int load(const struct sdccrm *const c, struct engine *const e)
+{
+    const size_t n = c->tree.n_files;
+
+    e->n_files = n;
+    e->files = alloc_(NULL, sizeof *e->files, n, ALLOC_TABLE);
+    e->parsed = alloc_(NULL, sizeof *e->parsed, n, ALLOC_TABLE);
+    e->used = alloc_(NULL, sizeof *e->used, n, ALLOC_TABLE);
+
+    if (!e->files || !e->parsed || !e->used)
+    {
+        e->n_files = 0;
+        unload(e);
+        return ENOMEM;
+    }
+
+    memset(e->used, 0, n * sizeof *e->used);
+    memset(e->parsed, 0, n * sizeof *e->parsed);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct input *const in = &c->inputs[i];
+
+        if ((e->parsed[i] = in->buf != NULL))
+        {
+            const int ret = parse_file(c, in, &e->files[i]);
+
+            if (ret)
+            {
+                /* Files not parsed yet are not released. */
+                e->n_files = i + 1;
+                unload(e);
+                return ret;
+            }
+        }
+        else
+            e->files[i] = c->tree.files[i];
+
+        e->n_names += e->files[i].n_labels;
+    }
+
+    e->names = alloc_(NULL, sizeof *e->names, e->n_names, ALLOC_TABLE);
+    e->pending = alloc_(NULL, sizeof *e->pending, e->n_names, ALLOC_TABLE);
+
+    if (!e->names || !e->pending)
+    {
+        unload(e);
+        return ENOMEM;
+    }
+
+    e->n_names = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct file *const f = &e->files[i];
+
+        if (!(e->used[i] = alloc_(NULL, sizeof **e->used, f->n_labels, ALLOC_TABLE)))
+        {
+            unload(e);
+            return ENOMEM;
+        }
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            e->names[e->n_names++] = (struct label_ref){.name = f->labels[j].name, .file = i, .label = j};
+        }
+    }
+
+    qsort(e->names, e->n_names, sizeof *e->names, compare_refs);
+
+    if (c->peephole && load_jumps(c, e))
+    {
+        unload(e);
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+static int parse_file(const struct sdccrm *const c, const struct input *const in, struct file *const f)
+{
+    const char *p = in->buf;
+    char line[MAX_CH_PER_LINE];
+    size_t len, line_no = 0, depth = 0;
+    /* Any label found before is only a symbol, e.g.: in DATA. */
+    bool code = false;
+    /* Lines from here until the next .area belong to the last label. */
+    bool in_label = false;
+    /* Last block of the label returned or jumped away. */
+    bool ended = false;
+    /* Local labels of the last label branched to so far. */
+    struct local_depth *locals = NULL;
+    size_t n_locals = 0;
+    int ret = 0;
+
+    *f = (struct file){.name = in->name};
+
+    while (!ret && (p = get_line(p, line, &len)))
+    {
+        struct line_info li;
+
+        line_no++;
+        classify_line(c, line, len, &li);
+
+        /* A label ends right before the next label or .area,
+         * but always takes the line following it. */
+        if (li.kind == LINE_LABEL || li.area)
+        {
+            for (size_t i = f->n_labels; i-- && !f->labels[i].end_line; )
+            {
+                if (f->labels[i].start_line + 1 < line_no)
+                    f->labels[i].end_line = line_no - 1;
+            }
+
+            if (li.area)
+                in_label = false;
+        }
+
+        struct label *const l = in_label ? &f->labels[f->n_labels - 1] : NULL;
+
+        if (li.kind == LINE_GLOBAL)
+        {
+            ret = add_name(&f->globals, &f->n_globals, li.operand, li.operand_len);
+        }
+        else if (li.kind == LINE_DATA)
+        {
+            /* e.g.: ".dw _f, _g", referenced by the label holding
+             * the table, or by nothing at all, e.g.: vectors. */
+            for (const char *s = li.operand; !ret && *s; s++)
+            {
+                if (*s != '_' || (s > li.operand && (isalnum((unsigned char)s[-1]) || s[-1] == '_' || s[-1] == '$')))
+                    continue;
+
+                size_t n = 1;
+
+                while (isalnum((unsigned char)s[n]) || s[n] == '_' || s[n] == '$')
+                {
+                    n++;
+                }
+
+                ret = l ? add_call(l, s, n, 0) : add_name(&f->roots, &f->n_roots, s, n);
+                s += n - 1;
+            }
+
+            if (l)
+                l->size += estimate_size(line, &li);
+        }
+        else if (!l && (li.kind == LINE_CALL || li.kind == LINE_REF))
+        {
+            ret = add_name(&f->roots, &f->n_roots, li.operand, li.operand_len);
+        }
+        else if (!code)
+        {
+            code = li.kind == LINE_AREA_CODE;
+        }
+        else if (li.kind == LINE_LABEL)
+        {
+            struct label *const labels = alloc_grow(f->labels, f->n_labels, ALLOC_TABLE);
+            char *const name = alloc_buf(li.operand_len + 1, ALLOC_LABEL_NAME);
+
+            if (labels)
+                f->labels = labels;
+
+            if (!labels || !name)
+            {
+                alloc_free(name);
+                ret = ENOMEM;
+                break;
+            }
+
+            memcpy(name, li.operand, li.operand_len);
+            name[li.operand_len] = '\0';
+            f->labels[f->n_labels] = (struct label){.name = name, .start_line = line_no};
+
+            for (size_t i = 0; i < f->n_globals; i++)
+            {
+                if (!strcmp(f->globals[i], name))
+                    f->labels[f->n_labels].global = true;
+            }
+
+            f->n_labels++;
+            in_label = true;
+            ended = false;
+            depth = 0;
+            n_locals = 0;
+        }
+        else if (l)
+        {
+            struct stack_effect se = {0};
+            unsigned long targets[MAX_CH_PER_LINE];
+            const bool instruction = is_instruction(c, line, len);
+            const size_t n_targets = instruction ? find_locals(line, targets) : 0;
+
+            l->size += estimate_size(line, &li);
+
+            /* A local label starts with the worst depth of any branch
+             * to it found so far, or of the block falling into it. */
+            if (is_local_def(line, len))
+            {
+                for (size_t i = 0; i < n_locals; i++)
+                {
+                    if (locals[i].label == strtoul(line, NULL, 10) && (ended || locals[i].depth > depth))
+                        depth = locals[i].depth;
+                }
+
+                ended = false;
+            }
+
+            if (stack_effect(c->port, line, &se))
+            {
+                if (se.delta < 0 && (size_t)-se.delta > depth)
+                    depth = 0;
+                else
+                    depth += se.delta;
+
+                if (depth > l->frame)
+                    l->frame = depth;
+
+                if (se.iret)
+                    l->interrupt = true;
+            }
+
+            /* Jumps push no return address, while references
+             * might be called from around here. */
+            if (li.operand_len && li.kind == LINE_CALL)
+                ret = add_call(l, li.operand, li.operand_len, depth + se.call);
+            else if (li.operand_len && li.kind == LINE_REF)
+                ret = add_call(l, li.operand, li.operand_len, depth + 2);
+
+            /* Only the first local label is taken as the target. */
+            if (n_targets)
+            {
+                size_t i = 0;
+
+                while (i < n_locals && locals[i].label != targets[0])
+                {
+                    i++;
+                }
+
+                if (i == n_locals)
+                {
+                    struct local_depth *const grown = alloc_grow(locals, n_locals, ALLOC_TABLE);
+
+                    if (!grown)
+                    {
+                        ret = ENOMEM;
+                        break;
+                    }
+
+                    locals = grown;
+                    locals[n_locals++] = (struct local_depth){.label = targets[0], .depth = depth};
+                }
+                else if (depth > locals[i].depth)
+                {
+                    locals[i].depth = depth;
+                }
+            }
+
+            if (instruction && ends_block(c->port, line))
+                ended = true;
+        }
+    }
+
+    alloc_free(locals);
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        if (!f->labels[i].end_line)
+            f->labels[i].end_line = line_no;
+    }
+
+    return ret;
+}
+
+static void classify_line(const struct sdccrm *const c, const char *const line, const size_t len,
+    struct line_info *const li)
+{
+    static const char *const jumps[] = {"jp", "jpf", "jra"};
+    static const char *const data[] = {".dw", ".word", ".db", ".byte", ".3byte", "int"};
+    const char *operand;
+
+    if (strcmp(port_name(c->port), "stm8"))
+    {
+        classify(c->port, line, len, li);
+        return;
+    }
+
+    *li = (struct line_info){.kind = LINE_OTHER, .area = strstr(line, AREA_DIRECTIVE) != NULL};
+
+    if ((operand = get_global(line)))
+    {
+        *li = (struct line_info){.kind = LINE_GLOBAL, .operand = operand, .area = li->area};
+    }
+    else if (!strncmp(line, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)))
+    {
+        char directive[sizeof AREA_DIRECTIVE], area[MAX_CH_PER_LINE];
+
+        if (sscanf(line, "%5s %127s", directive, area) == 2 && !strcmp(directive, AREA_DIRECTIVE)
+            && !strcmp(area, "CODE"))
+            li->kind = LINE_AREA_CODE;
+
+        return;
+    }
+    else if (is_label(line, len))
+    {
+        li->kind = LINE_LABEL;
+        li->operand = line;
+        li->operand_len = len - 2;
+        return;
+    }
+    else if (is_call(line) && strpbrk(line, " \t"))
+    {
+        li->kind = LINE_CALL;
+        li->operand = get_call(line);
+    }
+
+    for (size_t i = 0; li->kind == LINE_OTHER && i < lengthof (jumps); i++)
+    {
+        const size_t n = strlen(jumps[i]);
+
+        /* Only jumps to other labels, e.g.: tail calls. */
+        if (!strncmp(line, jumps[i], n) && isspace((unsigned char)line[n]) && line[n + 1] == '_')
+        {
+            li->kind = LINE_CALL;
+            li->operand = line + n + 1;
+        }
+    }
+
+    for (size_t i = 0; li->kind == LINE_OTHER && i < lengthof (data); i++)
+    {
+        const size_t n = strlen(data[i]);
+
+        if (!strncmp(line, data[i], n) && isspace((unsigned char)line[n]) && strchr(line + n + 1, '_'))
+        {
+            li->kind = LINE_DATA;
+            li->operand = line + n + 1;
+        }
+    }
+
+    if (li->kind == LINE_OTHER && (operand = get_ref(line)))
+    {
+        li->kind = LINE_REF;
+        li->operand = operand;
+    }
+
+    if (li->operand)
+        li->operand_len = strlen(li->operand);
+}
+
+static int add_name(char ***const names, size_t *const n, const char *const name, const size_t len)
+{
+    char **const list = alloc_grow(*names, *n, ALLOC_TABLE);
+    char *const s = alloc_buf(len + 1, ALLOC_LABEL_NAME);
+
+    if (list)
+        *names = list;
+
+    if (!list || !s)
+    {
+        alloc_free(s);
+        return ENOMEM;
+    }
+
+    memcpy(s, name, len);
+    s[len] = '\0';
+    (*names)[(*n)++] = s;
+    return 0;
+}
+
+static int add_call(struct label *const l, const char *const name, const size_t len, const size_t depth)
+{
+    size_t *const depths = alloc_grow(l->call_depths, l->n_calls, ALLOC_CALL_LIST);
+
+    if (depths)
+        l->call_depths = depths;
+
+    if (!depths)
+        return ENOMEM;
+
+    depths[l->n_calls] = depth;
+    return add_name(&l->calls, &l->n_calls, name, len);
+}
+
+static void unload(struct engine *const e)
+{
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        if (e->parsed[i])
+            free_file(&e->files[i]);
+
+        alloc_free(e->used[i]);
+
+        if (e->jumps)
+            alloc_free(e->jumps[i]);
+    }
+
+    alloc_free(e->jumps);
+
+    alloc_free(e->files);
+    alloc_free(e->parsed);
+    alloc_free(e->used);
+    alloc_free(e->names);
+    alloc_free(e->pending);
+    *e = (struct engine){0};
+}
+
+static void find_used(const struct sdccrm *const c, const struct config *const cfg, struct engine *const e)
+{
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        memset(e->used[i], 0, e->files[i].n_labels * sizeof *e->used[i]);
+    }
+
+    e->n_pending = 0;
+
+    /* Excluded labels include the entry label. */
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        const struct file *const f = &e->files[i];
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            if (is_label_excluded(c, cfg, &f->labels[j]))
+            {
+                e->used[i][j] = true;
+                e->pending[e->n_pending++] = (struct label_ref){.file = i, .label = j};
+            }
+        }
+    }
+
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        const struct file *const f = &e->files[i];
+
+        for (size_t j = 0; j < f->n_roots; j++)
+        {
+            mark_name(e, i, f->roots[j]);
+        }
+    }
+
+    while (e->n_pending)
+    {
+        const struct label_ref r = e->pending[--e->n_pending];
+        const struct label *const l = &e->files[r.file].labels[r.label];
+
+        for (size_t i = 0; i < l->n_calls; i++)
+        {
+            mark_name(e, r.file, l->calls[i]);
+        }
+    }
+}
+
+static void mark_name(struct engine *const e, const size_t from, const char *const name)
+{
+    const struct label_ref *const end = e->names + e->n_names;
+
+    for (const struct label_ref *r = find_first(e, name); r && r < end && !strcmp(r->name, name); r++)
+    {
+        /* Static labels are only visible from the same file. */
+        if (e->files[r->file].labels[r->label].global || r->file == from)
+        {
+            const struct jump *const j = e->jumps ? &e->jumps[r->file][r->label] : NULL;
+            /* Bypassed trampolines are never called. */
+            const struct label_ref *const m = j && j->bypass ? j->target : r;
+
+            if (!e->used[m->file][m->label])
+            {
+                e->used[m->file][m->label] = true;
+                e->pending[e->n_pending++] = *m;
+            }
+        }
+    }
+}
+
+static int compare_key(const void *const key, const void *const r)
+{
+    return strcmp(key, ((const struct label_ref *)r)->name);
+}
+
+static const struct label_ref *find_first(const struct engine *const e, const char *const name)
+{
+    const struct label_ref *r = bsearch(name, e->names, e->n_names, sizeof *e->names, compare_key);
+
+    while (r && r > e->names && !strcmp(r[-1].name, name))
+    {
+        r--;
+    }
+
+    return r;
+}
+
+/* The only label with that name visible from a file, if any. */
+static const struct label_ref *find_visible(const struct engine *const e, const size_t from, const char *const name)
+{
+    const struct label_ref *const end = e->names + e->n_names, *found = NULL;
+
+    for (const struct label_ref *r = find_first(e, name); r && r < end && !strcmp(r->name, name); r++)
+    {
+        if (e->files[r->file].labels[r->label].global || r->file == from)
+        {
+            if (found)
+                return NULL;
+
+            found = r;
+        }
+    }
+
+    return found;
+}
+
+/* Indexed by line number, starting from 1: lines[i] is where
+ * get_line() finds line i from. */
+static const char **index_text(const char *const p, size_t *const n_lines)
+{
+    char line[MAX_CH_PER_LINE];
+    size_t len;
+    const char **lines;
+
+    *n_lines = 0;
+
+    for (const char *q = p; (q = get_line(q, line, &len)); )
+    {
+        ++*n_lines;
+    }
+
+    if (!(lines = alloc_(NULL, sizeof *lines, *n_lines + 1, ALLOC_TABLE)))
+        return NULL;
+
+    lines[1] = p;
+
+    for (size_t i = 1; i < *n_lines; i++)
+    {
+        lines[i + 1] = get_line(lines[i], line, &len);
+    }
+
+    return lines;
+}
+
+static int load_jumps(const struct sdccrm *const c, struct engine *const e)
+{
+    const struct label_ref **final = alloc_(NULL, sizeof *final, e->n_names, ALLOC_TABLE);
+    size_t *refs = alloc_(NULL, sizeof *refs, e->n_names, ALLOC_TABLE);
+    size_t *retargeted = alloc_(NULL, sizeof *retargeted, e->n_names, ALLOC_TABLE);
+    bool *root = alloc_(NULL, sizeof *root, e->n_names, ALLOC_TABLE);
+    int ret = 0;
+
+    if (!final || !refs || !retargeted || !root
+        || !(e->jumps = alloc_(NULL, sizeof *e->jumps, e->n_files, ALLOC_TABLE)))
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    memset(e->jumps, 0, e->n_files * sizeof *e->jumps);
+
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        const struct file *const f = &e->files[i];
+
+        if (!(e->jumps[i] = alloc_(NULL, sizeof **e->jumps, f->n_labels, ALLOC_TABLE)))
+        {
+            ret = ENOMEM;
+            goto end;
+        }
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            e->jumps[i][j] = (struct jump){0};
+        }
+    }
+
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        const struct file *const f = &e->files[i];
+        size_t n_lines;
+        const char **lines;
+
+        if (!e->parsed[i])
+            continue;
+        else if (!(lines = index_text(c->inputs[i].buf, &n_lines)))
+        {
+            ret = ENOMEM;
+            goto end;
+        }
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            const struct label *const l = &f->labels[j];
+            const size_t last = label_end(l, n_lines);
+            char line[MAX_CH_PER_LINE];
+            struct line_info li;
+            size_t len;
+            bool call;
+
+            /* A single jump, and nothing else, after the label. */
+            if (l->interrupt || l->n_calls != 1 || l->start_line >= n_lines || last != l->start_line + 1)
+                continue;
+
+            get_line(lines[l->start_line + 1], line, &len);
+            classify(c->port, line, len, &li);
+
+            const struct tail *const tail = li.kind == LINE_CALL ? find_tail(c->port, line, &call) : NULL;
+            const struct label_ref *const target = find_visible(e, i, l->calls[0]);
+
+            if (tail && !call && !strcmp(li.operand, l->calls[0]) && ends_block(c->port, line) && target
+                && (target->file != i || target->label != j))
+            {
+                e->jumps[i][j] = (struct jump){.target = target, .tail = tail};
+            }
+        }
+
+        alloc_free(lines);
+    }
+
+    /* Chains are followed through jumps of the same reach. Those
+     * longer than the number of labels run in circles. */
+    for (size_t i = 0; i < e->n_names; i++)
+    {
+        const struct jump *const j = &e->jumps[e->names[i].file][e->names[i].label];
+        const struct label_ref *target = j->target;
+        size_t steps = 0;
+
+        for (; target && steps < e->n_names; steps++)
+        {
+            const struct jump *const next = &e->jumps[target->file][target->label];
+
+            if (!next->target || next->tail != j->tail)
+                break;
+
+            target = next->target;
+        }
+
+        final[i] = steps < e->n_names ? target : NULL;
+    }
+
+    for (size_t i = 0; i < e->n_names; i++)
+    {
+        struct jump *const j = &e->jumps[e->names[i].file][e->names[i].label];
+
+        if (!(j->target = final[i]))
+            j->tail = NULL;
+
+        refs[i] = retargeted[i] = 0;
+        root[i] = false;
+    }
+
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        const struct file *const f = &e->files[i];
+        const struct label_ref *const end = e->names + e->n_names;
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            const struct label *const l = &f->labels[j];
+
+            for (size_t k = 0; k < l->n_calls; k++)
+            {
+                for (const struct label_ref *r = find_first(e, l->calls[k]); r && r < end
+                    && !strcmp(r->name, l->calls[k]); r++)
+                {
+                    if (e->files[r->file].labels[r->label].global || r->file == i)
+                        refs[r - e->names]++;
+                }
+            }
+        }
+
+        for (size_t j = 0; j < f->n_roots; j++)
+        {
+            for (const struct label_ref *r = find_first(e, f->roots[j]); r && r < end
+                && !strcmp(r->name, f->roots[j]); r++)
+            {
+                if (e->files[r->file].labels[r->label].global || r->file == i)
+                    root[r - e->names] = true;
+            }
+        }
+    }
+
+    /* References to be retargeted, from the same lines labels
+     * take their references from. */
+    for (size_t i = 0; i < e->n_files; i++)
+    {
+        const struct file *const f = &e->files[i];
+        size_t n_lines;
+        const char **lines;
+
+        if (!e->parsed[i])
+            continue;
+        else if (!(lines = index_text(c->inputs[i].buf, &n_lines)))
+        {
+            ret = ENOMEM;
+            goto end;
+        }
+
+        for (size_t j = 0; j < f->n_labels; j++)
+        {
+            const struct label *const l = &f->labels[j];
+            const size_t last = label_end(l, n_lines);
+
+            for (size_t ln = l->start_line + 1; ln <= last; ln++)
+            {
+                char line[MAX_CH_PER_LINE];
+                const char *operand;
+                size_t len;
+
+                get_line(lines[ln], line, &len);
+
+                if (!strncmp(line, ".area", strlen(".area")))
+                    break;
+
+                const struct label_ref *const r = retarget(c, e, i, line, len, &operand);
+
+                if (r)
+                    retargeted[r - e->names]++;
+            }
+        }
+
+        alloc_free(lines);
+    }
+
+    for (size_t i = 0; i < e->n_names; i++)
+    {
+        struct jump *const j = &e->jumps[e->names[i].file][e->names[i].label];
+
+        j->bypass = j->target && !root[i] && refs[i] == retargeted[i];
+    }
+
+end:
+    alloc_free(final);
+    alloc_free(refs);
+    alloc_free(retargeted);
+    alloc_free(root);
+
+    return ret;
+}
+
+/* Trampoline the jump or call in line goes to, if it can go to
+ * its final target instead, which is then at operand. */
+static const struct label_ref *retarget(const struct sdccrm *const c, const struct engine *const e,
+    const size_t file, const char *const line, const size_t len, const char **const operand)
+{
+    struct line_info li;
+    bool call;
+
+    classify(c->port, line, len, &li);
+
+    const struct tail *const tail = li.kind == LINE_CALL ? find_tail(c->port, line, &call) : NULL;
+    const struct label_ref *const r = tail ? find_visible(e, file, li.operand) : NULL;
+
+    if (!r)
+        return NULL;
+
+    const struct jump *const j = &e->jumps[r->file][r->label];
+
+    if (!j->target || j->tail != tail || find_visible(e, file, j->target->name) != j->target
+        || strlen(line) - strlen(li.operand) + strlen(j->target->name) >= MAX_CH_PER_LINE)
+        return NULL;
+
+    *operand = li.operand;
+
+    return r;
+}
+
+/* Copies line_no into text, which holds 2 * MAX_CH_PER_LINE, as
+ * written by the peephole stage. Returns whether it was changed,
+ * and tail_call if the line after is to be removed. */
+static bool rewrite(const struct sdccrm *const c, const struct engine *const e, const size_t file,
+    const char *const *const lines, const size_t n_lines, const size_t line_no, char *const text,
+    bool *const tail_call)
+{
+    char line[MAX_CH_PER_LINE];
+    const char *operand;
+    size_t len;
+    bool changed = false, call;
+
+    get_line(lines[line_no], line, &len);
+    strcpy(text, line);
+    *tail_call = false;
+
+    const struct label_ref *const r = retarget(c, e, file, line, len, &operand);
+
+    if (r)
+    {
+        strcpy(&text[operand - line], e->jumps[r->file][r->label].target->name);
+        changed = true;
+    }
+
+    const struct tail *const tail = find_tail(c->port, text, &call);
+
+    if (tail && call && !strchr(text, ',') && line_no < n_lines)
+    {
+        const size_t n = strlen(tail->ret);
+        const char *p;
+
+        get_line(lines[line_no + 1], line, &len);
+        p = &line[n];
+
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        /* e.g.: "ret" or "ret ; comment", but not "ret nz". */
+        if (!strncmp(line, tail->ret, n) && (!line[n] || line[n] == ' ' || line[n] == '\t') && (!*p || *p == ';'))
+        {
+            char jump[2 * MAX_CH_PER_LINE];
+
+            snprintf(jump, sizeof jump, "%s%s", tail->jump, &text[strlen(tail->call)]);
+            strcpy(text, jump);
+            changed = *tail_call = true;
+        }
+    }
+
+    return changed;
+}
+
+static size_t write_output(const struct sdccrm *const c, const struct config *const cfg,
+    const struct engine *const e, const size_t file, const char *p, struct strbuf *const out)
+{
+    const struct file *const f = &e->files[file];
+    char line[MAX_CH_PER_LINE], text[2 * MAX_CH_PER_LINE], area[MAX_CH_PER_LINE] = "";
+    /* Window the last .area directive written stands for. */
+    size_t len, n_lines, changed = 0, label = 0, in_effect = 0;
+    bool *removed = NULL, tail_call = false;
+    const char **const lines = index_text(p, &n_lines);
+
+    /* Indexed by line number, as lines. */
+    if (!lines || !(removed = alloc_(NULL, sizeof *removed, n_lines + 1, ALLOC_TABLE)))
+    {
+        alloc_free(lines);
+        return SIZE_MAX;
+    }
+
+    memset(removed, 0, (n_lines + 2) * sizeof *removed);
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        const struct label *const l = &f->labels[i];
+        const size_t end = label_end(l, n_lines);
+
+        for (size_t j = l->start_line; !e->used[file][i] && j <= end; j++)
+        {
+            removed[j] = true;
+        }
+
+        if (e->used[file][i] && c->remove_blocks && l->start_line <= n_lines
+            && remove_unreachable(c, lines, l->start_line, end, removed))
+        {
+            alloc_free(removed);
+            alloc_free(lines);
+            return SIZE_MAX;
+        }
+    }
+
+    for (size_t line_no = 1; (p = get_line(p, line, &len)); line_no++)
+    {
+        const char *const global = get_global(line);
+        /* The return after a call turned into a jump. */
+        bool drop = removed[line_no] || tail_call, edited = false, moved = false;
+
+        if (e->jumps)
+            edited = rewrite(c, e, file, lines, n_lines, line_no, text, &tail_call);
+
+        if (global)
+        {
+            /* Declarations are removed if the first label
+             * with that name is global and unused. */
+            const struct label_ref *const r = find_first(e, global);
+
+            if (r && e->files[r->file].labels[r->label].global && !e->used[r->file][r->label])
+                drop = true;
+        }
+
+        if (!strncmp(line, ".area", strlen(".area")))
+        {
+            strcpy(area, line);
+            in_effect = 0;
+        }
+
+        while (label < f->n_labels && f->labels[label].start_line < line_no)
+        {
+            label++;
+        }
+
+        if (!drop && label < f->n_labels && f->labels[label].start_line == line_no)
+        {
+            const size_t w = find_window(c, cfg, file, &f->labels[label]);
+
+            if (w != SIZE_MAX && w != in_effect)
+            {
+                write_area(out, area, w);
+                in_effect = w;
+                moved = true;
+            }
+        }
+
+        if (drop || edited || moved)
+            changed++;
+
+        if (drop)
+            continue;
+        else if (edited)
+            strbuf_append(out, text, strlen(text));
+        else
+            strbuf_append(out, line, len - 1);
+
+        strbuf_append(out, "\n", 1);
+    }
+
+    alloc_free(removed);
+    alloc_free(lines);
+
+    return changed;
+}
+
+/* Window label was placed into by place_labels(), found by the
+ * line it starts at, or SIZE_MAX. */
+static size_t find_window(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    const struct label *const l)
+{
+    const struct file *const f = &c->tree.files[file];
+
+    for (size_t i = 0; cfg->windows && i < f->n_labels; i++)
+    {
+        if (f->labels[i].start_line == l->start_line && !strcmp(f->labels[i].name, l->name))
+            return cfg->windows[f->labels[i].id];
+    }
+
+    return SIZE_MAX;
+}
+
+/* Writes area for the given window, e.g.: ".area CODE" becomes
+ * ".area CODE_2" for window 2. */
+static void write_area(struct strbuf *const out, const char *const area, const size_t window)
+{
+    char suffix[32];
+    const char *name = area + strlen(".area"), *end;
+
+    if (window)
+    {
+        name += strspn(name, " \t");
+        end = name + strcspn(name, " \t(");
+        snprintf(suffix, sizeof suffix, "_%zu", window);
+        strbuf_append(out, area, end - area);
+        strbuf_append(out, suffix, strlen(suffix));
+        strbuf_append(out, end, strlen(end));
+    }
+    else
+    {
+        strbuf_append(out, area, strlen(area));
+    }
+
+    strbuf_append(out, "\n", 1);
+}
+
+static bool is_instruction(const struct sdccrm *const c, const char *const line, const size_t len)
+{
+    struct line_info li;
+
+    if (!strchr("abcdefghijklmnopqrstuvwxyz", *line) || strchr(line, '='))
+        return false;
+
+    classify(c->port, line, len, &li);
+
+    return li.kind != LINE_DATA;
+}
+
+/* Local label numbers in line, e.g.: "jrne 00102$". Returns how
+ * many were stored into labels, which holds MAX_CH_PER_LINE. */
+static size_t find_locals(const char *const line, unsigned long *const labels)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; line[i]; i++)
+    {
+        if (line[i] == '$' && i && strchr("0123456789", line[i - 1]))
+        {
+            size_t j = i - 1;
+
+            while (j && strchr("0123456789", line[j - 1]))
+            {
+                j--;
+            }
+
+            /* Not part of another symbol, e.g.: "C$main.c$10$1_0$5". */
+            if (!j || !strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$.", line[j - 1]))
+                labels[n++] = strtoul(&line[j], NULL, 10);
+        }
+    }
+
+    return n;
+}
+
+static bool is_local_def(const char *const line, const size_t len)
+{
+    /* e.g.: "00102$:". len accounts for the null terminator. */
+    return len > 3 && strspn(line, "0123456789") == len - 3 && !strcmp(&line[len - 3], "$:");
+}
+
+static bool is_other_def(const char *const line)
+{
+    /* Any other label, e.g.: "loop:", might be reached from anywhere. */
+    const size_t n = strspn(line, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$.");
+
+    return n && line[n] == ':';
+}
+
+static int remove_unreachable(const struct sdccrm *const c, const char *const *const lines, const size_t start,
+    const size_t end, bool *const removed)
+{
+    char line[MAX_CH_PER_LINE];
+    unsigned long locals[MAX_CH_PER_LINE], *reached = NULL;
+    size_t len, n_reached = 0;
+    bool changed = true, *dead = alloc_(NULL, sizeof *dead, end - start, ALLOC_TABLE);
+
+    if (!dead)
+        return ENOMEM;
+
+    for (size_t ln = start; ln <= end; ln++)
+    {
+        get_line(lines[ln], line, &len);
+
+        /* Labels spanning several areas are left alone. */
+        if (!strncmp(line, ".area", strlen(".area")))
+        {
+            alloc_free(dead);
+            return 0;
+        }
+    }
+
+    /* Sweep every line until no more local labels are reached. */
+    while (changed)
+    {
+        bool live = true;
+
+        changed = false;
+
+        for (size_t ln = start; ln <= end; ln++)
+        {
+            get_line(lines[ln], line, &len);
+
+            if (ln > start && is_local_def(line, len))
+            {
+                find_locals(line, locals);
+
+                for (size_t i = 0; i < n_reached && !live; i++)
+                {
+                    live = reached[i] == locals[0];
+                }
+            }
+            else if (ln > start && is_other_def(line))
+            {
+                live = true;
+            }
+
+            dead[ln - start] = !live;
+
+            if (live || *line == '.')
+            {
+                const size_t n = find_locals(line, locals);
+
+                for (size_t i = 0; i < n; i++)
+                {
+                    bool found = false;
+
+                    for (size_t j = 0; j < n_reached && !found; j++)
+                    {
+                        found = reached[j] == locals[i];
+                    }
+
+                    if (!found)
+                    {
+                        if (!(reached = alloc(reached, n_reached, ALLOC_TABLE)))
+                        {
+                            alloc_free(dead);
+                            return ENOMEM;
+                        }
+
+                        reached[n_reached++] = locals[i];
+                        changed = true;
+                    }
+                }
+            }
+
+            if (live && is_instruction(c, line, len) && ends_block(c->port, line))
+                live = false;
+        }
+    }
+
+    for (size_t ln = start; ln <= end; ln++)
+    {
+        get_line(lines[ln], line, &len);
+
+        if (dead[ln - start] && (is_instruction(c, line, len) || (ln > start && is_local_def(line, len))))
+            removed[ln] = true;
+    }
+
+    alloc_free(reached);
+    alloc_free(dead);
+
+    return 0;
+}
+
+static bool compare_files(const struct file *const fast, const struct file *const ref, FILE *const f)
+{
+    const char *const name = ref->name;
+
+    if (fast->n_labels != ref->n_labels)
+    {
+        report(f, name, NULL, "%zu labels parsed, but %zu by the reference engine", fast->n_labels, ref->n_labels);
+        return false;
+    }
+
+    for (size_t i = 0; i < fast->n_labels; i++)
+    {
+        const struct label *const a = &fast->labels[i], *const b = &ref->labels[i];
+        bool same = !strcmp(a->name, b->name) && a->global == b->global
+            && a->start_line == b->start_line && a->end_line == b->end_line
+            && a->frame == b->frame && a->interrupt == b->interrupt
+            && a->size == b->size && a->n_calls == b->n_calls;
+
+        for (size_t j = 0; same && j < a->n_calls; j++)
+        {
+            same = !strcmp(a->calls[j], b->calls[j]) && a->call_depths[j] == b->call_depths[j];
+        }
+
+        if (!same)
+        {
+            report(f, name, NULL, "label %s (lines %zu-%zu, %zu calls) parsed as %s (lines %zu-%zu, %zu calls) "
+                "by the reference engine", a->name, a->start_line, a->end_line, a->n_calls,
+                b->name, b->start_line, b->end_line, b->n_calls);
+            return false;
+        }
+    }
+
+    bool same = fast->n_globals == ref->n_globals && fast->n_roots == ref->n_roots;
+
+    for (size_t i = 0; same && i < fast->n_globals; i++)
+    {
+        same = !strcmp(fast->globals[i], ref->globals[i]);
+    }
+
+    for (size_t i = 0; same && i < fast->n_roots; i++)
+    {
+        same = !strcmp(fast->roots[i], ref->roots[i]);
+    }
+
+    if (!same)
+    {
+        report(f, name, NULL, "%zu global declarations and %zu roots parsed, but %zu and %zu by the reference engine",
+            fast->n_globals, fast->n_roots, ref->n_globals, ref->n_roots);
+    }
+
+    return same;
+}
+
+static size_t compare_used(const struct sdccrm *const c, const struct config *const cfg, const struct engine *const e,
+    const size_t file, FILE *const f)
+{
+    const struct file *const fast = &c->tree.files[file];
+    size_t n = 0;
+
+    for (size_t i = 0; i < fast->n_labels; i++)
+    {
+        const bool used = cfg->used[fast->labels[i].id];
+
+        if (used != e->used[file][i])
+        {
+            report(f, fast->name, cfg, "label %s %s, but %s by the reference engine", fast->labels[i].name,
+                used ? "kept" : "removed", used ? "removed" : "kept");
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static bool compare_output(const struct sdccrm *const c, const struct config *const cfg, const struct engine *const e,
+    const size_t file, const char *const text, const struct sdccrm_result *const r, FILE *const f)
+{
+    struct strbuf out = {0};
+    const size_t changed = write_output(c, cfg, e, file, text, &out);
+    bool same = true;
+
+    if (changed == SIZE_MAX)
+    {
+        report(f, r->name, cfg, "could not write reference output");
+        same = false;
+    }
+    else if (r->unchanged)
+    {
+        /* Given as is, so only equivalent if nothing is changed. */
+        if (changed)
+        {
+            report(f, r->name, cfg, "kept unchanged, but %zu lines changed by the reference engine", changed);
+            same = false;
+        }
+    }
+    else if (r->output_len != out.len || (out.len && memcmp(r->output, out.data, out.len)))
+    {
+        size_t i = 0;
+
+        while (i < r->output_len && i < out.len && r->output[i] == out.data[i])
+        {
+            i++;
+        }
+
+        report(f, r->name, cfg, "output differs from the reference engine at byte %zu", i);
+        same = false;
+    }
+
+    if (same && r->n_parts)
+        same = compare_parts(cfg, out.data, r, f);
+
+    alloc_free(out.data);
+
+    return same;
+}
+
+static int compare_strings(const void *const a, const void *const b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static bool compare_parts(const struct config *const cfg, const char *const text,
+    const struct sdccrm_result *const r, FILE *const f)
+{
+    struct strbuf whole = {0}, parts = {0};
+    size_t n_whole = append_body(text, &whole), n_parts = 0;
+
+    for (size_t m = 0; m < r->n_parts; m++)
+    {
+        n_parts += append_body(r->parts[m].output, &parts);
+    }
+
+    const char **const a = index_strings(&whole, n_whole), **const b = index_strings(&parts, n_parts);
+    bool same = true;
+
+    if (!a || !b)
+    {
+        report(f, r->name, cfg, "could not check modules split off the output");
+        same = false;
+    }
+    else
+    {
+        size_t i = 0;
+
+        /* Every line of the output is found in exactly one module. */
+        qsort(a, n_whole, sizeof *a, compare_strings);
+        qsort(b, n_parts, sizeof *b, compare_strings);
+
+        while (i < n_whole && i < n_parts && !strcmp(a[i], b[i]))
+        {
+            i++;
+        }
+
+        if (i < n_whole || i < n_parts)
+        {
+            report(f, r->name, cfg, "modules do not hold every line of the output once, e.g.: %s",
+                i < n_whole && (i >= n_parts || strcmp(a[i], b[i]) < 0) ? a[i] : b[i]);
+            same = false;
+        }
+    }
+
+    alloc_free(a);
+    alloc_free(b);
+    alloc_free(whole.data);
+    alloc_free(parts.data);
+
+    return same && check_statics(cfg, text, r, f);
+}
+
+static int compare_definitions(const void *const a, const void *const b)
+{
+    const struct definition *const da = a, *const db = b;
+
+    return strcmp(da->name, db->name);
+}
+
+static bool check_statics(const struct config *const cfg, const char *const text,
+    const struct sdccrm_result *const r, FILE *const f)
+{
+    char line[MAX_CH_PER_LINE];
+    size_t len, n_globals = 0, n_defs = 0;
+    struct strbuf globals = {0}, names = {0};
+    const char **g = NULL;
+    struct definition *defs = NULL;
+    bool same = true, ok = true;
+
+    for (const char *p = text; ok && (p = get_line(p, line, &len)); )
+    {
+        const char *const name = get_global(line);
+
+        if (name && (ok = strbuf_append(&globals, name, strlen(name) + 1)))
+            n_globals++;
+    }
+
+    /* e.g.: "_f:" or "_f::", but not "00102$:". len counts the null
+     * terminator. */
+    for (size_t m = 0; m < r->n_parts && ok; m++)
+    {
+        for (const char *p = r->parts[m].output; ok && (p = get_line(p, line, &len)); )
+        {
+            if (line[len - 2] == ':' && !isdigit((unsigned char)*line))
+            {
+                line[strcspn(line, ":")] = '\0';
+
+                if ((ok = strbuf_append(&names, line, strlen(line) + 1) && (defs = alloc(defs, n_defs, ALLOC_TABLE))))
+                    defs[n_defs++] = (struct definition){.module = m};
+            }
+        }
+    }
+
+    if (!ok || !(g = index_strings(&globals, n_globals)))
+    {
+        report(f, r->name, cfg, "could not check modules split off the output");
+        same = false;
+        goto end;
+    }
+
+    for (size_t i = 0, off = 0; i < n_defs; i++)
+    {
+        defs[i].name = names.data + off;
+        off += strlen(defs[i].name) + 1;
+    }
+
+    qsort(g, n_globals, sizeof *g, compare_strings);
+    qsort(defs, n_defs, sizeof *defs, compare_definitions);
+
+    /* Static labels are only visible within their module. */
+    for (size_t m = 0; m < r->n_parts && same; m++)
+    {
+        for (const char *p = r->parts[m].output; same && (p = get_line(p, line, &len)); )
+        {
+            /* Directive operands count too, e.g.: ".dw _counter". */
+            if (line[len - 2] == ':' || get_global(line) || !strncmp(line, ".area", static_strlen(".area"))
+                || !strncmp(line, ".module", static_strlen(".module")))
+                continue;
+
+            for (const char *t = line; *t && same; )
+            {
+                const size_t n = isalpha((unsigned char)*t) || *t == '_' ? strspn(t,
+                    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$") : 1;
+                char name[MAX_CH_PER_LINE];
+
+                memcpy(name, t, n);
+                name[n] = '\0';
+                t += n;
+
+                const char *const key = name;
+                const struct definition k = {.name = name};
+                const struct definition *const d = bsearch(&k, defs, n_defs, sizeof *defs, compare_definitions);
+
+                if (d && d->module != m && !bsearch(&key, g, n_globals, sizeof *g, compare_strings))
+                {
+                    report(f, r->name, cfg, "static label %s in module %zu is referenced from module %zu",
+                        name, d->module, m);
+                    same = false;
+                }
+            }
+        }
+    }
+
+end:
+    alloc_free(g);
+    alloc_free(defs);
+    alloc_free(globals.data);
+    alloc_free(names.data);
+
+    return same;
+}
+
+static size_t append_body(const char *p, struct strbuf *const b)
+{
+    char line[MAX_CH_PER_LINE];
+    size_t len, n = 0;
+    bool header = true;
+
+    while ((p = get_line(p, line, &len)))
+    {
+        const bool area = !strncmp(line, ".area", static_strlen(".area"));
+
+        if (area)
+            header = false;
+
+        /* Headers, .area directives and equates are repeated in
+         * every module. */
+        if (header || area || get_global(line) || ((isalpha((unsigned char)*line) || *line == '_')
+            && strchr(line, '=')))
+            continue;
+
+        /* len counts the null terminator. */
+        if (strbuf_append(b, line, len))
+            n++;
+    }
+
+    return n;
+}
+
+static const char **index_strings(const struct strbuf *const b, const size_t n)
+{
+    const char **const s = alloc_(NULL, sizeof *s, n, ALLOC_TABLE);
+
+    /* b holds n null-terminated strings, one after another. */
+    for (size_t i = 0, off = 0; s && i < n; i++)
+    {
+        s[i] = b->data + off;
+        off += strlen(s[i]) + 1;
+    }
+
+    return s;
+}
+
+static void report(FILE *const f, const char *const file, const struct config *const cfg, const char *const fmt, ...)
+{
+    va_list ap;
+
+    if (cfg && cfg->name)
+        fprintf(f, "%s (%s): ", file, cfg->name);
+    else
+        fprintf(f, "%s: ", file);
+
+    va_start(ap, fmt);
+    vfprintf(f, fmt, ap);
+    va_end(ap);
+
+    fputc('\n', f);
+}
@@ -17,115 +17,119 @@
  */
 
 #include "references.h"
+#include "peephole.h"
+#include "alloc.h"
 #include "common.h"
-#include "options.h"
+#include "log.h"
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
-static void find_used_labels(struct tree *t, const struct label *l, const char *file_name);
+/* Breadth-first search, so predecessors give the shortest
+ * chain from any root to every label. */
+struct search
+{
+    const struct sdccrm *c;
+    const struct config *cfg;
+    size_t *queue;
+    size_t head, tail;
+};
+
+static void mark_used(struct search *s, const struct label *l, size_t pred);
 
-void find_references(struct tree *t)
+int find_references(const struct sdccrm *const c, const struct config *const cfg)
 {
-    if (t)
+    const struct tree *const t = &c->tree;
+    const char *const entry = get_entry_label(c, cfg);
+    const struct label *l = NULL;
+    /* Every label is queued once at most. */
+    struct search s =
     {
-        const char *const entry = get_entry_label();
-        struct file *f = NULL;
-        struct label *l = NULL;
-        bool match = false;
+        .c = c,
+        .cfg = cfg,
+        .queue = alloc_(NULL, sizeof *s.queue, t->n_labels, ALLOC_TABLE)
+    };
 
-        /* Entry label must never be removed. */
-        exclude_label(entry);
+    if (!s.queue)
+        return ENOMEM;
 
-        for (size_t i = 0; i < t->n_files; i++)
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        if (t->labels[i]->global && !strcmp(t->labels[i]->name, entry))
         {
-            f = &t->files[i];
-
-            for (size_t j = 0; j < f->n_labels; j++)
-            {
-                l = &f->labels[j];
-
-                if (l->global)
-                {
-                    if (!strcmp(l->name, entry))
-                    {
-                        match = true;
-
-                        /* Exit nested loop. */
-                        goto end_loop;
-                    }
-                }
-            }
+            l = t->labels[i];
+            break;
         }
+    }
 
-end_loop:
-        if (match && f && l)
-        {
-            l->used = true;
+    if (l)
+    {
+        mark_used(&s, l, SIZE_MAX);
+    }
+    else
+    {
+        fprintf(stderr, "Could not find entry point %s from input files.\n", entry);
+    }
 
-            find_used_labels(t, l, f->name);
+    /* Excluded labels, which also include the entry label, are
+     * reachability roots. Match them once instead of on every
+     * call edge. */
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        const struct label *const el = t->labels[i];
+
+        if (!cfg->used[i] && is_label_excluded(c, cfg, el))
+        {
+            mark_used(&s, el, SIZE_MAX);
         }
-        else
+    }
+
+    /* Labels referenced from outside any label, e.g.: vector tables. */
+    for (size_t i = 0; i < t->n_roots; i++)
+    {
+        const struct label *const rl = t->labels[t->roots[i]];
+
+        if (!cfg->used[rl->id])
         {
-            fprintf(stderr, "Could not find entry point %s from input files.\n", entry);
+            mark_used(&s, rl, SIZE_MAX);
         }
     }
-}
 
-static void find_used_labels(struct tree *const t, const struct label *const l, const char *const file_name)
-{
-    if (l->calls)
+    while (s.head < s.tail)
     {
-        for (size_t i = 0; i < l->n_calls; i++)
+        const struct label *const caller = t->labels[s.queue[s.head++]];
+
+        for (size_t i = 0; i < caller->n_callees; i++)
         {
-            const char *const ref = l->calls[i];
-            bool match = false;
+            size_t id = caller->callees[i];
 
-            for (size_t j = 0; j < t->n_files && !match; j++)
-            {
-                struct file *const f = &t->files[j];
-
-                for (size_t k = 0; k < f->n_labels; k++)
-                {
-                    struct label *const called_l = &f->labels[k];
-
-                    if ((match = !strcmp(ref, called_l->name)))
-                    {
-                        if (called_l->global)
-                        {
-                            /* Reference to a global label from another file. */
-                        }
-                        else if (!strcmp(f->name, file_name))
-                        {
-                            /* Reference to a static label inside the same file. */
-                        }
-                        else
-                        {
-                            /* Even if symbol name matches, it is not a global
-                             * symbol and it is not being referred from the same file. */
-                            match = false;
-                        }
-                    }
-                    else if (is_label_excluded(called_l->name) && !called_l->used)
-                    {
-                        /* Label is referenced somehow, as indicated by the user. */
-                        match = true;
-                    }
-
-                    if (match)
-                    {
-                        called_l->used = true;
-                        LOG("%s (%s) marked as used", called_l->name, f->name);
-
-                        find_used_labels(t, called_l, f->name);
-                    }
-                }
-            }
+            /* Calls to bypassed trampolines go to their targets. */
+            if (c->trampolines && c->trampolines[id].bypass)
+                id = c->trampolines[id].target;
 
-            if (!match)
+            /* Labels already marked have been, or are being, visited. */
+            if (!cfg->used[id])
             {
-                /* Called label could not be found, but do not worry: just avoid removing it. */
+                mark_used(&s, t->labels[id], caller->id);
             }
         }
     }
+
+    alloc_free(s.queue);
+    return 0;
+}
+
+static void mark_used(struct search *const s, const struct label *const l, const size_t pred)
+{
+    const struct sdccrm *const c = s->c;
+
+    s->cfg->used[l->id] = true;
+
+    if (s->cfg->pred)
+        s->cfg->pred[l->id] = pred;
+
+    s->queue[s->tail++] = l->id;
+    LOG(c, SDCCRM_LOG_DEBUG, c->tree.files[l->file].name, l->name, "marked as used");
 }
@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* ASxxxx object file frontend. Relevant records are:
+ *
+ *  XL2       Radix (X, D or Q), endianness (L or H) and address size.
+ *  A n ...   Area n, numbered in order of appearance.
+ *  S n Defv  Symbol n, defined at offset v of the last area found.
+ *  S n Refv  Symbol n, defined by another module.
+ *  T a d...  Data at offset a of the area given by the next R record.
+ *  R 0 0 i i m o s s ...
+ *            Relocations for the last T record, on area i. Each one
+ *            gives a mode (m), offset within the T record (o) and
+ *            symbol or area index (s), as given by mode bit R_SYM.
+ *
+ * Static symbols are not exported into object files, so static
+ * functions are seen as part of the previous symbol, which can only
+ * keep more labels than needed. */
+
+#include "rel.h"
+#include "alloc.h"
+#include "classify.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    /* Relocation mode flags. */
+    R_BYTE = 0x01,
+    R_SYM = 0x02,
+    R_PCR = 0x04,
+    R_BYT2 = 0x08,
+    R_MSB = 0x80,
+    R_HIB = 0x200,
+    /* Extended modes take one more byte. */
+    R_ESCAPE_MASK = 0xf0,
+
+    MAX_RECORD_BYTES = 256
+};
+
+struct area
+{
+    const char *name;
+    size_t name_len;
+    unsigned long size;
+    bool code;
+    /* Labels defined in this area, sorted by address. */
+    size_t first_label;
+    size_t n_labels;
+};
+
+struct symbol
+{
+    const char *name;
+    size_t name_len;
+    bool def;
+    size_t area;
+    unsigned long addr;
+};
+
+struct rel
+{
+    const struct port *port;
+    int base;
+    bool big_endian;
+    unsigned addr_size;
+    struct area *areas;
+    size_t n_areas;
+    struct symbol *symbols;
+    size_t n_symbols;
+    /* Label addresses, parallel to the labels of the file. */
+    unsigned long *addrs;
+    /* Last T record. */
+    unsigned char data[MAX_RECORD_BYTES];
+    size_t n_data;
+};
+
+static const char *next_line(const char *p, const char **end);
+static const char *token(const char **p, const char *end, size_t *len);
+static bool number(const char **p, const char *end, int base, unsigned long *v);
+static int read_header(struct rel *r, const char *line, const char *end);
+static int read_t(struct rel *r, const char *line, const char *end);
+static int read_r(struct rel *r, struct file *f, const char *line, const char *end);
+static int add_labels(struct rel *r, struct file *f);
+static unsigned long read_value(const struct rel *r, size_t offset, size_t n);
+static struct label *find_containing(const struct rel *r, const struct file *f, size_t area, unsigned long addr);
+static bool may_target(const struct rel *r, unsigned long mode, size_t offset, unsigned long start, unsigned long next);
+static int add_reference(struct file *f, struct label *from, const char *name, size_t len);
+static int append_call(struct label *l, const char *name, size_t len);
+static int append_name(char ***names, size_t *n, const char *name, size_t len);
+static int compare_symbols(const void *a, const void *b);
+
+int parse_rel(const struct port *const port, const char *const buf, struct file *const f)
+{
+    struct rel r = {.port = port, .base = 16, .addr_size = 2};
+    int ret = 0;
+
+    *f = (struct file){0};
+
+    /* Header records come first, but are read in a pass of their
+     * own so relocations never find an incomplete symbol table. */
+    for (const char *p = buf, *end; !ret && (p = next_line(p, &end)); p = end)
+    {
+        ret = read_header(&r, p, end);
+    }
+
+    if (!ret)
+        ret = add_labels(&r, f);
+
+    for (const char *p = buf, *end; !ret && (p = next_line(p, &end)); p = end)
+    {
+        if (*p == 'T')
+            ret = read_t(&r, p + 1, end);
+        else if (*p == 'R')
+            ret = read_r(&r, f, p + 1, end);
+    }
+
+    alloc_free(r.areas);
+    alloc_free(r.symbols);
+    alloc_free(r.addrs);
+
+    return ret;
+}
+
+static const char *next_line(const char *p, const char **const end)
+{
+    while (*p == '\n' || *p == '\r')
+    {
+        p++;
+    }
+
+    if (!*p)
+        return NULL;
+
+    *end = p;
+
+    while (**end && **end != '\n' && **end != '\r')
+    {
+        ++*end;
+    }
+
+    return p;
+}
+
+static const char *token(const char **const p, const char *const end, size_t *const len)
+{
+    const char *start = *p;
+
+    while (start < end && (*start == ' ' || *start == '\t'))
+    {
+        start++;
+    }
+
+    *p = start;
+
+    while (*p < end && **p != ' ' && **p != '\t')
+    {
+        ++*p;
+    }
+
+    *len = *p - start;
+    return *len ? start : NULL;
+}
+
+static bool number(const char **const p, const char *const end, const int base, unsigned long *const v)
+{
+    size_t len;
+    const char *const t = token(p, end, &len);
+    char tmp[32], *endptr;
+
+    if (!t || len >= sizeof tmp)
+        return false;
+
+    memcpy(tmp, t, len);
+    tmp[len] = '\0';
+    *v = strtoul(tmp, &endptr, base);
+
+    return !*endptr;
+}
+
+static int read_header(struct rel *const r, const char *const line, const char *const end)
+{
+    const char *p = line + 1;
+    size_t len;
+    const char *t;
+
+    switch (*line)
+    {
+        case 'X':
+        case 'D':
+        case 'Q':
+            r->base = *line == 'X' ? 16 : *line == 'D' ? 10 : 8;
+            r->big_endian = line[1] == 'H';
+
+            if (line[1] && line[2] >= '2' && line[2] <= '4')
+                r->addr_size = line[2] - '0';
+
+            break;
+
+        case 'A':
+            if (!(t = token(&p, end, &len)))
+                return EINVAL;
+
+            if (!(r->areas = alloc(r->areas, r->n_areas, ALLOC_TABLE)))
+                return ENOMEM;
+
+            /* e.g.: "A _CODE size 1A flags 0 addr 0". */
+            unsigned long size = 0;
+            const char *q = p;
+            size_t key_len;
+            const char *const key = token(&q, end, &key_len);
+
+            if (key && key_len == static_strlen("size") && !memcmp(key, "size", key_len))
+                number(&q, end, r->base, &size);
+
+            r->areas[r->n_areas++] = (struct area)
+            {
+                .name = t,
+                .name_len = len,
+                .size = size,
+                .code = is_code_area(r->port, t, len)
+            };
+
+            break;
+
+        case 'S':
+        {
+            unsigned long addr;
+
+            if (!(t = token(&p, end, &len)))
+                return EINVAL;
+
+            const char *q = p;
+            size_t kind_len;
+            const char *const kind = token(&q, end, &kind_len);
+
+            if (!kind || kind_len <= static_strlen("Def"))
+                return EINVAL;
+
+            /* Value follows "Def" or "Ref" with no separation. */
+            const char *v = kind + static_strlen("Def");
+
+            if (!number(&v, q, r->base, &addr))
+                return EINVAL;
+
+            if (!(r->symbols = alloc(r->symbols, r->n_symbols, ALLOC_TABLE)))
+                return ENOMEM;
+
+            r->symbols[r->n_symbols++] = (struct symbol)
+            {
+                .name = t,
+                .name_len = len,
+                .def = !strncmp(kind, "Def", static_strlen("Def")),
+                /* Symbols are defined in the last area found. */
+                .area = r->n_areas ? r->n_areas - 1 : SIZE_MAX,
+                .addr = addr
+            };
+
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static int add_labels(struct rel *const r, struct file *const f)
+{
+    /* Sorted copy, so labels are created in address order. */
+    struct symbol *const sorted = alloc_(NULL, sizeof *sorted, r->n_symbols, ALLOC_TABLE);
+
+    if (!sorted)
+        return ENOMEM;
+
+    memcpy(sorted, r->symbols, r->n_symbols * sizeof *sorted);
+    qsort(sorted, r->n_symbols, sizeof *sorted, compare_symbols);
+
+    for (size_t i = 0; i < r->n_symbols; i++)
+    {
+        const struct symbol *const s = &sorted[i];
+
+        if (!s->def || s->area >= r->n_areas || !r->areas[s->area].code)
+            continue;
+
+        struct area *const a = &r->areas[s->area];
+        char *const name = alloc_buf((s->name_len + 1) * sizeof *name, ALLOC_LABEL_NAME);
+
+        f->labels = alloc(f->labels, f->n_labels, ALLOC_TABLE);
+        r->addrs = alloc(r->addrs, f->n_labels, ALLOC_TABLE);
+
+        if (!name || !f->labels || !r->addrs)
+        {
+            alloc_free(name);
+            alloc_free(sorted);
+            f->n_labels = 0;
+            return ENOMEM;
+        }
+
+        memcpy(name, s->name, s->name_len);
+        name[s->name_len] = '\0';
+
+        if (!a->n_labels)
+            a->first_label = f->n_labels;
+
+        a->n_labels++;
+        r->addrs[f->n_labels] = s->addr;
+        f->labels[f->n_labels++] = (struct label){.global = true, .name = name};
+    }
+
+    alloc_free(sorted);
+
+    /* Labels extend until the next one, or the end of their area. */
+    for (size_t i = 0; i < r->n_areas; i++)
+    {
+        const struct area *const a = &r->areas[i];
+
+        for (size_t j = a->first_label; j < a->first_label + a->n_labels; j++)
+        {
+            const unsigned long next = j + 1 < a->first_label + a->n_labels ? r->addrs[j + 1] : a->size;
+
+            f->labels[j].size = next > r->addrs[j] ? next - r->addrs[j] : 0;
+        }
+    }
+
+    return 0;
+}
+
+static int compare_symbols(const void *const a, const void *const b)
+{
+    const struct symbol *const sa = a, *const sb = b;
+
+    /* Labels of an area are kept together. */
+    if (sa->area != sb->area)
+        return sa->area < sb->area ? -1 : 1;
+
+    return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+static int read_t(struct rel *const r, const char *p, const char *const end)
+{
+    unsigned long v;
+
+    r->n_data = 0;
+
+    while (r->n_data < MAX_RECORD_BYTES && number(&p, end, r->base, &v))
+    {
+        r->data[r->n_data++] = v;
+    }
+
+    return r->n_data >= r->addr_size ? 0 : EINVAL;
+}
+
+static unsigned long read_value(const struct rel *const r, const size_t offset, const size_t n)
+{
+    unsigned long v = 0;
+
+    for (size_t i = 0; i < n && offset + i < r->n_data; i++)
+    {
+        const size_t shift = r->big_endian ? n - 1 - i : i;
+
+        v |= (unsigned long)r->data[offset + i] << (8 * shift);
+    }
+
+    return v;
+}
+
+static int read_r(struct rel *const r, struct file *const f, const char *p, const char *const end)
+{
+    unsigned long b[4];
+
+    for (size_t i = 0; i < lengthof (b); i++)
+    {
+        if (!number(&p, end, r->base, &b[i]))
+            return EINVAL;
+    }
+
+    /* Area index follows two unused bytes. */
+    const size_t area = r->big_endian ? b[2] << 8 | b[3] : b[3] << 8 | b[2];
+    const unsigned long t_addr = read_value(r, 0, r->addr_size);
+    unsigned long mode;
+
+    if (area >= r->n_areas)
+        return EINVAL;
+
+    while (number(&p, end, r->base, &mode))
+    {
+        unsigned long offset, lo, hi, ext;
+        int ret = 0;
+
+        if ((mode & R_ESCAPE_MASK) == R_ESCAPE_MASK)
+        {
+            if (!number(&p, end, r->base, &ext))
+                return EINVAL;
+
+            mode = (mode & ~(unsigned long)R_ESCAPE_MASK) << 8 | ext;
+        }
+
+        if (!number(&p, end, r->base, &offset)
+            || !number(&p, end, r->base, &lo)
+            || !number(&p, end, r->base, &hi)
+            || offset < r->addr_size)
+            return EINVAL;
+
+        const size_t index = r->big_endian ? lo << 8 | hi : hi << 8 | lo;
+        struct label *const from = r->areas[area].code
+            ? find_containing(r, f, area, t_addr + offset - r->addr_size) : NULL;
+
+        if (mode & R_SYM)
+        {
+            if (index >= r->n_symbols)
+                return EINVAL;
+
+            const struct symbol *const s = &r->symbols[index];
+
+            ret = add_reference(f, from, s->name, s->name_len);
+        }
+        else if (index < r->n_areas && r->areas[index].code)
+        {
+            /* Reference into a code area of this module. */
+            const struct area *const a = &r->areas[index];
+
+            for (size_t i = 0; !ret && i < a->n_labels; i++)
+            {
+                const struct label *const l = &f->labels[a->first_label + i];
+                const unsigned long start = r->addrs[a->first_label + i],
+                    next = i + 1 < a->n_labels ? r->addrs[a->first_label + i + 1] : ULONG_MAX;
+
+                if (may_target(r, mode, offset, start, next))
+                    ret = add_reference(f, from, l->name, strlen(l->name));
+            }
+        }
+
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+static bool may_target(const struct rel *const r, const unsigned long mode, const size_t offset,
+    const unsigned long start, const unsigned long next)
+{
+    unsigned shift;
+
+    if (mode & R_PCR)
+    {
+        /* Same-area relative references are solved by the assembler,
+         * so these are rare. Their target is not rebuilt. */
+        return true;
+    }
+    else if (mode & R_BYTE)
+    {
+        /* One byte out of the address, e.g.: "#<_f" or "#>_f". */
+        shift = mode & R_HIB ? 16 : mode & R_MSB ? 8 : 0;
+    }
+    else if (mode & R_BYT2)
+    {
+        /* Paged jumps only hold part of the address. */
+        return true;
+    }
+    else
+    {
+        /* Full address, 24 bits wide when R_MSB is set. */
+        const unsigned long target = read_value(r, offset, mode & R_MSB ? 3 : 2);
+
+        return target >= start && target < next;
+    }
+
+    /* Any address within [start, next) with that byte value. */
+    const unsigned long v = read_value(r, offset, 1),
+        block = 1ul << shift, period = block << 8;
+    unsigned long a = start - start % period + v * block;
+
+    if (a + block <= start)
+        a += period;
+
+    return (a > start ? a : start) < next;
+}
+
+static int add_reference(struct file *const f, struct label *const from, const char *const name, const size_t len)
+{
+    if (*name == '.')
+    {
+        /* Assembler-defined symbols, e.g.: ".__.ABS.". */
+        return 0;
+    }
+    else if (from)
+    {
+        return append_call(from, name, len);
+    }
+
+    /* References from any other place are roots, e.g.: interrupt
+     * vectors, initializers or code before any symbol in its area. */
+    return append_name(&f->roots, &f->n_roots, name, len);
+}
+
+static struct label *find_containing(const struct rel *const r, const struct file *const f,
+    const size_t area, const unsigned long addr)
+{
+    const struct area *const a = &r->areas[area];
+    struct label *l = NULL;
+
+    /* Last label of the area starting at or before addr. */
+    for (size_t lo = 0, hi = a->n_labels; lo < hi; )
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (r->addrs[a->first_label + mid] <= addr)
+        {
+            l = &f->labels[a->first_label + mid];
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return l;
+}
+
+static int append_call(struct label *const l, const char *const name, const size_t len)
+{
+    /* Call depths stay parallel to calls. Their values are unknown,
+     * since instructions are not decoded. */
+    if (!(l->call_depths = alloc(l->call_depths, l->n_calls, ALLOC_CALL_LIST)))
+    {
+        for (size_t i = 0; i < l->n_calls; i++)
+        {
+            alloc_free(l->calls[i]);
+        }
+
+        alloc_free(l->calls);
+        l->calls = NULL;
+        l->n_calls = 0;
+        return ENOMEM;
+    }
+
+    l->call_depths[l->n_calls] = 0;
+    return append_name(&l->calls, &l->n_calls, name, len);
+}
+
+static int append_name(char ***const names, size_t *const n, const char *const name, const size_t len)
+{
+    char *const s = alloc_buf((len + 1) * sizeof *s, ALLOC_CALL_LIST);
+
+    if (!s)
+        return ENOMEM;
+
+    if (!(*names = alloc(*names, *n, ALLOC_CALL_LIST)))
+    {
+        alloc_free(s);
+        *n = 0;
+        return ENOMEM;
+    }
+
+    memcpy(s, name, len);
+    s[len] = '\0';
+    (*names)[(*n)++] = s;
+
+    return 0;
+}
@@ -17,149 +17,342 @@
  */
 
 #include "remove_unused.h"
+#include "blocks.h"
+#include "peephole.h"
+#include "layout.h"
+#include "split.h"
 #include "common.h"
-#include "options.h"
-#include <stdlib.h>
+#include "classify.h"
+#include "alloc.h"
+#include "trace.h"
+#include "graph.h"
+#include "log.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void write_filtered_file(FILE *const fi, const struct tree *const t, const struct file *const f, const char *p);
-
-static const char *extension = "rm";
+static size_t plan_removal(const struct config *cfg, const struct file *f, struct sdccrm_result *r);
+static int build_plan(const struct sdccrm *c, const struct config *cfg, const struct file *f, struct plan *p);
+static void sort_edits(struct plan *p);
 
-void remove_unused(const struct tree *const t)
+void remove_unused(const struct sdccrm *const c, const struct config *const cfg, struct sdccrm_result *const results, struct plan *const plans)
 {
-    if (!t) return;
+    const struct tree *const t = &c->tree;
 
     for (size_t i = 0; i < t->n_files; i++)
     {
         const struct file *const f = &t->files[i];
-        if (!f->name) continue;
+        const struct input *const in = &c->inputs[i];
+        struct sdccrm_result *const r = &results[i];
+        struct plan *const p = &plans[i];
+        struct strbuf out = {0};
 
-        char *const buf = open(f->name);
+        *r = (struct sdccrm_result){.name = in->name, .config = cfg->name};
 
-        if (!buf) return;
+        const size_t removed = plan_removal(cfg, f, r);
 
-        if(replace())
+        LOG(c, SDCCRM_LOG_INFO, f->name, NULL, "%zu out of %zu labels shall be removed", removed, f->n_labels);
+
+        if (build_plan(c, cfg, f, p) || (c->remove_blocks && in->buf && plan_blocks(c, cfg, f, in->buf, p))
+            || (c->trampolines && in->buf && plan_peephole(c, i, in->buf, p))
+            || (cfg->windows && in->buf && plan_layout(c, cfg, i, in->buf, p)))
+        {
+            /* Keep the input untouched rather than emitting a partial result. */
+            free_plan(p);
+        }
+        else if (c->remove_blocks || c->trampolines || cfg->windows)
         {
-            FILE *const fi = fopen(f->name, "w");
+            merge_spans(p);
+            sort_edits(p);
+        }
 
-            if (fi)
+        /* Inputs added from summaries have no text to filter. */
+        if (in->buf && !p->n_spans && !p->n_drop && !p->n_edits)
+        {
+            /* Nothing to remove, e.g.: hand-written drivers. The input
+             * text is given as is, so it can even be copied without
+             * reading it again. */
+            LOG(c, SDCCRM_LOG_INFO, f->name, NULL, "kept unchanged");
+            r->output = in->buf;
+            r->output_len = in->len;
+            r->unchanged = true;
+        }
+        else
+        {
+            if (in->buf)
             {
-                LOG("Filtering %s..", f->name);
-                write_filtered_file(fi, t, f, buf);
+                const uint64_t start = trace_begin();
+
+                /* Files with every label removed only keep their
+                 * skeleton, e.g.: directives and data areas, which is
+                 * quick since removed lines are skipped uncopied. */
+                LOG(c, SDCCRM_LOG_DEBUG, f->name, NULL, "filtering");
+                write_filtered_file(&out, p, in->buf);
+
+                trace_end(start, removed == f->n_labels ? "skeleton" : "filter", &(const struct trace_args)
+                    {
+                        .file = f->name,
+                        .bytes = out.len
+                    });
+            }
 
-                fclose(fi);
+            if (!out.data)
+            {
+                /* Empty outputs are still valid, null-terminated strings. */
+                strbuf_append(&out, "", 0);
             }
 
+            r->output = out.data;
+            r->output_len = out.len;
         }
-        else
+
+        if (c->split > 1 && in->buf && split_output(c, cfg, i, in->buf, p, r))
+            WARNING(c, f->name, NULL, "could not split output, so it is given as a whole");
+    }
+}
+
+static size_t plan_removal(const struct config *const cfg, const struct file *const f, struct sdccrm_result *const r)
+{
+    const uint64_t start = trace_begin();
+    size_t removed = 0;
+    const char **names = NULL;
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        if (!cfg->used[f->labels[i].id])
         {
-            /* Use temporary file extension ".asmrm". */
-            char *const n = malloc((strlen(f->name) + strlen(extension) + 1) * sizeof *n);
-            if (!n) 
+            names = alloc(names, removed, ALLOC_TABLE);
+
+            if (names)
             {
-                free(buf);
-                continue;
+                names[removed++] = f->labels[i].name;
+            }
+            else
+            {
+                removed = 0;
             }
+        }
+    }
 
-            strcpy(n, f->name);
+    r->removed = names;
+    r->n_removed = removed;
 
-            /* Create final file name. */
-            if (strcat(n, extension))
-            {
-                FILE *const fi = fopen(n, "w");
+    trace_end(start, "plan", &(const struct trace_args)
+        {
+            .file = f->name,
+            .labels = f->n_labels,
+            .removed = removed
+        });
 
-                if (fi)
-                {
-                    LOG("Filtering %s..", n);
-                    write_filtered_file(fi, t, f, buf);
+    return removed;
+}
 
-                    fclose(fi);
-                }
+static int build_plan(const struct sdccrm *const c, const struct config *const cfg, const struct file *const f, struct plan *const p)
+{
+    const struct tree *const t = &c->tree;
+
+    *p = (struct plan){0};
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        const struct label *const l = &f->labels[i];
 
+        if (!cfg->used[l->id])
+        {
+            /* A label found on the last line extends until the end of file. */
+            const size_t end = l->end_line > l->start_line ? l->end_line : SIZE_MAX;
+            struct span *const prev = p->n_spans ? &p->spans[p->n_spans - 1] : NULL;
+
+            LOG(c, SDCCRM_LOG_INFO, f->name, l->name, "removing unused label");
+
+            /* Spans of consecutive labels might overlap. */
+            if (prev && l->start_line <= prev->end)
+            {
+                if (end > prev->end)
+                    prev->end = end;
+
+                continue;
             }
 
-            free(n);
+            if (!(p->spans = alloc(p->spans, p->n_spans, ALLOC_TABLE)))
+                return ENOMEM;
+
+            p->spans[p->n_spans++] = (struct span){.start = l->start_line, .end = end};
         }
+    }
 
-        free(buf);
+    for (size_t i = 0; i < f->n_globals; i++)
+    {
+        /* A global label declaration is removed if the first
+         * label with that name is global and unused. */
+        const struct label *const l = find_label(t, f->globals[i]);
+
+        if (l && l->global && !cfg->used[l->id])
+        {
+            if (!(p->drop = alloc(p->drop, p->n_drop, ALLOC_TABLE)))
+                return ENOMEM;
+
+            p->drop[p->n_drop++] = i;
+        }
     }
+
+    return 0;
 }
 
-static void write_filtered_file(FILE *const fi, const struct tree *const t, const struct file *const f, const char *p)
+static int compare_spans(const void *const a, const void *const b)
 {
-    /* When true, all lines belonging to selected label shall be ignored. */
-    bool remove_label = false;
-    char line[MAX_CH_PER_LINE];
+    const struct span *const sa = a, *const sb = b;
 
-    for (size_t line_no = 1, len; (p = get_line(p, line, &len)); line_no++)
+    return (sa->start > sb->start) - (sa->start < sb->start);
+}
+
+void merge_spans(struct plan *const p)
+{
+    size_t n = 0;
+
+    if (!p->n_spans)
+        return;
+
+    /* Spans within kept labels are found after removed labels. */
+    qsort(p->spans, p->n_spans, sizeof *p->spans, compare_spans);
+
+    for (size_t i = 0; i < p->n_spans; i++)
     {
-        if (!remove_label)
+        struct span *const prev = n ? &p->spans[n - 1] : NULL;
+
+        if (prev && p->spans[i].start <= prev->end)
         {
-            bool skip_global_declaration = false;
-            const char *const global_label = get_global(line);
+            if (p->spans[i].end > prev->end)
+                prev->end = p->spans[i].end;
+        }
+        else
+        {
+            p->spans[n++] = p->spans[i];
+        }
+    }
 
-            if (global_label)
-            {
-                /* A global label declaration was found.
-                 * Determine if it has to be removed. */
+    p->n_spans = n;
+}
 
-                for (size_t i = 0; i < t->n_files; i++)
-                {
-                    const struct file *const f = &t->files[i];
+static int compare_edits(const void *const a, const void *const b)
+{
+    const struct edit *const ea = a, *const eb = b;
 
-                    for (size_t j = 0; j < f->n_labels; j++)
-                    {
-                        const struct label *const l = &f->labels[j];
+    return (ea->line > eb->line) - (ea->line < eb->line);
+}
 
-                        if (!strcmp(global_label, l->name))
-                        {
-                            skip_global_declaration = !l->used && l->global;
+static void sort_edits(struct plan *const p)
+{
+    /* Every stage edits different lines, but in its own pass. */
+    if (p->n_edits)
+        qsort(p->edits, p->n_edits, sizeof *p->edits, compare_edits);
+}
 
-                            /* Exit nested loop. */
-                            goto global_label_found;
-                        }
-                    }
-                }
-            }
-            else
-            {
-                for (size_t j = 0; j < f->n_labels; j++)
-                {
-                    const struct label *const l = &f->labels[j];
+void free_plan(struct plan *const p)
+{
+    for (size_t i = 0; i < p->n_edits; i++)
+    {
+        alloc_free(p->edits[i].text);
+    }
 
-                    if (l->start_line == line_no && !l->used)
-                    {
-                        remove_label = true;
-                        LOG("Removing unused label %s (%s)", l->name, f->name);
+    alloc_free(p->spans);
+    alloc_free(p->drop);
+    alloc_free(p->edits);
+    *p = (struct plan){0};
+}
 
-                        break;
-                    }
-                }
-            }
+void write_filtered_file(struct strbuf *const out, const struct plan *const plan, const char *p)
+{
+    char line[MAX_CH_PER_LINE];
+    size_t span = 0, global = 0, drop = 0, edit = 0;
+    const char *start;
 
-global_label_found:
+    for (size_t line_no = 1; (p = scan_line(p, &start)); line_no++)
+    {
+        /* All lines belonging to removed labels are ignored. */
+        const bool removing = span < plan->n_spans && line_no >= plan->spans[span].start;
+        bool skip = removing;
+        /* Lines are truncated as get_line() does. */
+        size_t len = p - start < MAX_CH_PER_LINE - 1 ? (size_t)(p - start) : MAX_CH_PER_LINE - 1;
 
-            if (!remove_label && !skip_global_declaration)
-            {
-                fprintf(fi, "%s\n", line);
-            }
+        if (removing && plan->spans[span].end == SIZE_MAX)
+        {
+            /* Nothing else is kept until the end of file. */
+            break;
         }
-        else
+        else if (*start == '.')
         {
-            for (size_t j = 0; j < f->n_labels; j++)
-            {
-                const struct label *const l = &f->labels[j];
+            struct line_info li;
+
+            memcpy(line, start, len);
+            line[len] = '\0';
+            /* Directives are the same for every port. */
+            classify(find_port(NULL), line, len + 1, &li);
 
-                if (l->end_line == line_no)
+            /* Global declarations are counted even within removed
+             * spans, so indices match those found by parse(). */
+            if (li.kind == LINE_GLOBAL)
+            {
+                if (drop < plan->n_drop && plan->drop[drop] == global)
                 {
-                    remove_label = false;
-                    break;
+                    skip = true;
+                    drop++;
                 }
+
+                global++;
             }
         }
+
+        if (removing && line_no == plan->spans[span].end)
+        {
+            span++;
+        }
+
+        while (edit < plan->n_edits && plan->edits[edit].line < line_no)
+        {
+            edit++;
+        }
+
+        if (skip)
+        {
+            continue;
+        }
+        else if (edit < plan->n_edits && plan->edits[edit].line == line_no)
+        {
+            const char *const text = plan->edits[edit].text;
+
+            strbuf_append(out, text, strlen(text));
+        }
+        else
+        {
+            strbuf_append(out, start, len);
+        }
+
+        strbuf_append(out, "\n", 1);
     }
 }
+
+int add_edit(struct plan *const p, const size_t line, const char *const text)
+{
+    const size_t len = strlen(text);
+    char *const copy = alloc_buf((len + 1) * sizeof *copy, ALLOC_TABLE);
+
+    if (!copy)
+        return ENOMEM;
+
+    memcpy(copy, text, len + 1);
+
+    if (!(p->edits = alloc(p->edits, p->n_edits, ALLOC_TABLE)))
+    {
+        p->n_edits = 0;
+        alloc_free(copy);
+        return ENOMEM;
+    }
+
+    p->edits[p->n_edits++] = (struct edit){.line = line, .text = copy};
+
+    return 0;
+}
@@ -16,20 +16,44 @@
  *
  */
 
-#include "common.h"
+#include "sdccrm.h"
 #include "options.h"
-#include "function_list.h"
-#include "references.h"
-#include "remove_unused.h"
+#include "alloc.h"
+#include "trace.h"
+#include "common.h"
+#include "file_io.h"
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
+
+static void start(struct sdccrm *c, size_t n_files, const char *const *files);
+static int read_stream(struct sdccrm *c, FILE *f);
+static void write_outputs(const struct sdccrm *c);
+static void write_plans(const struct sdccrm *c);
+static char *output_name(const char *name, const char *config, const char *default_suffix);
+static char **output_names(size_t n, const char *const *names, const char *const *configs, const char *suffix, bool replace);
+static void free_names(char **names, size_t n);
+static void write_stream(const struct sdccrm *c, FILE *f);
+static void summarize(struct sdccrm *c, size_t n_files, const char *const *files);
+static void apply(size_t n_files, const char *const *files);
+static int add_summary(void *arg, size_t i, char *buf, size_t len);
+static int add_rel(void *arg, size_t i, char *buf, size_t len);
+static void write_removed(const struct sdccrm *c);
+static void verify(struct sdccrm *c);
+static int keep_text(void *arg, size_t i, char *buf, size_t len);
+static char **result_names(const struct sdccrm *c, const char *suffix, bool replace);
+static void write_data(size_t n, char *const *paths, void **bufs, const size_t *lens);
 
-static void start(size_t n_files, const char *const *files);
-static void cleanup(struct tree *t);
+static const char *extension = "rm";
+static const char *summary_extension = ".sum";
+static const char *plan_extension = ".plan";
+static const char *removed_extension = ".removed";
 
 int main(const int argc, const char *const argv[])
 {
@@ -43,8 +67,16 @@ int main(const int argc, const char *const argv[])
 
     if (argc >= MINIMUM_PARAMETERS)
     {
+        struct sdccrm *const c = sdccrm_new();
+
+        if (!c)
+        {
+            fprintf(stderr, "Could not allocate sdccrm context\n");
+            return ENOMEM;
+        }
+
         bool exit;
-        const int i = parse_options(DEFAULT_ASM_FILE, argc, argv, &exit);
+        const int i = parse_options(c, DEFAULT_ASM_FILE, argc, argv, &exit);
 
         if (!exit)
         {
@@ -56,13 +88,18 @@ int main(const int argc, const char *const argv[])
                 /* Substract executable path. */
                 const size_t n_files = argc - i;
 
-                start(n_files, files);
+                start(c, n_files, files);
             }
             else
             {
                 usage();
             }
         }
+
+        sdccrm_free(c);
+        free_options();
+        trace_write();
+        alloc_report(stderr);
     }
     else
     {
@@ -72,52 +109,625 @@ int main(const int argc, const char *const argv[])
     return errno;
 }
 
-static void start(const size_t n_files, const char *const *const files)
+struct rel_files
+{
+    struct sdccrm *c;
+    const char *const *paths;
+};
+
+static void start(struct sdccrm *const c, const size_t n_files, const char *const *const files)
+{
+    /* "-" as the only file selects pipe mode. */
+    const bool pipe = n_files == 1 && !strcmp(files[0], "-");
+
+    if (pipe && mode() != MODE_DEFAULT)
+    {
+        fprintf(stderr, "--summarize, --merge, --apply, --rel and --verify do not support reading from stdin\n");
+        return;
+    }
+    else if (mode() == MODE_SUMMARIZE)
+    {
+        summarize(c, n_files, files);
+        return;
+    }
+    else if (mode() == MODE_APPLY)
+    {
+        apply(n_files, files);
+        return;
+    }
+
+    if (pipe)
+    {
+        /* stdout is reserved for the filtered stream. */
+        sdccrm_set_log(c, stderr);
+
+        /* Modules are only written into files of their own. */
+        if (split())
+        {
+            fprintf(stderr, "--split is ignored when writing to stdout\n");
+            sdccrm_set_split(c, 0);
+        }
+
+        if (read_stream(c, stdin))
+        {
+            fprintf(stderr, "Could not read from stdin\n");
+            return;
+        }
+    }
+    else if (mode() == MODE_MERGE)
+    {
+        /* Summaries are added in order until one cannot be read. */
+        read_files(n_files, files, add_summary, c);
+    }
+    else if (mode() == MODE_REL)
+    {
+        struct rel_files r = {.c = c, .paths = files};
+
+        /* Object files are added in order until one cannot be read. */
+        read_files(n_files, files, add_rel, &r);
+    }
+    else
+    {
+        /* Files are added in order until one cannot be read. */
+        sdccrm_add_files(c, n_files, files);
+    }
+
+    if (mode() == MODE_VERIFY)
+    {
+        verify(c);
+        return;
+    }
+
+    if (sdccrm_run(c))
+    {
+        fprintf(stderr, "Could not process input files\n");
+        return;
+    }
+
+    if (stack() && sdccrm_stack_report(c, pipe ? stderr : stdout))
+    {
+        fprintf(stderr, "Could not analyse stack usage\n");
+    }
+
+    if (layout() && sdccrm_layout_report(c, pipe ? stderr : stdout))
+    {
+        fprintf(stderr, "Could not lay out functions\n");
+    }
+
+    for (size_t i = 0; i < n_why(); i++)
+    {
+        if (sdccrm_why(c, why(i), pipe ? stderr : stdout))
+        {
+            fprintf(stderr, "Could not find why %s is kept\n", why(i));
+        }
+    }
+
+    if (why_all() && sdccrm_why_all(c, pipe ? stderr : stdout))
+    {
+        fprintf(stderr, "Could not find which labels are kept by every root\n");
+    }
+
+    if (pipe)
+    {
+        write_stream(c, stdout);
+    }
+    else if (mode() == MODE_MERGE)
+    {
+        write_plans(c);
+    }
+    else if (mode() == MODE_REL)
+    {
+        write_removed(c);
+    }
+    else
+    {
+        write_outputs(c);
+    }
+}
+
+static int add_stream_file(struct sdccrm *const c, const char *const name, const char *const begin, const char *const end)
+{
+    /* Skip chunks made only of blanks and comments,
+     * e.g.: a banner before the first marker. */
+    for (const char *p = begin; p < end; p++)
+    {
+        if (*p == ';')
+        {
+            while (p < end && *p != '\n')
+            {
+                p++;
+            }
+        }
+        else if (!isspace((unsigned char)*p))
+        {
+            return sdccrm_add_buffer(c, name, begin, end - begin);
+        }
+    }
+
+    return 0;
+}
+
+static int read_stream(struct sdccrm *const c, FILE *const f)
+{
+    const uint64_t start = trace_begin();
+    struct strbuf in = {0};
+    char chunk[BUFSIZ];
+    size_t n;
+    int ret = 0;
+
+    while ((n = fread(chunk, sizeof *chunk, sizeof chunk, f)))
+    {
+        if (!strbuf_append(&in, chunk, n))
+        {
+            return ENOMEM;
+        }
+    }
+
+    if (ferror(f) || !in.data)
+    {
+        alloc_free(in.data);
+        return ferror(f) ? EIO : EINVAL;
+    }
+
+    trace_end(start, "read", &(const struct trace_args){.file = "<stdin>", .bytes = in.len});
+
+    /* Split the stream at file markers. Text before the first
+     * marker, if any, is handled as an anonymous file. */
+    char name[MAX_CH_PER_LINE] = "<stdin>";
+    const char *begin = in.data;
+
+    for (const char *p = in.data; p && *p && !ret; )
+    {
+        const char *const eol = strchr(p, '\n');
+        const char *const next = eol ? eol + 1 : p + strlen(p);
+
+        if (!strncmp(p, FILE_MARKER, static_strlen(FILE_MARKER)))
+        {
+            ret = add_stream_file(c, name, begin, p);
+
+            const char *const n = p + static_strlen(FILE_MARKER);
+            size_t len = (eol ? eol : next) - n;
+
+            while (len && isspace((unsigned char)n[len - 1]))
+            {
+                len--;
+            }
+
+            if (len >= sizeof name)
+            {
+                len = sizeof name - 1;
+            }
+
+            memcpy(name, n, len);
+            name[len] = '\0';
+            begin = next;
+        }
+
+        p = next;
+    }
+
+    if (!ret)
+    {
+        ret = add_stream_file(c, name, begin, in.data + in.len);
+    }
+
+    alloc_free(in.data);
+    return ret;
+}
+
+static void write_stream(const struct sdccrm *const c, FILE *const f)
+{
+    for (size_t i = 0; i < sdccrm_n_results(c); i++)
+    {
+        const uint64_t start = trace_begin();
+        const struct sdccrm_result *const r = sdccrm_get_result(c, i);
+
+        if (r->config)
+        {
+            fprintf(f, FILE_MARKER "%s/%s\n", r->config, r->name);
+        }
+        else
+        {
+            fprintf(f, FILE_MARKER "%s\n", r->name);
+        }
+
+        if (fwrite(r->output, sizeof *r->output, r->output_len, f) != r->output_len)
+        {
+            fprintf(stderr, "Could not write %s to stdout\n", r->name);
+        }
+
+        trace_end(start, "write", &(const struct trace_args)
+            {
+                .file = r->name,
+                .bytes = r->output_len
+            });
+    }
+
+    fflush(f);
+}
+
+static char *output_name(const char *const name, const char *const config, const char *const default_suffix)
+{
+    const struct output *const o = get_output(config);
+    /* Configurations are written into a directory of their own by default. */
+    const char *const dir = o->dir ? o->dir : config;
+    const char *const suffix = o->suffix ? o->suffix : default_suffix;
+    const char *base = name;
+
+    if (dir)
+    {
+        const char *const slash = strrchr(name, '/');
+
+        if (slash)
+            base = slash + 1;
+
+        if (mkdir(dir, 0777) && errno != EEXIST)
+        {
+            fprintf(stderr, "Could not create directory %s\n", dir);
+        }
+
+        errno = 0;
+    }
+
+    const size_t len = (dir ? strlen(dir) + 1 : 0) + strlen(base) + strlen(suffix) + 1;
+    char *const n = alloc_buf(len * sizeof *n, ALLOC_OUTPUT_NAME);
+
+    if (n)
+    {
+        snprintf(n, len, "%s%s%s%s", dir ? dir : "", dir ? "/" : "", base, suffix);
+    }
+
+    return n;
+}
+
+static char **output_names(const size_t n, const char *const *const names, const char *const *const configs,
+    const char *const suffix, const bool replace)
+{
+    char **const paths = alloc_(NULL, sizeof *paths, n, ALLOC_OUTPUT_NAME);
+
+    if (!paths)
+    {
+        fprintf(stderr, "Could not allocate output file names\n");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *const config = configs ? configs[i] : NULL;
+
+        if (replace && !config)
+        {
+            const size_t len = strlen(names[i]) + 1;
+
+            if ((paths[i] = alloc_buf(len * sizeof *paths[i], ALLOC_OUTPUT_NAME)))
+                memcpy(paths[i], names[i], len);
+        }
+        else
+        {
+            paths[i] = output_name(names[i], config, suffix);
+        }
+
+        if (!paths[i])
+        {
+            fprintf(stderr, "Could not allocate output file name for %s\n", names[i]);
+            free_names(paths, i);
+            return NULL;
+        }
+    }
+
+    return paths;
+}
+
+static void free_names(char **const names, const size_t n)
 {
-    struct tree t = get_function_list(n_files, files);
+    if (names)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            alloc_free(names[i]);
+        }
+
+        alloc_free(names);
+    }
+}
+
+static char **result_names(const struct sdccrm *const c, const char *const suffix, const bool replace)
+{
+    const size_t n = sdccrm_n_results(c);
+    const char **const names = alloc_(NULL, sizeof *names, n, ALLOC_TABLE);
+    const char **const configs = alloc_(NULL, sizeof *configs, n, ALLOC_TABLE);
+    char **paths = NULL;
+
+    if (names && configs)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            const struct sdccrm_result *const r = sdccrm_get_result(c, i);
 
-    find_references(&t);
+            names[i] = r->name;
+            configs[i] = r->config;
+        }
+
+        paths = output_names(n, names, configs, suffix, replace);
+    }
 
-    remove_unused(&t);
+    alloc_free(names);
+    alloc_free(configs);
 
-    cleanup(&t);
-    options_cleanup();
+    return paths;
 }
 
-static void cleanup(struct tree *const t)
+static void write_outputs(const struct sdccrm *const c)
 {
-    if (t->files)
+    const size_t n = sdccrm_n_results(c);
+
+    if (replace() && n && sdccrm_get_result(c, 0)->config)
     {
-        for (size_t i = 0; i < t->n_files; i++)
+        fprintf(stderr, "-r is ignored when using configurations\n");
+    }
+
+    char **const paths = result_names(c, extension, replace());
+
+    if (paths)
+    {
+        const int ret = sdccrm_write_files(c, (const char *const *)paths);
+
+        if (ret)
         {
-            struct file *const f = &t->files[i];
+            fprintf(stderr, "Could not write output files\n");
+            /* Returned as exit status. */
+            errno = ret;
+        }
+
+        free_names(paths, n);
+    }
+}
+
+/* Writes n buffers obtained through one of the sdccrm_get_*() functions. */
+static void write_data(const size_t n, char *const *const paths, void **const bufs, const size_t *const lens)
+{
+    const int ret = write_files(n, (const char *const *)paths, (const char *const *)bufs, lens);
+
+    if (ret)
+    {
+        fprintf(stderr, "Could not write output files\n");
+        /* Returned as exit status. */
+        errno = ret;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        sdccrm_free_data(bufs[i]);
+    }
+}
+
+static void summarize(struct sdccrm *const c, const size_t n_files, const char *const *const files)
+{
+    /* Files are added in order until one cannot be read. */
+    sdccrm_add_files(c, n_files, files);
+
+    const size_t n = sdccrm_n_inputs(c);
+    char **const paths = output_names(n, files, NULL, summary_extension, false);
+    void **const bufs = alloc_(NULL, sizeof *bufs, n, ALLOC_TABLE);
+    size_t *const lens = alloc_(NULL, sizeof *lens, n, ALLOC_TABLE);
+
+    if (paths && bufs && lens)
+    {
+        size_t i;
 
-            if (f->labels)
+        for (i = 0; i < n; i++)
+        {
+            if (sdccrm_get_summary(c, i, &bufs[i], &lens[i]))
+            {
+                fprintf(stderr, "Could not summarize %s\n", files[i]);
+                break;
+            }
+        }
+
+        write_data(i, paths, bufs, lens);
+    }
+
+    free_names(paths, n);
+    alloc_free(bufs);
+    alloc_free(lens);
+}
+
+static void write_plans(const struct sdccrm *const c)
+{
+    const size_t n = sdccrm_n_results(c);
+    char **const paths = result_names(c, plan_extension, false);
+    void **const bufs = alloc_(NULL, sizeof *bufs, n, ALLOC_TABLE);
+    size_t *const lens = alloc_(NULL, sizeof *lens, n, ALLOC_TABLE);
+
+    if (paths && bufs && lens)
+    {
+        size_t i;
+
+        for (i = 0; i < n; i++)
+        {
+            if (sdccrm_get_plan(c, i, &bufs[i], &lens[i]))
             {
-                for (size_t j = 0; j < f->n_labels; j++)
+                fprintf(stderr, "Could not make removal plan for %s\n", sdccrm_get_result(c, i)->name);
+                break;
+            }
+        }
+
+        write_data(i, paths, bufs, lens);
+    }
+
+    free_names(paths, n);
+    alloc_free(bufs);
+    alloc_free(lens);
+}
+
+static int add_summary(void *const arg, const size_t i, char *const buf, const size_t len)
+{
+    struct sdccrm *const c = arg;
+    const int ret = sdccrm_add_summary(c, buf, len);
+
+    (void)i;
+
+    if (ret)
+    {
+        fprintf(stderr, "Invalid summary file\n");
+    }
+
+    alloc_free(buf);
+    return ret;
+}
+
+static int add_rel(void *const arg, const size_t i, char *const buf, const size_t len)
+{
+    const struct rel_files *const r = arg;
+    const int ret = sdccrm_add_rel(r->c, r->paths[i], buf, len);
+
+    if (ret)
+    {
+        fprintf(stderr, "Invalid object file %s\n", r->paths[i]);
+    }
+
+    alloc_free(buf);
+    return ret;
+}
+
+static void verify(struct sdccrm *const c)
+{
+    size_t n_diff;
+
+    if (sdccrm_verify(c, stdout, &n_diff))
+    {
+        fprintf(stderr, "Could not verify input files\n");
+    }
+    else if (n_diff)
+    {
+        fprintf(stderr, "%zu differences found against the reference engine\n", n_diff);
+        /* Returned as exit status, so test runs fail. */
+        errno = EDOM;
+    }
+    else
+    {
+        printf("No differences found against the reference engine\n");
+    }
+}
+
+static void write_removed(const struct sdccrm *const c)
+{
+    const size_t n = sdccrm_n_results(c);
+    char **const paths = result_names(c, removed_extension, false);
+    void **const bufs = alloc_(NULL, sizeof *bufs, n, ALLOC_TABLE);
+    size_t *const lens = alloc_(NULL, sizeof *lens, n, ALLOC_TABLE);
+
+    if (paths && bufs && lens)
+    {
+        size_t i;
+
+        for (i = 0; i < n; i++)
+        {
+            const struct sdccrm_result *const r = sdccrm_get_result(c, i);
+            struct strbuf out = {0};
+            bool ok = strbuf_append(&out, "", 0);
+
+            /* One name per line, as read by --removed. */
+            for (size_t j = 0; ok && j < r->n_removed; j++)
+            {
+                ok = strbuf_append(&out, r->removed[j], strlen(r->removed[j]))
+                    && strbuf_append(&out, "\n", 1);
+            }
+
+            if (!ok)
+            {
+                fprintf(stderr, "Could not list removed labels for %s\n", r->name);
+                alloc_free(out.data);
+                break;
+            }
+
+            bufs[i] = out.data;
+            lens[i] = out.len;
+        }
+
+        write_data(i, paths, bufs, lens);
+    }
+
+    free_names(paths, n);
+    alloc_free(bufs);
+    alloc_free(lens);
+}
+
+struct texts
+{
+    char **bufs;
+    size_t *lens;
+};
+
+static int keep_text(void *const arg, const size_t i, char *const buf, const size_t len)
+{
+    struct texts *const t = arg;
+
+    t->bufs[i] = buf;
+    t->lens[i] = len;
+    return 0;
+}
+
+static void apply(const size_t n_files, const char *const *const files)
+{
+    /* Input files come first, followed by their plans. */
+    char **const plans = output_names(n_files, files, NULL, plan_extension, false);
+    char **const paths = output_names(n_files, files, NULL, extension, replace());
+    const char **const in = alloc_(NULL, sizeof *in, 2 * n_files, ALLOC_TABLE);
+    struct texts t =
+    {
+        .bufs = alloc_(NULL, sizeof *t.bufs, 2 * n_files, ALLOC_TABLE),
+        .lens = alloc_(NULL, sizeof *t.lens, 2 * n_files, ALLOC_TABLE)
+    };
+    void **const outs = alloc_(NULL, sizeof *outs, n_files, ALLOC_TABLE);
+    size_t *const out_lens = alloc_(NULL, sizeof *out_lens, n_files, ALLOC_TABLE);
+
+    int error = ENOMEM;
+
+    if (plans && paths && in && t.bufs && t.lens && outs && out_lens)
+    {
+        size_t n = 0;
+
+        memset(t.bufs, 0, 2 * n_files * sizeof *t.bufs);
+
+        for (size_t i = 0; i < n_files; i++)
+        {
+            in[i] = files[i];
+            in[n_files + i] = plans[i];
+        }
+
+        if (!(error = read_files(2 * n_files, in, keep_text, &t)))
+        {
+            for (; n < n_files; n++)
+            {
+                if ((error = sdccrm_apply_plan(t.bufs[n], t.lens[n], t.bufs[n_files + n],
+                    t.lens[n_files + n], (char **)&outs[n], &out_lens[n])))
                 {
-                    struct label *const l = &f->labels[j];
-
-                    if (l->calls)
-                    {
-                        for (size_t k = 0; k < l->n_calls; k++)
-                        {
-                            free(l->calls[k]);
-                        }
-
-                        free(l->calls);
-                    }
-
-                    if (l->name)
-                    {
-                        free(l->name);
-                    }
+                    fprintf(stderr, error == ESTALE ? "%s does not match %s\n"
+                        : "Could not apply %s to %s\n", plans[n], files[n]);
+                    break;
                 }
-
-                free(f->labels);
             }
         }
 
-        free(t->files);
+        write_data(n, paths, outs, out_lens);
+
+        for (size_t i = 0; i < 2 * n_files; i++)
+        {
+            alloc_free(t.bufs[i]);
+        }
     }
+
+    free_names(plans, n_files);
+    free_names(paths, n_files);
+    alloc_free(in);
+    alloc_free(t.bufs);
+    alloc_free(t.lens);
+    alloc_free(outs);
+    alloc_free(out_lens);
+
+    /* Returned as exit status, so builds do not go on
+     * with outputs left over from the previous revision. */
+    if (error)
+        errno = error;
 }
@@ -0,0 +1,895 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Split stage, run once a file is filtered. Kept labels in code
+ * areas are moved out of the module into up to c->split - 1 other
+ * ones, so the assembler can be run on all of them at once. Every
+ * module starts with the same header and .globl directives, so
+ * symbols defined in any other module are imported, and labels are
+ * preceded by the .area directive in effect for them. Labels that
+ * must share a module are grouped first: those falling through into
+ * the next one, and static symbols, e.g.: "_counter:" in DATA, with
+ * every label referencing them, since those are only visible within
+ * a module. Groups are then
+ * given, largest first, to the module they share most references
+ * with among those with room left for them. */
+
+#include "split.h"
+#include "classify.h"
+#include "peephole.h"
+#include "graph.h"
+#include "alloc.h"
+#include "common.h"
+#include "trace.h"
+#include "log.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODULE_DIRECTIVE ".module"
+
+/* Symbol defined or declared in the file, and the label
+ * holding it, or pinned. */
+struct symbol
+{
+    const char *name;
+    size_t len;
+    size_t owner;
+};
+
+/* Reference between two groups, by their roots. */
+struct edge
+{
+    size_t from;
+    size_t to;
+};
+
+struct split
+{
+    const struct file *f;
+    const struct text_line *lines;
+    size_t n_lines;
+    /* Sets of label indices within f sharing a module, where pinned
+     * (i.e.: f->n_labels) stands for the first module. */
+    struct sets sets;
+    /* Module every group is given to, only valid for roots. */
+    size_t *module;
+    size_t n_modules;
+    /* Kept label found in a code area. */
+    bool *movable;
+    /* .area directive in effect for every label, as written, and
+     * the line it is written at. */
+    struct text_line *area;
+    size_t *area_line;
+    /* The edit on the label line writes the directive itself. */
+    bool *own;
+    /* Equates found outside any label, e.g.: "_P0 = 0x0080", which
+     * are copied into every module. */
+    size_t *equates;
+    size_t n_equates;
+    /* Symbols defined by label lines in any area, and those
+     * declared by .globl directives. Sorted once scanned. */
+    struct symbol *defined, *globals;
+    size_t n_defined, n_globals;
+    struct edge *edges;
+    size_t n_edges;
+    /* Lines of the first .area and .module directives, or 0. */
+    size_t first_area;
+    size_t module_line;
+};
+
+static int scan_file(const struct sdccrm *c, const struct config *cfg, size_t file, const struct plan *p,
+    struct split *s);
+static int visit_line(void *arg, const struct scanned_line *sl);
+static void join_relative(const struct sdccrm *c, size_t file, struct split *s, size_t k, const char *line,
+    const struct line_info *li);
+static void join_static(const struct sdccrm *c, size_t file, struct split *s, size_t k, size_t to);
+static int constrain(const struct sdccrm *c, const struct config *cfg, size_t file, struct split *s);
+static int join_symbols(const struct sdccrm *c, const struct config *cfg, struct split *s);
+static int visit_symbols(void *arg, const struct scanned_line *sl);
+static int add_symbol(struct symbol **list, size_t *n, const char *name, size_t len, size_t owner);
+static const struct symbol *find_symbol(const struct symbol *list, size_t n, const char *name, size_t len);
+static size_t symbol_len(const char *p);
+static size_t static_definition(const char *line);
+static int add_edges(const struct sdccrm *c, const struct config *cfg, size_t file, struct split *s);
+static int balance(const struct sdccrm *c, struct split *s);
+static size_t first_edge(const struct split *s, size_t root);
+static int add_prefix(struct plan *q, const struct plan *p, size_t *e, size_t line, const struct text_line *area,
+    const char *text);
+static int add_span(struct plan *q, const size_t *keep, size_t n_keep, size_t start, size_t end);
+static int write_module(const struct config *cfg, const char *text, const struct plan *p, struct split *s,
+    size_t m, struct strbuf *out);
+static bool find_area(const char *text, struct text_line *area);
+static size_t module_of(struct split *s, const struct config *cfg, size_t k);
+
+int split_output(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    const char *const text, const struct plan *const p, struct sdccrm_result *const r)
+{
+    const struct file *const f = &c->tree.files[file];
+    const size_t n = f->n_labels;
+    const uint64_t start = trace_begin();
+    struct split s = {.f = f};
+    struct sdccrm_part *parts = NULL;
+    size_t moved = 0, written = 0;
+    int ret = 0;
+
+    s.lines = index_lines(text, &s.n_lines);
+    ret = init_sets(&s.sets, n);
+    s.module = alloc_(NULL, sizeof *s.module, n + 1, ALLOC_TABLE);
+    s.movable = alloc_(NULL, sizeof *s.movable, n, ALLOC_TABLE);
+    s.area = alloc_(NULL, sizeof *s.area, n, ALLOC_TABLE);
+    s.area_line = alloc_(NULL, sizeof *s.area_line, n, ALLOC_TABLE);
+    s.own = alloc_(NULL, sizeof *s.own, n, ALLOC_TABLE);
+
+    if (ret || !s.lines || !s.module || !s.movable || !s.area || !s.area_line || !s.own)
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    for (size_t i = 0; i <= n; i++)
+    {
+        s.module[i] = SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        s.movable[i] = s.own[i] = false;
+        s.area[i] = (struct text_line){0};
+        s.area_line[i] = 0;
+    }
+
+    if ((ret = scan_file(c, cfg, file, p, &s)) || (ret = constrain(c, cfg, file, &s)))
+        goto end;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (cfg->used[f->labels[i].id])
+            s.sets.size[find_set(&s.sets, i)] += f->labels[i].size;
+    }
+
+    if ((ret = add_edges(c, cfg, file, &s)) || (ret = balance(c, &s)) || s.n_modules < 2)
+        goto end;
+
+    if (!(parts = alloc_(NULL, sizeof *parts, s.n_modules, ALLOC_TABLE)))
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    for (; written < s.n_modules && !ret; written++)
+    {
+        struct strbuf out = {0};
+
+        /* Empty outputs are still valid, null-terminated strings. */
+        if ((ret = write_module(cfg, text, p, &s, written, &out)) || (!out.data && !strbuf_append(&out, "", 0)))
+        {
+            alloc_free(out.data);
+            ret = ENOMEM;
+            break;
+        }
+
+        parts[written] = (struct sdccrm_part){.output = out.data, .output_len = out.len};
+    }
+
+    if (ret)
+        goto end;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const size_t m = module_of(&s, cfg, i);
+
+        if (m)
+        {
+            LOG(c, SDCCRM_LOG_DEBUG, f->name, f->labels[i].name, "moved into module %zu", m);
+            moved++;
+        }
+    }
+
+    LOG(c, SDCCRM_LOG_INFO, f->name, NULL, "%zu labels moved into %zu other modules", moved, s.n_modules - 1);
+
+    r->parts = parts;
+    r->n_parts = s.n_modules;
+    parts = NULL;
+
+end:
+
+    if (parts)
+    {
+        for (size_t i = 0; i < written; i++)
+        {
+            alloc_free((char *)parts[i].output);
+        }
+
+        alloc_free(parts);
+    }
+
+    alloc_free((struct text_line *)s.lines);
+    free_sets(&s.sets);
+    alloc_free(s.module);
+    alloc_free(s.movable);
+    alloc_free(s.area);
+    alloc_free(s.area_line);
+    alloc_free(s.own);
+    alloc_free(s.equates);
+    alloc_free(s.defined);
+    alloc_free(s.globals);
+    alloc_free(s.edges);
+
+    trace_end(start, "split", &(const struct trace_args){.file = f->name, .labels = moved});
+
+    return ret;
+}
+
+/* Arguments to visit_line() and visit_symbols(). */
+struct scan
+{
+    const struct sdccrm *c;
+    const struct config *cfg;
+    size_t file;
+    const struct plan *p;
+    struct split *s;
+    /* Next edit, and last .area directive written, either found
+     * in text or by an edit, and its line. */
+    size_t e;
+    struct text_line area;
+    size_t area_line;
+};
+
+static int scan_file(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    const struct plan *const p, struct split *const s)
+{
+    struct scan sc = {.c = c, .cfg = cfg, .file = file, .p = p, .s = s};
+
+    return scan_areas(c->port, s->f, s->lines, s->n_lines, cfg->used, 0, &s->sets, visit_line, &sc);
+}
+
+static int visit_line(void *const arg, const struct scanned_line *const sl)
+{
+    struct scan *const sc = arg;
+    struct split *const s = sc->s;
+    const struct plan *const p = sc->p;
+    const struct file *const f = s->f;
+    const size_t ln = sl->ln, k = sl->owner;
+    const char *const line = sl->line;
+    /* Kept label whose span holds the line, if any. */
+    const bool used = k != SIZE_MAX && sc->cfg->used[f->labels[k].id];
+
+    while (sc->e < p->n_edits && p->edits[sc->e].line < ln)
+    {
+        sc->e++;
+    }
+
+    if (sl->kind == SCANNED_LABEL)
+    {
+        /* e.g.: ".area CODE_1", written by the layout stage. */
+        if (sc->e < p->n_edits && p->edits[sc->e].line == ln && find_area(p->edits[sc->e].text, &sc->area))
+        {
+            s->own[k] = true;
+            sc->area_line = ln;
+        }
+
+        s->area[k] = sc->area;
+        s->area_line[k] = sc->area_line;
+        s->movable[k] = used && sl->code;
+
+        if (used && static_definition(line))
+            return add_symbol(&s->defined, &s->n_defined, s->lines[ln - 1].start, static_definition(line), k);
+
+        return 0;
+    }
+    else if (sl->kind == SCANNED_AREA)
+    {
+        sc->area = s->lines[ln - 1];
+        sc->area_line = ln;
+
+        if (!s->first_area)
+            s->first_area = ln;
+
+        return 0;
+    }
+    else if (!s->first_area && !s->module_line && !strncmp(line, MODULE_DIRECTIVE, static_strlen(MODULE_DIRECTIVE)))
+    {
+        s->module_line = ln;
+    }
+
+    if (used && sl->li.kind == LINE_CALL)
+        join_relative(sc->c, sc->file, s, k, line, &sl->li);
+
+    /* Operands point into line, not into the input text. */
+    if (sl->li.kind == LINE_GLOBAL)
+        return add_symbol(&s->globals, &s->n_globals, s->lines[ln - 1].start + (sl->li.operand - line),
+            sl->li.operand_len, SIZE_MAX);
+    /* e.g.: "_counter:" in DATA, or "__helper:" within a label. */
+    else if (static_definition(line) && (k == SIZE_MAX || used))
+        return add_symbol(&s->defined, &s->n_defined, s->lines[ln - 1].start, static_definition(line),
+            k != SIZE_MAX ? k : s->sets.pinned);
+    /* e.g.: "_P0 = 0x0080", "_f = _g" or "A == 1". */
+    else if (s->first_area && k == SIZE_MAX && (isalpha((unsigned char)*line) || *line == '_')
+        && strchr(line, '=') && sl->li.kind == LINE_OTHER)
+    {
+        if (!(s->equates = alloc(s->equates, s->n_equates, ALLOC_TABLE)))
+        {
+            s->n_equates = 0;
+            return ENOMEM;
+        }
+
+        s->equates[s->n_equates++] = ln;
+    }
+
+    return 0;
+}
+
+static void join_relative(const struct sdccrm *const c, const size_t file, struct split *const s, const size_t k,
+    const char *const line, const struct line_info *const li)
+{
+    const size_t digits = strspn(li->operand, "0123456789");
+    bool call;
+
+    /* Jumps within the label, e.g.: "jp 00102$". */
+    if (digits && li->operand[digits] == '$')
+        return;
+
+    const size_t to = resolve_label(&c->tree, file, li->operand);
+
+    /* Relative forms, e.g.: "jra _f", only reach within a module. */
+    if (to != SIZE_MAX && !find_tail(c->port, line, &call) && c->tree.labels[to]->file == file)
+        join_sets(&s->sets, k, c->tree.labels[to] - s->f->labels);
+}
+
+static void join_static(const struct sdccrm *const c, const size_t file, struct split *const s, const size_t k,
+    const size_t to)
+{
+    const struct label *const l = c->tree.labels[to];
+
+    /* Static labels are only visible within the module. */
+    if (l->file == file && !l->global)
+        join_sets(&s->sets, k, l - s->f->labels);
+}
+
+static int constrain(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    struct split *const s)
+{
+    const struct tree *const t = &c->tree;
+    const struct file *const f = s->f;
+
+    for (size_t k = 0; k < f->n_labels; k++)
+    {
+        const struct label *const l = &f->labels[k];
+
+        if (!cfg->used[l->id])
+            continue;
+        /* e.g.: data, interrupt vectors or startup code. */
+        else if (!s->movable[k])
+            join_sets(&s->sets, k, s->sets.pinned);
+
+        for (size_t j = 0; j < l->n_callees; j++)
+        {
+            const size_t to = l->callees[j];
+
+            join_static(c, file, s, k, to);
+
+            /* Calls to trampolines might go to their targets instead. */
+            if (c->trampolines && c->trampolines[to].target != SIZE_MAX)
+                join_static(c, file, s, k, c->trampolines[to].target);
+        }
+    }
+
+    /* Static labels referenced from outside any label. */
+    for (size_t i = 0; i < t->n_roots; i++)
+    {
+        const struct label *const l = t->labels[t->roots[i]];
+
+        if (l->file == file && !l->global)
+            join_sets(&s->sets, l - f->labels, s->sets.pinned);
+    }
+
+    return join_symbols(c, cfg, s);
+}
+
+static int compare_symbols(const void *const a, const void *const b)
+{
+    const struct symbol *const sa = a, *const sb = b;
+    const int cmp = memcmp(sa->name, sb->name, sa->len < sb->len ? sa->len : sb->len);
+
+    return cmp ? cmp : (sa->len > sb->len) - (sa->len < sb->len);
+}
+
+static int join_symbols(const struct sdccrm *const c, const struct config *const cfg, struct split *const s)
+{
+    struct scan sc = {.c = c, .cfg = cfg, .s = s};
+
+    if (!s->n_defined)
+        return 0;
+
+    qsort(s->defined, s->n_defined, sizeof *s->defined, compare_symbols);
+
+    if (s->n_globals)
+        qsort(s->globals, s->n_globals, sizeof *s->globals, compare_symbols);
+
+    /* Labels falling into each other are joined again, to no effect. */
+    return scan_areas(c->port, s->f, s->lines, s->n_lines, cfg->used, 0, &s->sets, visit_symbols, &sc);
+}
+
+static int visit_symbols(void *const arg, const struct scanned_line *const sl)
+{
+    const struct scan *const sc = arg;
+    struct split *const s = sc->s;
+    const size_t k = sl->owner;
+    const char *const line = sl->line;
+
+    if (sl->kind != SCANNED_OTHER || get_global(line) || static_definition(line)
+        || (k != SIZE_MAX && !sc->cfg->used[s->f->labels[k].id]))
+        return 0;
+
+    /* Operands naming a static symbol, e.g.: "ld a, _counter+0",
+     * but not the mnemonic or directive itself. */
+    for (const char *p = line + strcspn(line, " \t"); *p; )
+    {
+        const size_t n = symbol_len(p);
+
+        if (!n)
+        {
+            /* Skips numbers as a whole, e.g.: "0x12ab" or "00102$". */
+            const size_t skip = strspn(p, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$.");
+
+            p += skip ? skip : 1;
+            continue;
+        }
+
+        const struct symbol *const d = find_symbol(s->defined, s->n_defined, p, n);
+
+        if (d && !find_symbol(s->globals, s->n_globals, p, n))
+            join_sets(&s->sets, k != SIZE_MAX ? k : s->sets.pinned, d->owner);
+
+        p += n;
+    }
+
+    return 0;
+}
+
+static int add_symbol(struct symbol **const list, size_t *const n, const char *const name, const size_t len,
+    const size_t owner)
+{
+    if (!(*list = alloc(*list, *n, ALLOC_TABLE)))
+    {
+        *n = 0;
+        return ENOMEM;
+    }
+
+    (*list)[(*n)++] = (struct symbol){.name = name, .len = len, .owner = owner};
+
+    return 0;
+}
+
+static const struct symbol *find_symbol(const struct symbol *const list, const size_t n, const char *const name,
+    const size_t len)
+{
+    const struct symbol key = {.name = name, .len = len};
+
+    return n ? bsearch(&key, list, n, sizeof *list, compare_symbols) : NULL;
+}
+
+static size_t symbol_len(const char *const p)
+{
+    /* e.g.: "_counter" or "__helper", but not "00102$". */
+    if (!isalpha((unsigned char)*p) && *p != '_')
+        return 0;
+
+    return strspn(p, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$.");
+}
+
+static size_t static_definition(const char *const line)
+{
+    /* e.g.: "_counter:", but not "_f::", which is global. Returns
+     * the length of the name, or 0. */
+    const size_t n = symbol_len(line);
+
+    return n && line[n] == ':' && line[n + 1] != ':' ? n : 0;
+}
+
+static int add_edges(const struct sdccrm *const c, const struct config *const cfg, const size_t file,
+    struct split *const s)
+{
+    const struct file *const f = s->f;
+
+    for (size_t k = 0; k < f->n_labels; k++)
+    {
+        const struct label *const l = &f->labels[k];
+
+        for (size_t j = 0; s->movable[k] && j < l->n_callees; j++)
+        {
+            const struct label *const to = c->tree.labels[l->callees[j]];
+
+            if (to->file != file || !cfg->used[to->id])
+                continue;
+
+            const size_t a = find_set(&s->sets, k), b = find_set(&s->sets, to - f->labels);
+
+            if (a == b)
+                continue;
+            else if (!(s->edges = alloc_(s->edges, sizeof *s->edges, s->n_edges + 1, ALLOC_TABLE)))
+            {
+                s->n_edges = 0;
+                return ENOMEM;
+            }
+
+            /* Looked up by either end. */
+            s->edges[s->n_edges++] = (struct edge){.from = a, .to = b};
+            s->edges[s->n_edges++] = (struct edge){.from = b, .to = a};
+        }
+    }
+
+    return 0;
+}
+
+static int compare_edges(const void *const a, const void *const b)
+{
+    const struct edge *const ea = a, *const eb = b;
+
+    if (ea->from != eb->from)
+        return ea->from > eb->from ? 1 : -1;
+
+    return (ea->to > eb->to) - (ea->to < eb->to);
+}
+
+static int compare_roots(const void *const a, const void *const b)
+{
+    const struct set_size *const ga = a, *const gb = b;
+
+    return (ga->root > gb->root) - (ga->root < gb->root);
+}
+
+static int balance(const struct sdccrm *const c, struct split *const s)
+{
+    const struct file *const f = s->f;
+    const size_t n = c->split;
+    struct set_size *const groups = alloc_(NULL, sizeof *groups, f->n_labels, ALLOC_TABLE);
+    size_t *const load = alloc_(NULL, sizeof *load, n, ALLOC_TABLE);
+    size_t *const weight = alloc_(NULL, sizeof *weight, n, ALLOC_TABLE);
+    size_t *const renumber = alloc_(NULL, sizeof *renumber, n, ALLOC_TABLE);
+    size_t n_groups = 0, unique = 0, total = 0;
+
+    s->n_modules = 0;
+
+    if (!groups || !load || !weight || !renumber)
+    {
+        alloc_free(groups);
+        alloc_free(load);
+        alloc_free(weight);
+        alloc_free(renumber);
+        return ENOMEM;
+    }
+
+    for (size_t k = 0; k < f->n_labels; k++)
+    {
+        const size_t r = find_set(&s->sets, k);
+
+        if (s->movable[k] && r != s->sets.pinned)
+            groups[n_groups++] = (struct set_size){.root = r, .size = s->sets.size[r]};
+    }
+
+    qsort(groups, n_groups, sizeof *groups, compare_roots);
+
+    /* Every label in a group found its root. */
+    for (size_t i = 0; i < n_groups; i++)
+    {
+        if (!unique || groups[unique - 1].root != groups[i].root)
+        {
+            groups[unique++] = groups[i];
+            total += groups[i].size;
+        }
+    }
+
+    n_groups = unique;
+
+    qsort(groups, n_groups, sizeof *groups, compare_set_sizes);
+
+    if (s->n_edges)
+        qsort(s->edges, s->n_edges, sizeof *s->edges, compare_edges);
+
+    total += s->sets.size[s->sets.pinned];
+
+    /* Every module is given about the same share, rounded up. */
+    const size_t share = total / n + !!(total % n);
+
+    for (size_t m = 0; m < n; m++)
+    {
+        load[m] = renumber[m] = 0;
+    }
+
+    load[0] = s->sets.size[s->sets.pinned];
+    s->module[s->sets.pinned] = 0;
+
+    for (size_t i = 0; i < n_groups; i++)
+    {
+        const struct set_size *const g = &groups[i];
+        size_t best = SIZE_MAX;
+
+        for (size_t m = 0; m < n; m++)
+        {
+            weight[m] = 0;
+        }
+
+        for (size_t e = first_edge(s, g->root); e < s->n_edges && s->edges[e].from == g->root; e++)
+        {
+            const size_t m = s->module[s->edges[e].to];
+
+            if (m != SIZE_MAX)
+                weight[m]++;
+        }
+
+        for (size_t m = 0; m < n; m++)
+        {
+            if (load[m] + g->size > share)
+                continue;
+            else if (best == SIZE_MAX || weight[m] > weight[best]
+                || (weight[m] == weight[best] && load[m] < load[best]))
+                best = m;
+        }
+
+        /* Larger than any room left, so into the emptiest module. */
+        if (best == SIZE_MAX)
+        {
+            best = 0;
+
+            for (size_t m = 1; m < n; m++)
+            {
+                if (load[m] < load[best])
+                    best = m;
+            }
+        }
+
+        s->module[g->root] = best;
+        load[best] += g->size;
+        renumber[best]++;
+    }
+
+    /* Modules nothing was given to are not written. */
+    for (size_t m = 0; m < n; m++)
+    {
+        renumber[m] = !m || renumber[m] ? s->n_modules++ : SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < n_groups; i++)
+    {
+        s->module[groups[i].root] = renumber[s->module[groups[i].root]];
+    }
+
+    alloc_free(groups);
+    alloc_free(load);
+    alloc_free(weight);
+    alloc_free(renumber);
+
+    return 0;
+}
+
+static size_t first_edge(const struct split *const s, const size_t root)
+{
+    size_t lo = 0, hi = s->n_edges;
+
+    /* Edges are sorted by their first end. */
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (s->edges[mid].from < root)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int add_prefix(struct plan *const q, const struct plan *const p, size_t *const e, const size_t line,
+    const struct text_line *const area, const char *text)
+{
+    struct strbuf b = {0};
+    int ret = 0;
+
+    /* Edits before line are copied as they are. */
+    for (; *e < p->n_edits && p->edits[*e].line < line && !ret; ++*e)
+    {
+        ret = add_edit(q, p->edits[*e].line, p->edits[*e].text);
+    }
+
+    if (ret)
+        return ret;
+    else if (*e < p->n_edits && p->edits[*e].line == line)
+        text = p->edits[(*e)++].text;
+
+    if (!strbuf_append(&b, area->start, area->len) || !strbuf_append(&b, "\n", 1)
+        || !strbuf_append(&b, text, strlen(text)))
+        ret = ENOMEM;
+    else
+        ret = add_edit(q, line, b.data);
+
+    alloc_free(b.data);
+
+    return ret;
+}
+
+static int add_span(struct plan *const q, const size_t *const keep, const size_t n_keep, size_t start,
+    const size_t end)
+{
+    for (size_t i = 0; i < n_keep && start <= end; i++)
+    {
+        const size_t ln = keep[i];
+
+        if (ln < start || ln > end)
+            continue;
+        else if (ln > start)
+        {
+            if (!(q->spans = alloc(q->spans, q->n_spans, ALLOC_TABLE)))
+                return ENOMEM;
+
+            q->spans[q->n_spans++] = (struct span){.start = start, .end = ln - 1};
+        }
+
+        start = ln + 1;
+    }
+
+    if (start > end)
+        return 0;
+    else if (!(q->spans = alloc(q->spans, q->n_spans, ALLOC_TABLE)))
+        return ENOMEM;
+
+    q->spans[q->n_spans++] = (struct span){.start = start, .end = end};
+
+    return 0;
+}
+
+static int write_module(const struct config *const cfg, const char *const text, const struct plan *const p,
+    struct split *const s, const size_t m, struct strbuf *const out)
+{
+    const struct file *const f = s->f;
+    /* Global declarations are dropped as in the whole output. */
+    struct plan q = {.drop = p->drop, .n_drop = p->n_drop};
+    /* Line of the last .area directive found in an edit, and
+     * written for a label moved into another module. */
+    size_t moved = 0, e = 0, next = s->first_area;
+    const struct text_line *last = NULL;
+    int ret = 0;
+
+    for (size_t i = 0; i < p->n_spans && !ret; i++)
+    {
+        if (!(q.spans = alloc(q.spans, q.n_spans, ALLOC_TABLE)))
+            ret = ENOMEM;
+        else
+            q.spans[q.n_spans++] = p->spans[i];
+    }
+
+    if (!ret && m && s->module_line)
+    {
+        char line[MAX_CH_PER_LINE], edit[2 * MAX_CH_PER_LINE];
+        const char *name;
+
+        copy_line(&s->lines[s->module_line - 1], line);
+        name = line + static_strlen(MODULE_DIRECTIVE);
+
+        while (is_space(*name))
+        {
+            name++;
+        }
+
+        /* e.g.: ".module main_1". */
+        snprintf(edit, sizeof edit, "%.*s_%zu", (int)(strcspn(name, " \t;") + (name - line)), line, m);
+
+        for (; e < p->n_edits && p->edits[e].line < s->module_line && !ret; e++)
+        {
+            ret = add_edit(&q, p->edits[e].line, p->edits[e].text);
+        }
+
+        if (!ret)
+            ret = add_edit(&q, s->module_line, edit);
+
+        if (e < p->n_edits && p->edits[e].line == s->module_line)
+            e++;
+    }
+
+    for (size_t k = 0; k < f->n_labels && !ret; k++)
+    {
+        const struct label *const l = &f->labels[k];
+        /* Empty labels, e.g.: falling into the next one, only take
+         * their own line. */
+        const size_t end = l->end_line > l->start_line ? l->end_line : l->start_line;
+        const size_t in = module_of(s, cfg, k);
+        char line[MAX_CH_PER_LINE];
+
+        if (!cfg->used[l->id])
+            continue;
+
+        copy_line(&s->lines[l->start_line - 1], line);
+
+        if (!m && in)
+        {
+            /* Labels after this one might rely on its directive. */
+            if (s->own[k])
+                moved = l->start_line;
+
+            ret = add_span(&q, NULL, 0, l->start_line, end);
+        }
+        else if (!m && !s->own[k] && moved && s->area_line[k] == moved)
+        {
+            ret = add_prefix(&q, p, &e, l->start_line, &s->area[k], line);
+        }
+        else if (m && in == m)
+        {
+            /* Everything since the last label moved here is left out. */
+            if (l->start_line > next)
+                ret = add_span(&q, s->equates, s->n_equates, next, l->start_line - 1);
+
+            if (!ret && !s->own[k] && (!last || last->len != s->area[k].len
+                || memcmp(last->start, s->area[k].start, last->len)))
+                ret = add_prefix(&q, p, &e, l->start_line, &s->area[k], line);
+
+            last = &s->area[k];
+            next = end + 1;
+        }
+    }
+
+    if (!ret && m)
+        ret = add_span(&q, s->equates, s->n_equates, next, SIZE_MAX);
+
+    for (; e < p->n_edits && !ret; e++)
+    {
+        ret = add_edit(&q, p->edits[e].line, p->edits[e].text);
+    }
+
+    if (!ret)
+    {
+        merge_spans(&q);
+        write_filtered_file(out, &q, text);
+    }
+
+    q.drop = NULL;
+    free_plan(&q);
+
+    return ret;
+}
+
+static bool find_area(const char *text, struct text_line *const area)
+{
+    bool found = false;
+
+    /* Edits hold one line per statement, without indentation. */
+    for (const char *end; *text; text = *end ? end + 1 : end)
+    {
+        end = text + strcspn(text, "\n");
+
+        if (!strncmp(text, AREA_DIRECTIVE, static_strlen(AREA_DIRECTIVE)))
+        {
+            *area = (struct text_line){.start = text, .len = end - text};
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+static size_t module_of(struct split *const s, const struct config *const cfg, const size_t k)
+{
+    const size_t r = find_set(&s->sets, k);
+
+    return cfg->used[s->f->labels[k].id] && s->movable[k] && r != s->sets.pinned ? s->module[r] : 0;
+}
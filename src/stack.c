@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Worst-case stack depth over the call graph. Each label records
+ * the peak number of bytes it pushes and how many bytes are in use
+ * at each call, so the worst case for a label is the largest of its
+ * own peak and, for every callee, the bytes in use when calling it
+ * plus the worst case of the callee. Recursive calls are reported
+ * and skipped, so results involving them are lower bounds. */
+
+#include "stack.h"
+#include "alloc.h"
+#include "classify.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+enum state
+{
+    UNVISITED,
+    VISITING,
+    DONE
+};
+
+struct frame_info
+{
+    size_t worst;
+    /* Callee on the critical path, or SIZE_MAX, and
+     * bytes in use when calling it. */
+    size_t next;
+    size_t next_depth;
+    enum state state;
+    bool recursive;
+};
+
+struct analysis
+{
+    const struct tree *t;
+    struct frame_info *info;
+    /* Labels currently being visited, used to report cycles. */
+    size_t *path;
+    size_t n_path;
+    /* Bytes pushed by hardware on interrupt entry. */
+    size_t interrupt_frame;
+    FILE *f;
+};
+
+static void visit(struct analysis *a, size_t id);
+static void print_cycle(const struct analysis *a, size_t id);
+static void print_root(const struct analysis *a, size_t id, bool interrupt);
+
+int report_stack(const struct sdccrm *const c, const struct config *const cfg, FILE *const f)
+{
+    const struct tree *const t = &c->tree;
+    const char *const entry = get_entry_label(c, cfg);
+    struct analysis a =
+    {
+        .t = t,
+        .info = alloc_(NULL, sizeof *a.info, t->n_labels, ALLOC_TABLE),
+        .path = alloc_(NULL, sizeof *a.path, t->n_labels, ALLOC_TABLE),
+        .interrupt_frame = interrupt_frame(c->port),
+        .f = f
+    };
+
+    if (!a.info || !a.path)
+    {
+        alloc_free(a.info);
+        alloc_free(a.path);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        a.info[i] = (struct frame_info){.next = SIZE_MAX};
+    }
+
+    if (cfg->name)
+        fprintf(f, "Stack usage (%s):\n", cfg->name);
+    else
+        fprintf(f, "Stack usage:\n");
+
+    size_t entry_worst = 0, interrupt_worst = 0, entry_id = SIZE_MAX;
+    bool recursive = false;
+
+    /* The entry label goes first, then any other root in file order. */
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < t->n_labels; i++)
+        {
+            const struct label *const l = t->labels[i];
+
+            if (!pass && l->global && !strcmp(l->name, entry))
+            {
+                visit(&a, i);
+                print_root(&a, i, false);
+                entry_worst = a.info[i].worst;
+                recursive |= a.info[i].recursive;
+                entry_id = i;
+                break;
+            }
+            else if (pass && i != entry_id && (l->interrupt || is_label_excluded(c, cfg, l)))
+            {
+                visit(&a, i);
+                print_root(&a, i, l->interrupt);
+                recursive |= a.info[i].recursive;
+
+                if (l->interrupt && a.info[i].worst + a.interrupt_frame > interrupt_worst)
+                {
+                    interrupt_worst = a.info[i].worst + a.interrupt_frame;
+                }
+            }
+        }
+    }
+
+    if (entry_id == SIZE_MAX)
+    {
+        fprintf(f, "  Entry point %s not found.\n", entry);
+    }
+
+    /* Interrupt handlers are assumed not to nest. */
+    fprintf(f, "  Worst case, entry plus deepest interrupt: %s%zu bytes\n",
+        recursive ? "at least " : "", entry_worst + interrupt_worst);
+
+    alloc_free(a.info);
+    alloc_free(a.path);
+
+    return 0;
+}
+
+static void visit(struct analysis *const a, const size_t id)
+{
+    const struct label *const l = a->t->labels[id];
+    struct frame_info *const fi = &a->info[id];
+
+    if (fi->state != UNVISITED)
+        return;
+
+    fi->state = VISITING;
+    fi->worst = l->frame;
+    a->path[a->n_path++] = id;
+
+    for (size_t i = 0; i < l->n_callees; i++)
+    {
+        const size_t callee = l->callees[i];
+        const struct frame_info *const ci = &a->info[callee];
+
+        if (ci->state == VISITING)
+        {
+            print_cycle(a, callee);
+            fi->recursive = true;
+            continue;
+        }
+
+        visit(a, callee);
+        fi->recursive |= ci->recursive;
+
+        if (l->callee_depths[i] + ci->worst > fi->worst)
+        {
+            fi->worst = l->callee_depths[i] + ci->worst;
+            fi->next = callee;
+            fi->next_depth = l->callee_depths[i];
+        }
+    }
+
+    a->n_path--;
+    fi->state = DONE;
+}
+
+static void print_cycle(const struct analysis *const a, const size_t id)
+{
+    const struct tree *const t = a->t;
+    size_t i = a->n_path;
+
+    /* Find where the cycle starts within the current path. */
+    while (i && a->path[i - 1] != id)
+    {
+        i--;
+    }
+
+    fprintf(a->f, "  Recursion:");
+
+    for (i = i ? i - 1 : 0; i < a->n_path; i++)
+    {
+        const struct label *const l = t->labels[a->path[i]];
+
+        fprintf(a->f, " %s (%s) ->", l->name, t->files[l->file].name);
+    }
+
+    fprintf(a->f, " %s\n", t->labels[id]->name);
+}
+
+static void print_root(const struct analysis *const a, const size_t id, const bool interrupt)
+{
+    const struct tree *const t = a->t;
+    const struct frame_info *const root = &a->info[id];
+    /* Bytes in use when entering each label in the chain. */
+    size_t offset = interrupt ? a->interrupt_frame : 0;
+
+    fprintf(a->f, "  %s%s: %s%zu bytes\n", t->labels[id]->name,
+        interrupt ? " (interrupt)" : "", root->recursive ? "at least " : "",
+        root->worst + offset);
+
+    for (size_t i = id; i != SIZE_MAX; i = a->info[i].next)
+    {
+        const struct label *const l = t->labels[i];
+
+        fprintf(a->f, "    %5zu %s (%s), %zu bytes\n", offset, l->name,
+            t->files[l->file].name, l->frame);
+
+        offset += a->info[i].next_depth;
+    }
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "summary.h"
+#include "alloc.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SUMMARY_MAGIC "SDCCRMS\x01"
+#define PLAN_MAGIC "SDCCRMP\x02"
+
+enum
+{
+    LABEL_GLOBAL = 1 << 0,
+    LABEL_INTERRUPT = 1 << 1
+};
+
+struct reader
+{
+    const unsigned char *p, *end;
+    bool error;
+};
+
+static bool put_varint(struct strbuf *out, uint64_t v);
+static bool put_string(struct strbuf *out, const char *s);
+static uint64_t get_varint(struct reader *r);
+static size_t get_size(struct reader *r);
+static size_t get_count(struct reader *r);
+static char *get_string(struct reader *r, enum alloc_tag tag);
+static void free_summary(struct file *f);
+
+uint64_t text_checksum(const char *const buf, const size_t len)
+{
+    /* FNV-1a, 64-bit. */
+    uint64_t h = 14695981039346656037u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char)buf[i]) * 1099511628211u;
+    }
+
+    return h;
+}
+
+int write_summary(const struct file *const f, const char *const name, const uint64_t checksum, struct strbuf *const out)
+{
+    bool ok = strbuf_append(out, SUMMARY_MAGIC, static_strlen(SUMMARY_MAGIC))
+        && put_string(out, name)
+        && put_varint(out, checksum)
+        && put_varint(out, f->n_globals);
+
+    for (size_t i = 0; ok && i < f->n_globals; i++)
+    {
+        ok = put_string(out, f->globals[i]);
+    }
+
+    ok = ok && put_varint(out, f->n_labels);
+
+    for (size_t i = 0; ok && i < f->n_labels; i++)
+    {
+        const struct label *const l = &f->labels[i];
+
+        ok = put_varint(out, (l->global ? LABEL_GLOBAL : 0) | (l->interrupt ? LABEL_INTERRUPT : 0))
+            && put_string(out, l->name)
+            && put_varint(out, l->start_line)
+            && put_varint(out, l->end_line)
+            && put_varint(out, l->frame)
+            && put_varint(out, l->size)
+            && put_varint(out, l->n_calls);
+
+        for (size_t j = 0; ok && j < l->n_calls; j++)
+        {
+            ok = put_string(out, l->calls[j]) && put_varint(out, l->call_depths[j]);
+        }
+    }
+
+    ok = ok && put_varint(out, f->n_roots);
+
+    for (size_t i = 0; ok && i < f->n_roots; i++)
+    {
+        ok = put_string(out, f->roots[i]);
+    }
+
+    return ok ? 0 : ENOMEM;
+}
+
+int read_summary(const void *const buf, const size_t len, struct file *const f, char **const name, uint64_t *const checksum)
+{
+    struct reader r = {.p = buf, .end = (const unsigned char *)buf + len};
+
+    *f = (struct file){0};
+    *name = NULL;
+
+    if (len < static_strlen(SUMMARY_MAGIC) || memcmp(buf, SUMMARY_MAGIC, static_strlen(SUMMARY_MAGIC)))
+        return EINVAL;
+
+    r.p += static_strlen(SUMMARY_MAGIC);
+    *name = get_string(&r, ALLOC_OUTPUT_NAME);
+    *checksum = get_varint(&r);
+
+    const size_t n_globals = get_count(&r);
+
+    if (!r.error && !(f->globals = alloc_(NULL, sizeof *f->globals, n_globals, ALLOC_TABLE)))
+        goto failed;
+
+    for (; !r.error && f->n_globals < n_globals; f->n_globals++)
+    {
+        f->globals[f->n_globals] = get_string(&r, ALLOC_LABEL_NAME);
+    }
+
+    const size_t n_labels = get_count(&r);
+
+    if (!r.error && !(f->labels = alloc_(NULL, sizeof *f->labels, n_labels, ALLOC_TABLE)))
+        goto failed;
+
+    while (!r.error && f->n_labels < n_labels)
+    {
+        struct label *const l = &f->labels[f->n_labels++];
+        const uint64_t flags = get_varint(&r);
+
+        *l = (struct label)
+        {
+            .global = flags & LABEL_GLOBAL,
+            .interrupt = flags & LABEL_INTERRUPT
+        };
+
+        l->name = get_string(&r, ALLOC_LABEL_NAME);
+        l->start_line = get_size(&r);
+        l->end_line = get_size(&r);
+        l->frame = get_size(&r);
+        l->size = get_size(&r);
+
+        const size_t n_calls = get_count(&r);
+
+        if (r.error)
+            break;
+
+        l->calls = alloc_(NULL, sizeof *l->calls, n_calls, ALLOC_CALL_LIST);
+        l->call_depths = alloc_(NULL, sizeof *l->call_depths, n_calls, ALLOC_CALL_LIST);
+
+        if (!l->calls || !l->call_depths)
+            goto failed;
+
+        for (; !r.error && l->n_calls < n_calls; l->n_calls++)
+        {
+            l->calls[l->n_calls] = get_string(&r, ALLOC_CALL_LIST);
+            l->call_depths[l->n_calls] = get_size(&r);
+        }
+    }
+
+    const size_t n_roots = get_count(&r);
+
+    if (!r.error && !(f->roots = alloc_(NULL, sizeof *f->roots, n_roots, ALLOC_TABLE)))
+        goto failed;
+
+    for (; !r.error && f->n_roots < n_roots; f->n_roots++)
+    {
+        f->roots[f->n_roots] = get_string(&r, ALLOC_CALL_LIST);
+    }
+
+    if (!r.error && r.p == r.end)
+        return 0;
+
+    free_summary(f);
+    alloc_free(*name);
+    *name = NULL;
+    return EINVAL;
+
+failed:
+    free_summary(f);
+    alloc_free(*name);
+    *name = NULL;
+    return ENOMEM;
+}
+
+int write_plan(const struct plan *const p, const uint64_t checksum, struct strbuf *const out)
+{
+    bool ok = strbuf_append(out, PLAN_MAGIC, static_strlen(PLAN_MAGIC))
+        && put_varint(out, checksum)
+        && put_varint(out, p->n_spans);
+
+    /* Spans and indices are increasing, so deltas are stored. */
+    for (size_t i = 0, prev = 0; ok && i < p->n_spans; i++)
+    {
+        const struct span *const s = &p->spans[i];
+
+        /* 0 stands for the end of file, since spans are never empty. */
+        ok = put_varint(out, s->start - prev)
+            && put_varint(out, s->end == SIZE_MAX ? 0 : s->end - s->start + 1);
+
+        prev = s->start;
+    }
+
+    ok = ok && put_varint(out, p->n_drop);
+
+    for (size_t i = 0, prev = 0; ok && i < p->n_drop; i++)
+    {
+        ok = put_varint(out, p->drop[i] - prev);
+        prev = p->drop[i];
+    }
+
+    ok = ok && put_varint(out, p->n_edits);
+
+    for (size_t i = 0, prev = 0; ok && i < p->n_edits; i++)
+    {
+        ok = put_varint(out, p->edits[i].line - prev) && put_string(out, p->edits[i].text);
+        prev = p->edits[i].line;
+    }
+
+    return ok ? 0 : ENOMEM;
+}
+
+int read_plan(const void *const buf, const size_t len, struct plan *const p, uint64_t *const checksum)
+{
+    struct reader r = {.p = buf, .end = (const unsigned char *)buf + len};
+
+    *p = (struct plan){0};
+
+    if (len < static_strlen(PLAN_MAGIC) || memcmp(buf, PLAN_MAGIC, static_strlen(PLAN_MAGIC)))
+        return EINVAL;
+
+    r.p += static_strlen(PLAN_MAGIC);
+    *checksum = get_varint(&r);
+
+    const size_t n_spans = get_count(&r);
+
+    if (!r.error && !(p->spans = alloc_(NULL, sizeof *p->spans, n_spans, ALLOC_TABLE)))
+        goto failed;
+
+    for (size_t prev = 0; !r.error && p->n_spans < n_spans; p->n_spans++)
+    {
+        struct span *const s = &p->spans[p->n_spans];
+
+        s->start = prev + get_size(&r);
+
+        const size_t n = get_size(&r);
+
+        s->end = n ? s->start + n - 1 : SIZE_MAX;
+        prev = s->start;
+    }
+
+    const size_t n_drop = get_count(&r);
+
+    if (!r.error && !(p->drop = alloc_(NULL, sizeof *p->drop, n_drop, ALLOC_TABLE)))
+        goto failed;
+
+    for (size_t prev = 0; !r.error && p->n_drop < n_drop; p->n_drop++)
+    {
+        prev = p->drop[p->n_drop] = prev + get_size(&r);
+    }
+
+    const size_t n_edits = get_count(&r);
+
+    if (!r.error && !(p->edits = alloc_(NULL, sizeof *p->edits, n_edits, ALLOC_TABLE)))
+        goto failed;
+
+    for (size_t prev = 0; !r.error && p->n_edits < n_edits; p->n_edits++)
+    {
+        struct edit *const e = &p->edits[p->n_edits];
+
+        prev = e->line = prev + get_size(&r);
+        e->text = get_string(&r, ALLOC_TABLE);
+    }
+
+    if (!r.error && r.p == r.end)
+        return 0;
+
+    free_plan(p);
+    return EINVAL;
+
+failed:
+    free_plan(p);
+    return ENOMEM;
+}
+
+static bool put_varint(struct strbuf *const out, uint64_t v)
+{
+    char b[10];
+    size_t n = 0;
+
+    do
+    {
+        b[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+
+    return strbuf_append(out, b, n);
+}
+
+static bool put_string(struct strbuf *const out, const char *const s)
+{
+    const size_t len = strlen(s);
+
+    return put_varint(out, len) && strbuf_append(out, s, len);
+}
+
+static uint64_t get_varint(struct reader *const r)
+{
+    uint64_t v = 0;
+
+    for (unsigned shift = 0; !r->error; shift += 7)
+    {
+        if (r->p == r->end || shift > 63)
+        {
+            r->error = true;
+            break;
+        }
+
+        const unsigned char b = *r->p++;
+
+        v |= (uint64_t)(b & 0x7f) << shift;
+
+        if (!(b & 0x80))
+            return v;
+    }
+
+    return 0;
+}
+
+static size_t get_size(struct reader *const r)
+{
+    const uint64_t v = get_varint(r);
+
+    if (v > SIZE_MAX)
+    {
+        r->error = true;
+        return 0;
+    }
+
+    return v;
+}
+
+static size_t get_count(struct reader *const r)
+{
+    const size_t n = get_size(r);
+
+    /* Every element takes at least one byte, so counts
+     * exceeding the remaining input are not valid. */
+    if (n > (size_t)(r->end - r->p))
+    {
+        r->error = true;
+        return 0;
+    }
+
+    return n;
+}
+
+static char *get_string(struct reader *const r, const enum alloc_tag tag)
+{
+    const size_t len = get_size(r);
+    char *s;
+
+    if (r->error || len > (size_t)(r->end - r->p))
+    {
+        r->error = true;
+        return NULL;
+    }
+
+    if (!(s = alloc_buf((len + 1) * sizeof *s, tag)))
+    {
+        r->error = true;
+        return NULL;
+    }
+
+    memcpy(s, r->p, len);
+    s[len] = '\0';
+    r->p += len;
+
+    return s;
+}
+
+static void free_summary(struct file *const f)
+{
+    for (size_t i = 0; i < f->n_globals; i++)
+    {
+        alloc_free(f->globals[i]);
+    }
+
+    for (size_t i = 0; i < f->n_roots; i++)
+    {
+        alloc_free(f->roots[i]);
+    }
+
+    for (size_t i = 0; i < f->n_labels; i++)
+    {
+        struct label *const l = &f->labels[i];
+
+        for (size_t j = 0; j < l->n_calls; j++)
+        {
+            alloc_free(l->calls[j]);
+        }
+
+        alloc_free(l->calls);
+        alloc_free(l->call_depths);
+        alloc_free(l->name);
+    }
+
+    alloc_free(f->globals);
+    alloc_free(f->roots);
+    alloc_free(f->labels);
+    *f = (struct file){0};
+}
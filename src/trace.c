@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Chrome/Perfetto trace-event output. Spans are recorded as
+ * complete ("X") events and written as a JSON array on exit,
+ * so the file can be loaded directly into chrome://tracing or
+ * ui.perfetto.dev. */
+
+#include "trace.h"
+#include "alloc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct event
+{
+    const char *name;
+    /* Owned copy of args.file, which may not outlive the span. */
+    char *file;
+    struct trace_args args;
+    uint64_t start;
+    uint64_t end;
+    unsigned tid;
+};
+
+static struct
+{
+    const char *path;
+    struct event *events;
+    size_t n_events;
+    pthread_mutex_t lock;
+} trace =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static atomic_uint next_tid;
+static _Thread_local unsigned tid;
+static _Thread_local bool tid_assigned;
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static unsigned get_tid(void)
+{
+    if (!tid_assigned)
+    {
+        tid = atomic_fetch_add(&next_tid, 1);
+        tid_assigned = true;
+    }
+
+    return tid;
+}
+
+void enable_trace(const char *const path)
+{
+    trace.path = path;
+}
+
+bool tracing(void)
+{
+    return trace.path;
+}
+
+uint64_t trace_begin(void)
+{
+    return tracing() ? now() : 0;
+}
+
+void trace_end(const uint64_t start, const char *const name, const struct trace_args *const args)
+{
+    if (!tracing())
+        return;
+
+    const uint64_t end = now();
+    char *file = NULL;
+
+    if (args && args->file)
+    {
+        const size_t len = strlen(args->file) + 1;
+
+        if ((file = alloc_buf(len * sizeof *file, ALLOC_TABLE)))
+        {
+            memcpy(file, args->file, len);
+        }
+    }
+
+    pthread_mutex_lock(&trace.lock);
+
+    struct event *const events = alloc_grow(trace.events, trace.n_events, ALLOC_TABLE);
+
+    if (events)
+    {
+        trace.events = events;
+        trace.events[trace.n_events++] = (struct event)
+        {
+            .name = name,
+            .file = file,
+            .args = args ? *args : (struct trace_args){0},
+            .start = start,
+            .end = end,
+            .tid = get_tid()
+        };
+    }
+    else
+    {
+        /* Events recorded so far are kept, only this one is lost. */
+        alloc_free(file);
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+}
+
+static void write_string(FILE *const f, const char *s)
+{
+    fputc('"', f);
+
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < ' ')
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+
+    fputc('"', f);
+}
+
+static void write_event(FILE *const f, const struct event *const e, const uint64_t origin)
+{
+    const struct trace_args *const a = &e->args;
+
+    fprintf(f, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+        "\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+        e->name, e->tid, (e->start - origin) / 1000.0, (e->end - e->start) / 1000.0);
+
+    const char *sep = "";
+
+    if (e->file)
+    {
+        fprintf(f, "\"file\": ");
+        write_string(f, e->file);
+        sep = ", ";
+    }
+
+    if (a->bytes)
+    {
+        fprintf(f, "%s\"bytes\": %zu", sep, a->bytes);
+        sep = ", ";
+    }
+
+    if (a->labels)
+    {
+        fprintf(f, "%s\"labels\": %zu", sep, a->labels);
+        sep = ", ";
+    }
+
+    if (a->removed)
+    {
+        fprintf(f, "%s\"removed\": %zu", sep, a->removed);
+    }
+
+    fprintf(f, "}}");
+}
+
+void trace_write(void)
+{
+    if (!tracing())
+        return;
+
+    FILE *const f = fopen(trace.path, "w");
+
+    if (f)
+    {
+        uint64_t origin = UINT64_MAX;
+        unsigned n_threads = 0;
+
+        for (size_t i = 0; i < trace.n_events; i++)
+        {
+            const struct event *const e = &trace.events[i];
+
+            if (e->start < origin)
+                origin = e->start;
+
+            if (e->tid >= n_threads)
+                n_threads = e->tid + 1;
+        }
+
+        fprintf(f, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"args\": {\"name\": \"sdccrm\"}}");
+
+        for (unsigned i = 0; i < n_threads; i++)
+        {
+            fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"tid\": %u, \"args\": {\"name\": \"%s %u\"}}",
+                i, i ? "worker" : "main", i);
+        }
+
+        for (size_t i = 0; i < trace.n_events; i++)
+        {
+            fprintf(f, ",\n");
+            write_event(f, &trace.events[i], origin);
+        }
+
+        fprintf(f, "\n]\n");
+        fclose(f);
+    }
+    else
+    {
+        fprintf(stderr, "Could not open trace file %s\n", trace.path);
+    }
+
+    for (size_t i = 0; i < trace.n_events; i++)
+    {
+        alloc_free(trace.events[i].file);
+    }
+
+    alloc_free(trace.events);
+    trace.events = NULL;
+    trace.n_events = 0;
+}
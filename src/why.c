@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2019  Xavier Del Campo Romero <xavi.dcr@tutanota.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Explains why labels are kept, from the predecessors recorded by
+ * find_references(). Bytes kept alive by a root are those of every
+ * label reachable from it. A label reachable from one root only is
+ * exclusive to it, i.e.: it would be removed along with the root,
+ * which tells where refactoring saves the most memory. */
+
+#include "why.h"
+#include "alloc.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct root_bytes
+{
+    size_t id;
+    size_t exclusive;
+    size_t reachable;
+};
+
+static const char *root_kind(const struct sdccrm *c, const struct config *cfg, const struct label *l);
+static int print_chain(const struct sdccrm *c, const struct config *cfg, const struct label *l, FILE *f);
+static int compare_roots(const void *a, const void *b);
+
+int report_why(const struct sdccrm *const c, const struct config *const cfg, const char *const name, FILE *const f)
+{
+    const struct tree *const t = &c->tree;
+    bool found = false;
+    int ret = 0;
+
+    if (cfg->name)
+        fprintf(f, "Why %s is kept (%s):\n", name, cfg->name);
+    else
+        fprintf(f, "Why %s is kept:\n", name);
+
+    /* Static labels might share their name with others. */
+    for (size_t i = 0; i < t->n_labels && !ret; i++)
+    {
+        const struct label *const l = t->labels[i];
+
+        if (strcmp(l->name, name))
+            continue;
+
+        found = true;
+
+        if (cfg->used[i])
+            ret = print_chain(c, cfg, l, f);
+        else
+            fprintf(f, "  %s (%s) is removed\n", l->name, t->files[l->file].name);
+    }
+
+    if (!found)
+    {
+        fprintf(f, "  %s not found.\n", name);
+    }
+
+    return ret;
+}
+
+int report_why_all(const struct sdccrm *const c, const struct config *const cfg, FILE *const f)
+{
+    enum
+    {
+        NO_ROOT = SIZE_MAX,
+        SHARED = SIZE_MAX - 1
+    };
+
+    const struct tree *const t = &c->tree;
+    struct root_bytes *roots = NULL;
+    size_t n_roots = 0, shared = 0, total = 0;
+    /* Root reaching each label, or SHARED if several do. */
+    size_t *const owner = alloc_(NULL, sizeof *owner, t->n_labels, ALLOC_TABLE);
+    /* Last root each label was visited from. */
+    size_t *const visited = alloc_(NULL, sizeof *visited, t->n_labels, ALLOC_TABLE);
+    size_t *const stack = alloc_(NULL, sizeof *stack, t->n_labels, ALLOC_TABLE);
+    int ret = 0;
+
+    if (!owner || !visited || !stack)
+    {
+        ret = ENOMEM;
+        goto end;
+    }
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        owner[i] = visited[i] = NO_ROOT;
+
+        if (cfg->used[i] && cfg->pred[i] == SIZE_MAX)
+        {
+            if (!(roots = alloc(roots, n_roots, ALLOC_TABLE)))
+            {
+                ret = ENOMEM;
+                goto end;
+            }
+
+            roots[n_roots++] = (struct root_bytes){.id = i};
+        }
+    }
+
+    /* One depth-first search per root. */
+    for (size_t i = 0; i < n_roots; i++)
+    {
+        struct root_bytes *const r = &roots[i];
+        size_t n = 0;
+
+        visited[r->id] = i;
+        stack[n++] = r->id;
+
+        while (n)
+        {
+            const struct label *const l = t->labels[stack[--n]];
+
+            r->reachable += l->size;
+            owner[l->id] = owner[l->id] == NO_ROOT ? i : SHARED;
+
+            for (size_t j = 0; j < l->n_callees; j++)
+            {
+                const size_t callee = l->callees[j];
+
+                if (visited[callee] != i)
+                {
+                    visited[callee] = i;
+                    stack[n++] = callee;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < t->n_labels; i++)
+    {
+        const size_t size = t->labels[i]->size;
+
+        if (owner[i] == SHARED)
+            shared += size;
+        else if (owner[i] != NO_ROOT)
+            roots[owner[i]].exclusive += size;
+
+        if (cfg->used[i])
+            total += size;
+    }
+
+    qsort(roots, n_roots, sizeof *roots, compare_roots);
+
+    if (cfg->name)
+        fprintf(f, "Bytes kept per root (%s):\n", cfg->name);
+    else
+        fprintf(f, "Bytes kept per root:\n");
+
+    fprintf(f, "  %9s %9s  root\n", "exclusive", "reachable");
+
+    for (size_t i = 0; i < n_roots; i++)
+    {
+        const struct label *const l = t->labels[roots[i].id];
+
+        fprintf(f, "  %9zu %9zu  %s (%s), %s\n", roots[i].exclusive, roots[i].reachable,
+            l->name, t->files[l->file].name, root_kind(c, cfg, l));
+    }
+
+    fprintf(f, "  Shared by several roots: %zu bytes\n", shared);
+    fprintf(f, "  Total kept: %zu bytes\n", total);
+
+end:
+    alloc_free(owner);
+    alloc_free(visited);
+    alloc_free(stack);
+    alloc_free(roots);
+    return ret;
+}
+
+static const char *root_kind(const struct sdccrm *const c, const struct config *const cfg, const struct label *const l)
+{
+    if (l->global && !strcmp(l->name, get_entry_label(c, cfg)))
+        return "entry";
+    else if (is_label_excluded(c, cfg, l))
+        return "excluded";
+
+    /* Roots are otherwise referenced from outside any label. */
+    return "address table";
+}
+
+static int print_chain(const struct sdccrm *const c, const struct config *const cfg, const struct label *const l, FILE *const f)
+{
+    const struct tree *const t = &c->tree;
+    size_t n = 0;
+
+    for (size_t i = l->id; i != SIZE_MAX; i = cfg->pred[i])
+    {
+        n++;
+    }
+
+    size_t *const chain = alloc_(NULL, sizeof *chain, n, ALLOC_TABLE);
+
+    if (!chain)
+        return ENOMEM;
+
+    /* Predecessors lead from the label back to its root. */
+    for (size_t i = l->id, j = n; i != SIZE_MAX; i = cfg->pred[i])
+    {
+        chain[--j] = i;
+    }
+
+    const struct label *const root = t->labels[chain[0]];
+
+    fprintf(f, "  %s (%s) is kept by %s %s:\n", l->name, t->files[l->file].name,
+        root_kind(c, cfg, root), root->name);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct label *const cl = t->labels[chain[i]];
+
+        fprintf(f, "    %s%s (%s)\n", i ? "-> " : "", cl->name, t->files[cl->file].name);
+    }
+
+    alloc_free(chain);
+    return 0;
+}
+
+static int compare_roots(const void *const a, const void *const b)
+{
+    const struct root_bytes *const ra = a, *const rb = b;
+
+    /* Most exclusive bytes first, then in file order. */
+    if (ra->exclusive != rb->exclusive)
+        return ra->exclusive < rb->exclusive ? 1 : -1;
+
+    return (ra->id > rb->id) - (ra->id < rb->id);
+}